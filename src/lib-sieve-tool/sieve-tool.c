@@ -307,6 +307,7 @@ void sieve_tool_deinit(struct sieve_tool **_tool)
 
 	/* Deinitialize Sieve engine */
 	sieve_deinit(&tool->svinst);
+	sieve_caches_deinit();
 
 	/* Free options */
 
@@ -559,7 +560,8 @@ struct ostream *sieve_tool_open_output_stream(const char *filename)
  */
 
 struct sieve_binary *sieve_tool_script_compile
-(struct sieve_instance *svinst, const char *filename, const char *name)
+(struct sieve_instance *svinst, const char *filename, const char *name,
+	enum sieve_compile_flags flags)
 {
 	struct sieve_error_handler *ehandler;
 	struct sieve_binary *sbin;
@@ -569,7 +571,7 @@ struct sieve_binary *sieve_tool_script_compile
 	sieve_error_handler_accept_debuglog(ehandler, svinst->debug);
 
 	if ( (sbin = sieve_compile
-		(svinst, filename, name, ehandler, 0, NULL)) == NULL )
+		(svinst, filename, name, ehandler, flags, NULL)) == NULL )
 		i_fatal("failed to compile sieve script '%s'", filename);
 
 	sieve_error_handler_unref(&ehandler);
@@ -413,9 +413,10 @@ static int act_reject_check_duplicate
 	const struct sieve_action *act_other)
 {
 	if ( !act_other->executed ) {
-		sieve_runtime_error(renv, act->location,
+		sieve_runtime_error(renv, sieve_action_get_location(act),
 			"duplicate reject/ereject action not allowed "
-			"(previously triggered one was here: %s)", act_other->location);
+			"(previously triggered one was here: %s)",
+			sieve_action_get_location(act_other));
 		return -1;
 	}
 
@@ -429,10 +430,10 @@ int act_reject_check_conflict
 {
 	if ( (act_other->def->flags & SIEVE_ACTFLAG_TRIES_DELIVER) > 0 ) {
 		if ( !act_other->executed ) {
-			sieve_runtime_error(renv, act->location,
+			sieve_runtime_error(renv, sieve_action_get_location(act),
 				"reject/ereject action conflicts with other action: "
 				"the %s action (%s) tries to deliver the message",
-				act_other->def->name, act_other->location);
+				act_other->def->name, sieve_action_get_location(act_other));
 			return -1;
 		}
 	}
@@ -441,10 +442,10 @@ int act_reject_check_conflict
 		struct act_reject_context *rj_ctx;
 
 		if ( !act_other->executed ) {
-			sieve_runtime_error(renv, act->location,
+			sieve_runtime_error(renv, sieve_action_get_location(act),
 				"reject/ereject action conflicts with other action: "
 				"the %s action (%s) also sends a response to the sender",
-				act_other->def->name, act_other->location);
+				act_other->def->name, sieve_action_get_location(act_other));
 			return -1;
 		}
 
@@ -5,6 +5,7 @@
  */
 
 #include "lib.h"
+#include "hash.h"
 
 #include "sieve-match-types.h"
 #include "sieve-comparators.h"
@@ -17,9 +18,11 @@
  * Forward declarations
  */
 
+static void mcht_contains_match_init(struct sieve_match_context *mctx);
 static int mcht_contains_match_key
 	(struct sieve_match_context *mctx, const char *val, size_t val_size,
 		const char *key, size_t key_size);
+static void mcht_contains_match_deinit(struct sieve_match_context *mctx);
 
 /*
  * Match-type object
@@ -29,20 +32,183 @@ const struct sieve_match_type_def contains_match_type = {
 	SIEVE_OBJECT("contains",
 		&match_type_operand, SIEVE_MATCH_TYPE_CONTAINS),
 	.validate_context = sieve_match_substring_validate_context,
-	.match_key = mcht_contains_match_key
+	.match_init = mcht_contains_match_init,
+	.match_key = mcht_contains_match_key,
+	.match_deinit = mcht_contains_match_deinit
 };
 
 /*
  * Match-type implementation
  */
 
-/* FIXME: Naive substring match implementation. Should switch to more
- * efficient algorithm if large values need to be searched (e.g. message body).
+/* Substring search for the i;octet and i;ascii-casemap comparators uses the
+ * Boyer-Moore-Horspool algorithm. The shift table for a key is computed only
+ * once per match context, which means that it is shared by all values that are
+ * matched against the same key list. Other comparators use the naive
+ * substring match, driven by the comparator's char_match() function.
  */
+
+struct mcht_contains_key {
+	const unsigned char *key;
+	size_t key_size;
+
+	/* Shift table; shifts are capped at 255, which only makes the search
+	   slightly less efficient for long keys */
+	uint8_t shift[256];
+};
+
+struct mcht_contains_context {
+	bool icase;
+	HASH_TABLE(const char *, struct mcht_contains_key *) keys;
+};
+
+static void mcht_contains_match_init
+(struct sieve_match_context *mctx)
+{
+	const struct sieve_comparator *cmp = mctx->comparator;
+	struct mcht_contains_context *ctx;
+
+	if ( sieve_comparator_is(cmp, i_octet_comparator) ) {
+		ctx = p_new(mctx->pool, struct mcht_contains_context, 1);
+	} else if ( sieve_comparator_is(cmp, i_ascii_casemap_comparator) ) {
+		ctx = p_new(mctx->pool, struct mcht_contains_context, 1);
+		ctx->icase = TRUE;
+	} else {
+		return;
+	}
+
+	mctx->data = (void *)ctx;
+}
+
+static void mcht_contains_match_deinit
+(struct sieve_match_context *mctx)
+{
+	struct mcht_contains_context *ctx =
+		(struct mcht_contains_context *)mctx->data;
+
+	if ( ctx != NULL && hash_table_is_created(ctx->keys) )
+		hash_table_destroy(&ctx->keys);
+}
+
+static struct mcht_contains_key *mcht_contains_key_get
+(struct sieve_match_context *mctx, const char *key, size_t key_size)
+{
+	struct mcht_contains_context *ctx =
+		(struct mcht_contains_context *)mctx->data;
+	struct mcht_contains_key *ckey;
+	size_t i, last = key_size - 1;
+	unsigned int shift;
+
+	/* Keys with embedded NUL characters cannot be used as hash key */
+	if ( strlen(key) != key_size )
+		ckey = NULL;
+	else if ( !hash_table_is_created(ctx->keys) ) {
+		hash_table_create(&ctx->keys, mctx->pool, 0, str_hash, strcmp);
+		ckey = NULL;
+	} else {
+		ckey = hash_table_lookup(ctx->keys, key);
+		if ( ckey != NULL )
+			return ckey;
+	}
+
+	ckey = p_new(mctx->pool, struct mcht_contains_key, 1);
+	ckey->key = (const unsigned char *)p_strndup(mctx->pool, key, key_size);
+	ckey->key_size = key_size;
+
+	/* Compose shift table */
+	shift = ( key_size > 255 ? 255 : key_size );
+	memset(ckey->shift, shift, sizeof(ckey->shift));
+	for ( i = 0; i < last; i++ ) {
+		unsigned char c = ckey->key[i];
+
+		shift = ( last - i > 255 ? 255 : last - i );
+		if ( ctx->icase ) {
+			ckey->shift[(unsigned char)i_tolower(c)] = shift;
+			ckey->shift[(unsigned char)i_toupper(c)] = shift;
+		} else {
+			ckey->shift[c] = shift;
+		}
+	}
+
+	if ( strlen(key) == key_size )
+		hash_table_insert(ctx->keys, (const char *)ckey->key, ckey);
+	return ckey;
+}
+
+static bool mcht_contains_search_octet
+(const struct mcht_contains_key *ckey,
+	const unsigned char *val, size_t val_size)
+{
+	const unsigned char *key = ckey->key;
+	size_t key_size = ckey->key_size, last = key_size - 1;
+	const unsigned char *vp, *vend;
+	unsigned char klast = key[last];
+
+	if ( key_size == 1 )
+		return ( memchr(val, key[0], val_size) != NULL );
+
+	vp = val;
+	vend = val + val_size - key_size;
+	while ( vp <= vend ) {
+		unsigned char c = vp[last];
+
+		if ( c == klast && memcmp(vp, key, last) == 0 )
+			return TRUE;
+		vp += ckey->shift[c];
+	}
+	return FALSE;
+}
+
+static inline bool mcht_contains_equals_icase
+(const unsigned char *val, const unsigned char *key, size_t size)
+{
+	size_t i;
+
+	for ( i = 0; i < size; i++ ) {
+		if ( i_tolower(val[i]) != i_tolower(key[i]) )
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static bool mcht_contains_search_icase
+(const struct mcht_contains_key *ckey,
+	const unsigned char *val, size_t val_size)
+{
+	const unsigned char *key = ckey->key;
+	size_t key_size = ckey->key_size, last = key_size - 1;
+	const unsigned char *vp, *vend;
+	char klast = i_tolower(key[last]);
+
+	if ( key_size == 1 ) {
+		unsigned char klower = i_tolower(key[0]), kupper = i_toupper(key[0]);
+
+		/* Scan for either case using memchr() */
+		if ( klower == kupper )
+			return ( memchr(val, klower, val_size) != NULL );
+		return ( memchr(val, klower, val_size) != NULL ||
+			memchr(val, kupper, val_size) != NULL );
+	}
+
+	vp = val;
+	vend = val + val_size - key_size;
+	while ( vp <= vend ) {
+		unsigned char c = vp[last];
+
+		if ( i_tolower(c) == klast &&
+			mcht_contains_equals_icase(vp, key, last) )
+			return TRUE;
+		vp += ckey->shift[c];
+	}
+	return FALSE;
+}
+
 static int mcht_contains_match_key
 (struct sieve_match_context *mctx, const char *val, size_t val_size,
 	const char *key, size_t key_size)
 {
+	struct mcht_contains_context *ctx =
+		(struct mcht_contains_context *)mctx->data;
 	const struct sieve_comparator *cmp = mctx->comparator;
 	const char *vend = (const char *) val + val_size;
 	const char *kend = (const char *) key + key_size;
@@ -52,9 +218,28 @@ static int mcht_contains_match_key
 	if ( val_size == 0 )
 		return ( key_size == 0 ? 1 : 0 );
 
+	if ( ctx != NULL ) {
+		const struct mcht_contains_key *ckey;
+
+		/* Fast substring search */
+		if ( key_size == 0 )
+			return 1;
+		if ( key_size > val_size )
+			return 0;
+
+		ckey = mcht_contains_key_get(mctx, key, key_size);
+		if ( ctx->icase ) {
+			return ( mcht_contains_search_icase
+				(ckey, (const unsigned char *)val, val_size) ? 1 : 0 );
+		}
+		return ( mcht_contains_search_octet
+			(ckey, (const unsigned char *)val, val_size) ? 1 : 0 );
+	}
+
 	if ( cmp->def == NULL || cmp->def->char_match == NULL )
 		return 0;
 
+	/* Naive substring match */
 	while ( (vp < vend) && (kp < kend) ) {
 		if ( !cmp->def->char_match(cmp, &vp, vend, &kp, kend) )
 			vp++;
@@ -62,5 +247,3 @@ static int mcht_contains_match_key
 
 	return ( kp == kend ? 1 : 0 );
 }
-
-
@@ -10,13 +10,49 @@
 #include "mail-storage.h"
 
 #include "sieve-common.h"
+#include "sieve-settings.h"
+#include "sieve-extensions.h"
 #include "sieve-stringlist.h"
 #include "sieve-code.h"
 #include "sieve-message.h"
+#include "sieve-match.h"
 #include "sieve-interpreter.h"
 
 #include "ext-body-common.h"
 
+/*
+ * Extension
+ */
+
+bool ext_body_load
+(const struct sieve_extension *ext, void **context)
+{
+	struct sieve_instance *svinst = ext->svinst;
+	struct ext_body_context *ctx;
+	size_t stream_min_size;
+
+	if ( *context != NULL )
+		ext_body_unload(ext);
+
+	if ( !sieve_setting_get_size_value
+		(svinst, "sieve_body_stream_min_size", &stream_min_size) )
+		stream_min_size = EXT_BODY_DEFAULT_STREAM_MIN_SIZE;
+
+	ctx = i_new(struct ext_body_context, 1);
+	ctx->stream_min_size = stream_min_size;
+
+	*context = (void *)ctx;
+	return TRUE;
+}
+
+void ext_body_unload
+(const struct sieve_extension *ext)
+{
+	struct ext_body_context *ctx =
+		(struct ext_body_context *)ext->context;
+
+	i_free(ctx);
+}
 
 /*
  * Body part stringlist
@@ -100,3 +136,116 @@ static void ext_body_stringlist_reset
 
 	strlist->body_parts_iter = strlist->body_parts;
 }
+
+/*
+ * Streamed body matching
+ */
+
+/* Large message bodies are matched while they are being decoded, so that the
+   decoded body parts never need to be held in memory. */
+
+struct ext_body_match_sink {
+	struct sieve_message_body_sink sink;
+
+	struct sieve_match_stream *mstream;
+};
+
+static void ext_body_match_part_begin
+(struct sieve_message_body_sink *_sink)
+{
+	struct ext_body_match_sink *sink =
+		(struct ext_body_match_sink *)_sink;
+
+	sieve_match_stream_value_begin(sink->mstream);
+}
+
+static int ext_body_match_part_more
+(struct sieve_message_body_sink *_sink, const unsigned char *data,
+	size_t size)
+{
+	struct ext_body_match_sink *sink =
+		(struct ext_body_match_sink *)_sink;
+
+	return ( sieve_match_stream_value_more(sink->mstream, data, size) > 0 ?
+		1 : 0 );
+}
+
+static int ext_body_match_part_end
+(struct sieve_message_body_sink *_sink)
+{
+	struct ext_body_match_sink *sink =
+		(struct ext_body_match_sink *)_sink;
+
+	return ( sieve_match_stream_value_end(sink->mstream) > 0 ? 1 : 0 );
+}
+
+static bool ext_body_stream_wanted
+(const struct sieve_runtime_env *renv)
+{
+	const struct sieve_extension *this_ext = renv->oprtn->ext;
+	struct ext_body_context *ctx =
+		(struct ext_body_context *)this_ext->context;
+	struct mail *mail = sieve_message_get_mail(renv->msgctx);
+	uoff_t size;
+
+	if ( ctx == NULL || ctx->stream_min_size == 0 )
+		return FALSE;
+
+	/* Errors are reported when the body is read */
+	if ( mail_get_physical_size(mail, &size) < 0 )
+		return FALSE;
+	return ( size >= ctx->stream_min_size );
+}
+
+int ext_body_stream_match
+(const struct sieve_runtime_env *renv, enum tst_body_transform transform,
+	const char * const *content_types,
+	const struct sieve_match_type *mcht,
+	const struct sieve_comparator *cmp,
+	struct sieve_stringlist *key_list, bool *streamed_r, int *match_r)
+{
+	static const char * const _no_content_types[] = { "", NULL };
+	struct ext_body_match_sink sink;
+	struct sieve_match_context *mctx;
+	int ret;
+
+	*streamed_r = FALSE;
+	*match_r = 0;
+
+	if ( !ext_body_stream_wanted(renv) )
+		return SIEVE_EXEC_OK;
+
+	if ( (mctx=sieve_match_begin(renv, mcht, cmp)) == NULL )
+		return SIEVE_EXEC_OK;
+
+	i_zero(&sink);
+	sink.sink.part_begin = ext_body_match_part_begin;
+	sink.sink.part_more = ext_body_match_part_more;
+	sink.sink.part_end = ext_body_match_part_end;
+	if ( (sink.mstream=sieve_match_stream_begin(mctx, key_list)) == NULL ) {
+		/* Cannot match incrementally */
+		(void)sieve_match_end(&mctx, NULL);
+		return SIEVE_EXEC_OK;
+	}
+
+	if ( content_types == NULL ) content_types = _no_content_types;
+
+	switch ( transform ) {
+	case TST_BODY_TRANSFORM_RAW:
+		ret = sieve_message_body_stream_raw(renv, &sink.sink);
+		break;
+	case TST_BODY_TRANSFORM_CONTENT:
+		ret = sieve_message_body_stream_content
+			(renv, content_types, &sink.sink);
+		break;
+	case TST_BODY_TRANSFORM_TEXT:
+		ret = sieve_message_body_stream_text(renv, &sink.sink);
+		break;
+	default:
+		i_unreached();
+	}
+
+	*streamed_r = TRUE;
+	*match_r = sieve_match_end(&mctx, NULL);
+	return ret;
+}
@@ -20,6 +20,17 @@ enum tst_body_transform {
 
 extern const struct sieve_extension_def body_extension;
 
+#define EXT_BODY_DEFAULT_STREAM_MIN_SIZE (1024*1024)
+
+struct ext_body_context {
+	size_t stream_min_size;
+};
+
+bool ext_body_load
+	(const struct sieve_extension *ext, void **context);
+void ext_body_unload
+	(const struct sieve_extension *ext);
+
 /*
  * Commands
  */
@@ -40,4 +51,11 @@ int ext_body_get_part_list
 	(const struct sieve_runtime_env *renv, enum tst_body_transform transform,
 		const char * const *content_types, struct sieve_stringlist **strlist_r);
 
+int ext_body_stream_match
+	(const struct sieve_runtime_env *renv, enum tst_body_transform transform,
+		const char * const *content_types,
+		const struct sieve_match_type *mcht,
+		const struct sieve_comparator *cmp,
+		struct sieve_stringlist *key_list, bool *streamed_r, int *match_r);
+
 #endif /* __EXT_BODY_COMMON_H */
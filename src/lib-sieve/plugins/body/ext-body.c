@@ -38,6 +38,8 @@ static bool ext_body_validator_load
 
 const struct sieve_extension_def body_extension = {
 	.name = "body",
+	.load = ext_body_load,
+	.unload = ext_body_unload,
 	.validator_load =	ext_body_validator_load,
 	SIEVE_EXT_DEFINE_OPERATION(body_operation)
 };
@@ -303,7 +303,7 @@ static int ext_body_operation_execute
 		SIEVE_MATCH_TYPE_DEFAULT(is_match_type);
 	unsigned int transform = TST_BODY_TRANSFORM_TEXT;
 	struct sieve_stringlist *ctype_list, *value_list, *key_list;
-	bool mvalues_active;
+	bool mvalues_active, streamed;
 	const char * const *content_types = NULL;
 	int match, ret;
 
@@ -362,21 +362,28 @@ static int ext_body_operation_execute
 
 	sieve_runtime_trace(renv, SIEVE_TRLVL_TESTS, "body test");
 
-	/* Extract requested parts */
-	if ( (ret=ext_body_get_part_list(renv,
-		(enum tst_body_transform) transform, content_types,&value_list)) <= 0 )
-		return ret;
-
 	/* Disable match values processing as required by RFC */
 	mvalues_active = sieve_match_values_set_enabled(renv, FALSE);
 
-	/* Perform match */
-	match = sieve_match(renv, &mcht, &cmp, value_list, key_list, &ret);
+	/* Match large bodies while extracting them */
+	ret = ext_body_stream_match(renv, (enum tst_body_transform) transform,
+		content_types, &mcht, &cmp, key_list, &streamed, &match);
+
+	if ( ret > 0 && !streamed ) {
+		/* Extract requested parts */
+		if ( (ret=ext_body_get_part_list(renv, (enum tst_body_transform)
+			transform, content_types, &value_list)) > 0 ) {
+			/* Perform match */
+			match = sieve_match(renv, &mcht, &cmp, value_list, key_list, &ret);
+			if ( match >= 0 )
+				ret = SIEVE_EXEC_OK;
+		}
+	}
 
 	/* Restore match values processing */
 	(void)sieve_match_values_set_enabled(renv, mvalues_active);
 
-	if ( match < 0 )
+	if ( ret <= 0 )
 		return ret;
 
 	/* Set test result for subsequent conditional jump */
@@ -516,7 +516,7 @@ static int act_notify_check_duplicate
 	nenv.svinst = renv->svinst;
 	nenv.method = nact->method;
 	nenv.ehandler = sieve_prefix_ehandler_create
-		(renv->ehandler, act->location, "notify");
+		(renv->ehandler, sieve_action_get_location(act), "notify");
 
 	result = nmth_def->action_check_duplicates(&nenv, nact, nact_other);
 
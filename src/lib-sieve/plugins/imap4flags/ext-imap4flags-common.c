@@ -2,6 +2,8 @@
  */
 
 #include "lib.h"
+#include "array.h"
+#include "hash.h"
 #include "str.h"
 #include "str-sanitize.h"
 #include "mail-storage.h"
@@ -172,38 +174,137 @@ void sieve_ext_imap4flags_register_side_effect
  * Result context
  */
 
+/* The internal variable is kept as a list of flags rather than as a string.
+ * Flags keep the spelling they were first added with and the order in which
+ * they were added, like they would in the string. A (case-insensitive) hash
+ * set indexes the list, so that adding or removing a flag needs no scan of the
+ * string. Flag names are interned, so that a flag that is added repeatedly is
+ * only allocated once. The string representation is only built when the
+ * internal variable is actually read.
+ */
+
 struct ext_imap4flags_result_context {
-    string_t *internal_flags;
+	pool_t pool;
+
+	/* Flags in the order they were added */
+	ARRAY(const char *) flags_list;
+	/* Flags in flags_list, case-insensitively */
+	HASH_TABLE(const char *, const char *) flags_set;
+	/* Every flag name seen so far */
+	HASH_TABLE(const char *, const char *) names;
+
+	/* System flags in flags_list */
+	enum mail_flags flags;
+	/* Keywords in flags_list; rebuilt when needed */
+	ARRAY(const char *) keywords;
+
+	string_t *flags_string;
+	bool flags_string_valid:1;
+	bool keywords_valid:1;
+};
+
+static const struct {
+	const char *name;
+	enum mail_flags flag;
+} _system_flags[] = {
+	{ "\\flagged", MAIL_FLAGGED },
+	{ "\\answered", MAIL_ANSWERED },
+	{ "\\deleted", MAIL_DELETED },
+	{ "\\seen", MAIL_SEEN },
+	{ "\\draft", MAIL_DRAFT }
 };
 
+static enum mail_flags _get_system_flag(const char *flag)
+{
+	unsigned int i;
+
+	for ( i = 0; i < N_ELEMENTS(_system_flags); i++ ) {
+		if ( strcasecmp(flag, _system_flags[i].name) == 0 )
+			return _system_flags[i].flag;
+	}
+	return 0;
+}
+
+static void _internal_flags_changed
+(struct ext_imap4flags_result_context *rctx)
+{
+	rctx->flags_string_valid = FALSE;
+	rctx->keywords_valid = FALSE;
+}
+
+static void _internal_flags_add
+(struct ext_imap4flags_result_context *rctx, const char *flag)
+{
+	const char *name;
+
+	if ( hash_table_lookup(rctx->flags_set, flag) != NULL )
+		return;
+
+	name = hash_table_lookup(rctx->names, flag);
+	if ( name == NULL ) {
+		name = p_strdup(rctx->pool, flag);
+		hash_table_insert(rctx->names, name, name);
+	}
+
+	array_append(&rctx->flags_list, &name, 1);
+	hash_table_insert(rctx->flags_set, name, name);
+	if ( *flag == '\\' )
+		rctx->flags |= _get_system_flag(flag);
+	_internal_flags_changed(rctx);
+}
+
+static void _internal_flags_remove
+(struct ext_imap4flags_result_context *rctx, const char *flag)
+{
+	const char *const *flags;
+	const char *name;
+	unsigned int count, i;
+
+	name = hash_table_lookup(rctx->flags_set, flag);
+	if ( name == NULL )
+		return;
+	hash_table_remove(rctx->flags_set, name);
+
+	flags = array_get(&rctx->flags_list, &count);
+	for ( i = 0; i < count; i++ ) {
+		if ( flags[i] == name ) {
+			array_delete(&rctx->flags_list, i, 1);
+			break;
+		}
+	}
+	if ( *flag == '\\' )
+		rctx->flags &= ~_get_system_flag(flag);
+	_internal_flags_changed(rctx);
+}
+
+static void _internal_flags_clear
+(struct ext_imap4flags_result_context *rctx)
+{
+	array_clear(&rctx->flags_list);
+	hash_table_clear(rctx->flags_set, TRUE);
+	rctx->flags = 0;
+	_internal_flags_changed(rctx);
+}
+
 static void _get_initial_flags
-(struct sieve_result *result, string_t *flags)
+(struct sieve_result *result, struct ext_imap4flags_result_context *rctx)
 {
 	const struct sieve_message_data *msgdata =
 		sieve_result_get_message_data(result);
 	enum mail_flags mail_flags;
 	const char *const *mail_keywords;
+	unsigned int i;
 
 	mail_flags = mail_get_flags(msgdata->mail);
 	mail_keywords = mail_get_keywords(msgdata->mail);
 
-	if ( (mail_flags & MAIL_FLAGGED) > 0 )
-		str_printfa(flags, " \\flagged");
-
-	if ( (mail_flags & MAIL_ANSWERED) > 0 )
-		str_printfa(flags, " \\answered");
-
-	if ( (mail_flags & MAIL_DELETED) > 0 )
-		str_printfa(flags, " \\deleted");
-
-	if ( (mail_flags & MAIL_SEEN) > 0 )
-		str_printfa(flags, " \\seen");
-
-	if ( (mail_flags & MAIL_DRAFT) > 0 )
-		str_printfa(flags, " \\draft");
+	for ( i = 0; i < N_ELEMENTS(_system_flags); i++ ) {
+		if ( (mail_flags & _system_flags[i].flag) != 0 )
+			_internal_flags_add(rctx, _system_flags[i].name);
+	}
 
 	while ( *mail_keywords != NULL ) {
-		str_printfa(flags, " %s", *mail_keywords);
+		_internal_flags_add(rctx, *mail_keywords);
 		mail_keywords++;
 	}
 }
@@ -219,8 +320,14 @@ static inline struct ext_imap4flags_result_context *_get_result_context
 		pool_t pool = sieve_result_pool(result);
 
 		rctx =p_new(pool, struct ext_imap4flags_result_context, 1);
-		rctx->internal_flags = str_new(pool, 32);
-		_get_initial_flags(result, rctx->internal_flags);
+		rctx->pool = pool;
+		p_array_init(&rctx->flags_list, pool, 8);
+		hash_table_create
+			(&rctx->flags_set, pool, 0, strcase_hash, strcasecmp);
+		hash_table_create(&rctx->names, pool, 0, str_hash, strcmp);
+		p_array_init(&rctx->keywords, pool, 4);
+		rctx->flags_string = str_new(pool, 32);
+		_get_initial_flags(result, rctx);
 
 		sieve_result_extension_set_context
 			(result, this_ext, rctx);
@@ -232,10 +339,22 @@ static inline struct ext_imap4flags_result_context *_get_result_context
 static string_t *_get_flags_string
 (const struct sieve_extension *this_ext, struct sieve_result *result)
 {
-	struct ext_imap4flags_result_context *ctx =
+	struct ext_imap4flags_result_context *rctx =
 		_get_result_context(this_ext, result);
+	const char *const *flag;
 
-	return ctx->internal_flags;
+	if ( rctx->flags_string_valid )
+		return rctx->flags_string;
+
+	str_truncate(rctx->flags_string, 0);
+	array_foreach(&rctx->flags_list, flag) {
+		if ( str_len(rctx->flags_string) > 0 )
+			str_append_c(rctx->flags_string, ' ');
+		str_append(rctx->flags_string, *flag);
+	}
+
+	rctx->flags_string_valid = TRUE;
+	return rctx->flags_string;
 }
 
 /*
@@ -398,13 +517,6 @@ static void ext_imap4flags_iter_delete_last
 
 /* Flag operations */
 
-static string_t *ext_imap4flags_get_flag_variable
-(const struct sieve_runtime_env *renv,
-	const struct sieve_extension *flg_ext,
-	struct sieve_variable_storage *storage,
-	unsigned int var_index)
-	ATTR_NULL(2);
-
 static bool flags_list_flag_exists
 (string_t *flags_list, const char *flag)
 {
@@ -480,35 +592,62 @@ static void flags_list_clear_flags
 	str_truncate(flags_list, 0);
 }
 
+static void internal_flags_add_flags
+(struct ext_imap4flags_result_context *rctx, string_t *flags)
+{
+	const char *flg;
+	struct ext_imap4flags_iter flit;
+
+	ext_imap4flags_iter_init(&flit, flags);
+
+	while ( (flg=ext_imap4flags_iter_get_flag(&flit)) != NULL ) {
+		if ( sieve_ext_imap4flags_flag_is_valid(flg) )
+			_internal_flags_add(rctx, flg);
+	}
+}
+
+static void internal_flags_remove_flags
+(struct ext_imap4flags_result_context *rctx, string_t *flags)
+{
+	const char *flg;
+	struct ext_imap4flags_iter flit;
+
+	ext_imap4flags_iter_init(&flit, flags);
+
+	while ( (flg=ext_imap4flags_iter_get_flag(&flit)) != NULL )
+		_internal_flags_remove(rctx, flg);
+}
+
 static string_t *ext_imap4flags_get_flag_variable
 (const struct sieve_runtime_env *renv,
-	const struct sieve_extension *flg_ext,
 	struct sieve_variable_storage *storage,
 	unsigned int var_index)
 {
 	string_t *flags;
 
-	if ( storage != NULL ) {
-		if ( sieve_runtime_trace_active(renv, SIEVE_TRLVL_COMMANDS) ) {
-			const char *var_name, *var_id;
+	if ( sieve_runtime_trace_active(renv, SIEVE_TRLVL_COMMANDS) ) {
+		const char *var_name, *var_id;
 
-			(void)sieve_variable_get_identifier(storage, var_index, &var_name);
-			var_id = sieve_variable_get_varid(storage, var_index);
+		(void)sieve_variable_get_identifier(storage, var_index, &var_name);
+		var_id = sieve_variable_get_varid(storage, var_index);
 
-			sieve_runtime_trace(renv, 0, "update variable `%s' [%s]",
-				var_name, var_id);
-		}
-
-		if ( !sieve_variable_get_modifiable(storage, var_index, &flags) )
-			return NULL;
-	} else {
-		i_assert( sieve_extension_is(flg_ext, imap4flags_extension) );
-		flags = _get_flags_string(flg_ext, renv->result);
+		sieve_runtime_trace(renv, 0, "update variable `%s' [%s]",
+			var_name, var_id);
 	}
 
+	if ( !sieve_variable_get_modifiable(storage, var_index, &flags) )
+		return NULL;
+
 	return flags;
 }
 
+static struct ext_imap4flags_result_context *ext_imap4flags_get_internal_flags
+(const struct sieve_runtime_env *renv, const struct sieve_extension *flg_ext)
+{
+	i_assert( sieve_extension_is(flg_ext, imap4flags_extension) );
+	return _get_result_context(flg_ext, renv->result);
+}
+
 int sieve_ext_imap4flags_set_flags
 (const struct sieve_runtime_env *renv,
 	const struct sieve_extension *flg_ext,
@@ -516,27 +655,33 @@ int sieve_ext_imap4flags_set_flags
 	unsigned int var_index,
 	struct sieve_stringlist *flags)
 {
-	string_t *cur_flags = ext_imap4flags_get_flag_variable
-		(renv, flg_ext, storage, var_index);
-
-	if ( cur_flags != NULL ) {
-		string_t *flags_item;
-		int ret;
+	struct ext_imap4flags_result_context *rctx = NULL;
+	string_t *cur_flags = NULL, *flags_item;
+	int ret;
 
+	if ( storage != NULL ) {
+		cur_flags = ext_imap4flags_get_flag_variable(renv, storage, var_index);
+		if ( cur_flags == NULL )
+			return SIEVE_EXEC_BIN_CORRUPT;
 		flags_list_clear_flags(cur_flags);
-		while ( (ret=sieve_stringlist_next_item(flags, &flags_item)) > 0 ) {
-			sieve_runtime_trace(renv, SIEVE_TRLVL_COMMANDS,
-				"set flags `%s'", str_c(flags_item));
-
-			flags_list_add_flags(cur_flags, flags_item);
-		}
+	} else {
+		rctx = ext_imap4flags_get_internal_flags(renv, flg_ext);
+		_internal_flags_clear(rctx);
+	}
 
-		if ( ret < 0 ) return SIEVE_EXEC_BIN_CORRUPT;
+	while ( (ret=sieve_stringlist_next_item(flags, &flags_item)) > 0 ) {
+		sieve_runtime_trace(renv, SIEVE_TRLVL_COMMANDS,
+			"set flags `%s'", str_c(flags_item));
 
-		return SIEVE_EXEC_OK;
+		if ( cur_flags != NULL )
+			flags_list_add_flags(cur_flags, flags_item);
+		else
+			internal_flags_add_flags(rctx, flags_item);
 	}
 
-	return SIEVE_EXEC_BIN_CORRUPT;
+	if ( ret < 0 ) return SIEVE_EXEC_BIN_CORRUPT;
+
+	return SIEVE_EXEC_OK;
 }
 
 int sieve_ext_imap4flags_add_flags
@@ -546,26 +691,31 @@ int sieve_ext_imap4flags_add_flags
 	unsigned int var_index,
 	struct sieve_stringlist *flags)
 {
-	string_t *cur_flags = ext_imap4flags_get_flag_variable
-		(renv, flg_ext, storage, var_index);
+	struct ext_imap4flags_result_context *rctx = NULL;
+	string_t *cur_flags = NULL, *flags_item;
+	int ret;
 
-	if ( cur_flags != NULL ) {
-		string_t *flags_item;
-		int ret;
+	if ( storage != NULL ) {
+		cur_flags = ext_imap4flags_get_flag_variable(renv, storage, var_index);
+		if ( cur_flags == NULL )
+			return SIEVE_EXEC_BIN_CORRUPT;
+	} else {
+		rctx = ext_imap4flags_get_internal_flags(renv, flg_ext);
+	}
 
-		while ( (ret=sieve_stringlist_next_item(flags, &flags_item)) > 0 ) {
-			sieve_runtime_trace(renv, SIEVE_TRLVL_COMMANDS,
-				"add flags `%s'", str_c(flags_item));
+	while ( (ret=sieve_stringlist_next_item(flags, &flags_item)) > 0 ) {
+		sieve_runtime_trace(renv, SIEVE_TRLVL_COMMANDS,
+			"add flags `%s'", str_c(flags_item));
 
+		if ( cur_flags != NULL )
 			flags_list_add_flags(cur_flags, flags_item);
-		}
-
-		if ( ret < 0 ) return SIEVE_EXEC_BIN_CORRUPT;
-
-		return SIEVE_EXEC_OK;
+		else
+			internal_flags_add_flags(rctx, flags_item);
 	}
 
-	return SIEVE_EXEC_BIN_CORRUPT;
+	if ( ret < 0 ) return SIEVE_EXEC_BIN_CORRUPT;
+
+	return SIEVE_EXEC_OK;
 }
 
 int sieve_ext_imap4flags_remove_flags
@@ -575,26 +725,31 @@ int sieve_ext_imap4flags_remove_flags
 	unsigned int var_index,
 	struct sieve_stringlist *flags)
 {
-	string_t *cur_flags = ext_imap4flags_get_flag_variable
-		(renv, flg_ext, storage, var_index);
+	struct ext_imap4flags_result_context *rctx = NULL;
+	string_t *cur_flags = NULL, *flags_item;
+	int ret;
 
-	if ( cur_flags != NULL ) {
-		string_t *flags_item;
-		int ret;
+	if ( storage != NULL ) {
+		cur_flags = ext_imap4flags_get_flag_variable(renv, storage, var_index);
+		if ( cur_flags == NULL )
+			return SIEVE_EXEC_BIN_CORRUPT;
+	} else {
+		rctx = ext_imap4flags_get_internal_flags(renv, flg_ext);
+	}
 
-		while ( (ret=sieve_stringlist_next_item(flags, &flags_item)) > 0 ) {
-			sieve_runtime_trace(renv, SIEVE_TRLVL_COMMANDS,
-				"remove flags `%s'", str_c(flags_item));
+	while ( (ret=sieve_stringlist_next_item(flags, &flags_item)) > 0 ) {
+		sieve_runtime_trace(renv, SIEVE_TRLVL_COMMANDS,
+			"remove flags `%s'", str_c(flags_item));
 
+		if ( cur_flags != NULL )
 			flags_list_remove_flags(cur_flags, flags_item);
-		}
-
-		if ( ret < 0 ) return SIEVE_EXEC_BIN_CORRUPT;
-
-		return SIEVE_EXEC_OK;
+		else
+			internal_flags_remove_flags(rctx, flags_item);
 	}
 
-	return SIEVE_EXEC_BIN_CORRUPT;
+	if ( ret < 0 ) return SIEVE_EXEC_BIN_CORRUPT;
+
+	return SIEVE_EXEC_OK;
 }
 
 /* Flag stringlist */
@@ -718,13 +873,26 @@ struct sieve_stringlist *sieve_ext_imap4flags_get_flags
 	return ext_imap4flags_stringlist_create(renv, flags_list, TRUE);
 }
 
-void ext_imap4flags_get_implicit_flags_init
-(struct ext_imap4flags_iter *iter, const struct sieve_extension *this_ext,
-	struct sieve_result *result)
+enum mail_flags ext_imap4flags_get_implicit_flags
+(const struct sieve_extension *this_ext, struct sieve_result *result,
+	const char *const **keywords_r, unsigned int *count_r)
 {
-	string_t *cur_flags = _get_flags_string(this_ext, result);
+	struct ext_imap4flags_result_context *rctx =
+		_get_result_context(this_ext, result);
+
+	const char *const *flag;
+
+	if ( !rctx->keywords_valid ) {
+		array_clear(&rctx->keywords);
+		array_foreach(&rctx->flags_list, flag) {
+			if ( **flag != '\\' )
+				array_append(&rctx->keywords, flag, 1);
+		}
+		rctx->keywords_valid = TRUE;
+	}
 
-	ext_imap4flags_iter_init(iter, cur_flags);
+	*keywords_r = array_get(&rctx->keywords, count_r);
+	return rctx->flags;
 }
 
 
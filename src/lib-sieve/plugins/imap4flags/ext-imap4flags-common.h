@@ -5,6 +5,7 @@
 #define __EXT_IMAP4FLAGS_COMMON_H
 
 #include "lib.h"
+#include "mail-types.h"
 
 #include "sieve-common.h"
 #include "sieve-ext-variables.h"
@@ -91,9 +92,9 @@ typedef int (*ext_imapflag_flag_operation_t)
 
 /* Flags access */
 
-void ext_imap4flags_get_implicit_flags_init
-	(struct ext_imap4flags_iter *iter, const struct sieve_extension *this_ext,
-		struct sieve_result *result);
+enum mail_flags ext_imap4flags_get_implicit_flags
+	(const struct sieve_extension *this_ext, struct sieve_result *result,
+		const char *const **keywords_r, unsigned int *count_r);
 
 
 #endif /* __EXT_IMAP4FLAGS_COMMON_H */
@@ -201,37 +201,16 @@ static struct seff_flags_context *seff_flags_get_implicit_context
 {
 	pool_t pool = sieve_result_pool(result);
 	struct seff_flags_context *ctx;
-	const char *flag;
-	struct ext_imap4flags_iter flit;
+	const char *const *keywords;
+	unsigned int count;
 
 	ctx = p_new(pool, struct seff_flags_context, 1);
-	p_array_init(&ctx->keywords, pool, 2);
-
-	T_BEGIN {
 
-		/* Unpack */
-		ext_imap4flags_get_implicit_flags_init(&flit, this_ext, result);
-		while ( (flag=ext_imap4flags_iter_get_flag(&flit)) != NULL ) {
-			if (flag != NULL && *flag != '\\') {
-				/* keyword */
-				const char *keyword = p_strdup(pool, flag);
-				array_append(&ctx->keywords, &keyword, 1);
-			} else {
-				/* system flag */
-				if (flag == NULL || strcasecmp(flag, "\\flagged") == 0)
-					ctx->flags |= MAIL_FLAGGED;
-				else if (strcasecmp(flag, "\\answered") == 0)
-					ctx->flags |= MAIL_ANSWERED;
-				else if (strcasecmp(flag, "\\deleted") == 0)
-					ctx->flags |= MAIL_DELETED;
-				else if (strcasecmp(flag, "\\seen") == 0)
-					ctx->flags |= MAIL_SEEN;
-				else if (strcasecmp(flag, "\\draft") == 0)
-					ctx->flags |= MAIL_DRAFT;
-			}
-		}
-
-	} T_END;
+	/* The internal variable is already unpacked; just copy it */
+	ctx->flags = ext_imap4flags_get_implicit_flags
+		(this_ext, result, &keywords, &count);
+	p_array_init(&ctx->keywords, pool, count + 1);
+	array_append(&ctx->keywords, keywords, count);
 
 	return ctx;
 }
@@ -1,11 +1,183 @@
 /* Copyright (c) 2002-2018 Pigeonhole authors, see the included COPYING file
  */
 
+#include "lib.h"
+#include "buffer.h"
+#include "str.h"
+#include "hash.h"
+#include "llist.h"
+
 #include "sieve-common.h"
+#include "sieve-settings.h"
+#include "sieve-extensions.h"
 #include "sieve-match-types.h"
 
 #include "ext-regex-common.h"
 
+/*
+ * Extension
+ */
+
+bool ext_regex_load
+(const struct sieve_extension *ext, void **context)
+{
+	struct sieve_instance *svinst = ext->svinst;
+	struct ext_regex_context *ctx;
+	unsigned long long int cache_size;
+
+	if ( *context != NULL )
+		ext_regex_unload(ext);
+
+	if ( !sieve_setting_get_uint_value
+		(svinst, "sieve_regex_cache_size", &cache_size) )
+		cache_size = EXT_REGEX_DEFAULT_CACHE_SIZE;
+
+	ctx = i_new(struct ext_regex_context, 1);
+	ctx->cache_size = (unsigned int)cache_size;
+	hash_table_create(&ctx->cache, default_pool, 0, str_hash, strcmp);
+
+	*context = (void *)ctx;
+	return TRUE;
+}
+
+static void ext_regex_cache_entry_free
+(struct ext_regex_context *ctx, struct ext_regex_cache_entry *entry)
+{
+	hash_table_remove(ctx->cache, entry->key);
+	DLLIST2_REMOVE(&ctx->lru_head, &ctx->lru_tail, entry);
+	ctx->cache_count--;
+
+	regfree(&entry->regexp);
+	i_free(entry->key);
+	i_free(entry);
+}
+
+void ext_regex_unload
+(const struct sieve_extension *ext)
+{
+	struct ext_regex_context *ctx =
+		(struct ext_regex_context *)ext->context;
+
+	if ( ctx == NULL )
+		return;
+
+	while ( ctx->lru_head != NULL )
+		ext_regex_cache_entry_free(ctx, ctx->lru_head);
+	hash_table_destroy(&ctx->cache);
+	i_free(ctx);
+}
+
+/*
+ * Regex errors
+ */
+
+/* Wrapper around the regerror function for easy access */
+const char *ext_regex_error(regex_t *regexp, int errorcode)
+{
+	size_t errsize = regerror(errorcode, regexp, NULL, 0);
+
+	if ( errsize > 0 ) {
+		char *errbuf;
+
+		buffer_t *error_buf =
+			buffer_create_dynamic(pool_datastack_create(), errsize);
+		errbuf = buffer_get_space_unsafe(error_buf, 0, errsize);
+
+		errsize = regerror(errorcode, regexp, errbuf, errsize);
+
+		/* We don't want the error to start with a capital letter */
+		errbuf[0] = i_tolower(errbuf[0]);
+
+		buffer_append_space_unsafe(error_buf, errsize);
+
+		return str_c(error_buf);
+	}
+
+	return "";
+}
+
+/*
+ * Compiled regex cache
+ */
+
+static void ext_regex_cache_evict(struct ext_regex_context *ctx)
+{
+	struct ext_regex_cache_entry *entry, *prev;
+
+	/* Drop least recently used entries that are not in use */
+	entry = ctx->lru_tail;
+	while ( ctx->cache_count > ctx->cache_size && entry != NULL ) {
+		prev = entry->prev;
+		if ( entry->refcount == 0 )
+			ext_regex_cache_entry_free(ctx, entry);
+		entry = prev;
+	}
+}
+
+struct ext_regex_cache_entry *ext_regex_cache_get
+(const struct sieve_extension *ext, const char *regex_str, int cflags,
+	const char **error_r)
+{
+	struct ext_regex_context *ctx =
+		(struct ext_regex_context *)ext->context;
+	struct ext_regex_cache_entry *entry;
+	const char *key;
+	int ret;
+
+	*error_r = NULL;
+
+	key = t_strdup_printf("%x:%s", cflags, regex_str);
+	entry = hash_table_lookup(ctx->cache, key);
+	if ( entry != NULL ) {
+		/* Hit: move to front of LRU list */
+		ctx->hits++;
+		if ( ctx->lru_head != entry ) {
+			DLLIST2_REMOVE(&ctx->lru_head, &ctx->lru_tail, entry);
+			DLLIST2_PREPEND(&ctx->lru_head, &ctx->lru_tail, entry);
+		}
+		entry->refcount++;
+		return entry;
+	}
+
+	/* Miss: compile regular expression */
+	ctx->misses++;
+	entry = i_new(struct ext_regex_cache_entry, 1);
+	if ( (ret=regcomp(&entry->regexp, regex_str, cflags)) != 0 ) {
+		*error_r = ext_regex_error(&entry->regexp, ret);
+		regfree(&entry->regexp);
+		i_free(entry);
+		return NULL;
+	}
+
+	entry->key = i_strdup(key);
+	entry->refcount = 1;
+	hash_table_insert(ctx->cache, entry->key, entry);
+	DLLIST2_PREPEND(&ctx->lru_head, &ctx->lru_tail, entry);
+	ctx->cache_count++;
+
+	ext_regex_cache_evict(ctx);
+	return entry;
+}
+
+void ext_regex_cache_release
+(const struct sieve_extension *ext,
+	struct ext_regex_cache_entry **_entry)
+{
+	struct ext_regex_context *ctx =
+		(struct ext_regex_context *)ext->context;
+	struct ext_regex_cache_entry *entry = *_entry;
+
+	*_entry = NULL;
+	if ( entry == NULL )
+		return;
+
+	i_assert( entry->refcount > 0 );
+	entry->refcount--;
+
+	if ( ctx->cache_count > ctx->cache_size )
+		ext_regex_cache_evict(ctx);
+}
+
 /*
  * Regex match type operand
  */
@@ -19,4 +191,3 @@ const struct sieve_operand_def regex_match_type_operand = {
 	.class = &sieve_match_type_operand_class,
 	.interface = &ext_match_types
 };
-
@@ -4,12 +4,22 @@
 #ifndef __EXT_REGEX_COMMON_H
 #define __EXT_REGEX_COMMON_H
 
+#include "hash.h"
+
+#include <sys/types.h>
+#include <regex.h>
+
 /*
  * Extension
  */
 
 extern const struct sieve_extension_def regex_extension;
 
+bool ext_regex_load
+	(const struct sieve_extension *ext, void **context);
+void ext_regex_unload
+	(const struct sieve_extension *ext);
+
 /*
  * Operand
  */
@@ -22,6 +32,41 @@ extern const struct sieve_operand_def regex_match_type_operand;
 
 extern const struct sieve_match_type_def regex_match_type;
 
-#endif /* __EXT_REGEX_COMMON_H */
+/*
+ * Compiled regex cache
+ */
+
+#define EXT_REGEX_DEFAULT_CACHE_SIZE 256
 
+struct ext_regex_cache_entry {
+	/* "<cflags>:<regex>" */
+	char *key;
+	regex_t regexp;
 
+	/* Number of match contexts currently using this entry; entries in use
+	   are never evicted */
+	unsigned int refcount;
+
+	/* LRU list; most recently used entry at the head */
+	struct ext_regex_cache_entry *prev, *next;
+};
+
+struct ext_regex_context {
+	HASH_TABLE(const char *, struct ext_regex_cache_entry *) cache;
+	struct ext_regex_cache_entry *lru_head, *lru_tail;
+	unsigned int cache_count, cache_size;
+
+	/* Statistics */
+	unsigned int hits, misses;
+};
+
+const char *ext_regex_error(regex_t *regexp, int errorcode);
+
+struct ext_regex_cache_entry *ext_regex_cache_get
+	(const struct sieve_extension *ext, const char *regex_str, int cflags,
+		const char **error_r);
+void ext_regex_cache_release
+	(const struct sieve_extension *ext,
+		struct ext_regex_cache_entry **_entry);
+
+#endif /* __EXT_REGEX_COMMON_H */
@@ -11,11 +11,11 @@
  *
  */
 
-/* FIXME: Regular expressions are compiled during compilation and
- * again during interpretation. This is suboptimal and should be
- * changed. This requires dumping the compiled regex to the binary.
- * Most likely, this will only be possible when we implement regular
- * expressions ourselves.
+/* Compiled regular expressions are kept in a bounded LRU cache that lives as
+ * long as the Sieve instance, so that these do not need to be compiled again
+ * for every test, message and recipient. Regular expressions compiled during
+ * validation are entered in the same cache. Storing the compiled regex in the
+ * binary itself would require implementing regular expressions ourselves.
  *
  */
 
@@ -38,9 +38,6 @@
 
 #include "ext-regex-common.h"
 
-#include <sys/types.h>
-#include <regex.h>
-
 /*
  * Extension
  */
@@ -50,6 +47,8 @@ static bool ext_regex_validator_load
 
 const struct sieve_extension_def regex_extension = {
 	.name = "regex",
+	.load = ext_regex_load,
+	.unload = ext_regex_unload,
 	.validator_load = ext_regex_validator_load,
 	SIEVE_EXT_DEFINE_OPERAND(regex_match_type_operand)
 };
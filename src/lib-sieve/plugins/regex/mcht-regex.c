@@ -24,8 +24,6 @@
 
 #include "ext-regex-common.h"
 
-#include <sys/types.h>
-#include <regex.h>
 #include <ctype.h>
 
 /*
@@ -60,50 +58,28 @@ const struct sieve_match_type_def regex_match_type = {
  * Match type validation
  */
 
-/* Wrapper around the regerror function for easy access */
-static const char *_regexp_error(regex_t *regexp, int errorcode)
-{
-	size_t errsize = regerror(errorcode, regexp, NULL, 0);
-
-	if ( errsize > 0 ) {
-		char *errbuf;
-
-		buffer_t *error_buf =
-			buffer_create_dynamic(pool_datastack_create(), errsize);
-		errbuf = buffer_get_space_unsafe(error_buf, 0, errsize);
-
-		errsize = regerror(errorcode, regexp, errbuf, errsize);
-
-		/* We don't want the error to start with a capital letter */
-		errbuf[0] = i_tolower(errbuf[0]);
-
-		buffer_append_space_unsafe(error_buf, errsize);
-
-		return str_c(error_buf);
-	}
-
-	return "";
-}
-
 static int mcht_regex_validate_regexp
 (struct sieve_validator *valdtr,
-	struct sieve_match_type_context *mtctx ATTR_UNUSED,
+	struct sieve_match_type_context *mtctx,
 	struct sieve_ast_argument *key, int cflags)
 {
-	int ret;
-	regex_t regexp;
+	const struct sieve_extension *ext = mtctx->match_type->object.ext;
+	struct ext_regex_cache_entry *rentry;
 	const char *regex_str = sieve_ast_argument_strc(key);
+	const char *error;
 
-	if ( (ret=regcomp(&regexp, regex_str, cflags)) != 0 ) {
+	/* Compiling through the cache means that the regular expression does not
+	   need to be compiled again when the script is executed in this process
+	   (at least when no match values are needed). */
+	rentry = ext_regex_cache_get(ext, regex_str, cflags, &error);
+	if ( rentry == NULL ) {
 		sieve_argument_validate_error(valdtr, key,
 			"invalid regular expression '%s' for regex match: %s",
-			str_sanitize(regex_str, 128), _regexp_error(&regexp, ret));
-
-		regfree(&regexp);
+			str_sanitize(regex_str, 128), error);
 		return -1;
 	}
 
-	regfree(&regexp);
+	ext_regex_cache_release(ext, &rentry);
 	return 1;
 }
 
@@ -170,14 +146,16 @@ static bool mcht_regex_validate_context
  */
 
 struct mcht_regex_key {
-	regex_t regexp;
+	struct ext_regex_cache_entry *entry;
 	int status;
 };
 
 struct mcht_regex_context {
+	const struct sieve_extension *ext;
 	ARRAY(struct mcht_regex_key) reg_expressions;
 	regmatch_t *pmatch;
 	size_t nmatch;
+	unsigned int hits, misses;
 	bool all_compiled:1;
 };
 
@@ -185,10 +163,15 @@ static void mcht_regex_match_init
 (struct sieve_match_context *mctx)
 {
 	pool_t pool = mctx->pool;
+	const struct sieve_extension *ext = mctx->match_type->object.ext;
+	struct ext_regex_context *rctx = (struct ext_regex_context *)ext->context;
 	struct mcht_regex_context *ctx;
 
 	/* Create context */
 	ctx = p_new(pool, struct mcht_regex_context, 1);
+	ctx->ext = ext;
+	ctx->hits = rctx->hits;
+	ctx->misses = rctx->misses;
 
 	/* Create storage for match values if match values are requested */
 	if ( sieve_match_values_are_enabled(mctx->runenv) ) {
@@ -284,7 +267,7 @@ static int mcht_regex_match_keys
 				struct mcht_regex_key *rkey;
 
 				if ( i >= array_count(&ctx->reg_expressions) ) {
-					int cflags;
+					int cflags = 0;
 
 					rkey = array_append_space(&ctx->reg_expressions);
 
@@ -298,28 +281,30 @@ static int mcht_regex_match_keys
 
 					if ( rkey->status >= 0 ) {
 						const char *regex_str = str_c(key_item);
-						int rxret;
+						const char *error;
 
 						/* Indicate whether match values need to be produced */
 						if ( ctx->nmatch == 0 ) cflags |= REG_NOSUB;
 
-						/* Compile regular expression */
-						if ( (rxret=regcomp(&rkey->regexp, regex_str, cflags)) != 0 ) {
+						/* Get compiled regular expression from cache */
+						rkey->entry = ext_regex_cache_get
+							(ctx->ext, regex_str, cflags, &error);
+						if ( rkey->entry == NULL ) {
 							sieve_runtime_error(renv, NULL,
 								"invalid regular expression '%s' for regex match: %s",
-								str_sanitize(regex_str, 128),
-								_regexp_error(&rkey->regexp, rxret));
+								str_sanitize(regex_str, 128), error);
 							rkey->status = -1;
 						} else {
 							rkey->status = 1;
 						}
 					}
 				} else {
-					rkey = array_idx_modifiable(&ctx->reg_expressions, 1);
+					rkey = array_idx_modifiable(&ctx->reg_expressions, i);
 				}
 
 				if ( rkey->status > 0 ) {
-					match = mcht_regex_match_key(mctx, val, &rkey->regexp);
+					match = mcht_regex_match_key
+						(mctx, val, &rkey->entry->regexp);
 
 					if ( trace ) {
 						sieve_runtime_trace(renv, 0,
@@ -352,7 +337,8 @@ static int mcht_regex_match_keys
 		match = 0;
 		while ( match == 0 && i < count ) {
 			if ( rkeys[i].status > 0 ) {
-				match = mcht_regex_match_key(mctx, val, &rkeys[i].regexp);
+				match = mcht_regex_match_key
+					(mctx, val, &rkeys[i].entry->regexp);
 
 				if ( trace ) {
 					sieve_runtime_trace(renv, 0,
@@ -371,15 +357,21 @@ void mcht_regex_match_deinit
 (struct sieve_match_context *mctx)
 {
 	struct mcht_regex_context *ctx = (struct mcht_regex_context *) mctx->data;
+	struct ext_regex_context *rctx =
+		(struct ext_regex_context *)ctx->ext->context;
 	struct mcht_regex_key *rkeys;
 	unsigned int count, i;
 
-	/* Clean up compiled regular expressions */
+	/* Release compiled regular expressions */
 	if ( array_is_created(&ctx->reg_expressions) ) {
 		rkeys = array_get_modifiable(&ctx->reg_expressions, &count);
-		for ( i = 0; i < count; i++ ) {
-			regfree(&rkeys[i].regexp);
-		}
+		for ( i = 0; i < count; i++ )
+			ext_regex_cache_release(ctx->ext, &rkeys[i].entry);
+
+		sieve_runtime_trace(mctx->runenv, SIEVE_TRLVL_MATCHING,
+			"regex cache: %u hits, %u misses "
+			"(%u entries cached; total %u hits, %u misses)",
+			rctx->hits - ctx->hits, rctx->misses - ctx->misses,
+			rctx->cache_count, rctx->hits, rctx->misses);
 	}
 }
-
@@ -2,6 +2,7 @@
  */
 
 #include "lib.h"
+#include "str.h"
 #include "strfuncs.h"
 #include "mail-storage.h"
 
@@ -33,6 +34,12 @@ struct ext_spamvirustest_header_spec {
 	const char *header_name;
 	regex_t regexp;
 	bool regexp_match;
+
+	/* Regular expressions of the form <literal>(-?<digits>\.<digits>) are
+	   matched without invoking the regex engine */
+	const char *fast_prefix;
+	bool fast_signed:1;
+	bool fast_multi_fraction:1;
 };
 
 struct ext_spamvirustest_data {
@@ -92,6 +99,100 @@ static const char *_regexp_match_get_value
 	return NULL;
 }
 
+/*
+ * Fast matching of common numeric patterns
+ */
+
+static const char *_fast_pattern_skip_digit_class(const char *p)
+{
+	if ( strncmp(p, "[[:digit:]]", 11) == 0 )
+		return p + 11;
+	if ( strncmp(p, "[0-9]", 5) == 0 )
+		return p + 5;
+	return NULL;
+}
+
+static bool ext_spamvirustest_header_spec_parse_fast
+(struct ext_spamvirustest_header_spec *spec, pool_t pool, const char *regexp)
+{
+	string_t *prefix = t_str_new(64);
+	const char *p = regexp;
+	bool is_signed = FALSE, multi_fraction = FALSE;
+
+	/* Literal prefix */
+	while ( *p != '\0' && *p != '(' ) {
+		if ( *p == '\\' ) {
+			p++;
+			if ( *p == '\0' || i_isalnum(*p) )
+				return FALSE;
+		} else if ( strchr(".[]*+?{}|^$)", *p) != NULL ) {
+			return FALSE;
+		}
+		str_append_c(prefix, *p);
+		p++;
+	}
+	if ( *p != '(' || str_len(prefix) == 0 )
+		return FALSE;
+	p++;
+
+	/* Number: -?<digit>+\.<digit>[+] */
+	if ( strncmp(p, "-?", 2) == 0 ) {
+		is_signed = TRUE;
+		p += 2;
+	}
+	if ( (p=_fast_pattern_skip_digit_class(p)) == NULL || *p != '+' )
+		return FALSE;
+	p++;
+	if ( strncmp(p, "\\.", 2) != 0 )
+		return FALSE;
+	p += 2;
+	if ( (p=_fast_pattern_skip_digit_class(p)) == NULL )
+		return FALSE;
+	if ( *p == '+' ) {
+		multi_fraction = TRUE;
+		p++;
+	}
+	if ( *p != ')' )
+		return FALSE;
+	p++;
+
+	/* Optional trailing wildcard */
+	if ( strcmp(p, ".*") != 0 && *p != '\0' )
+		return FALSE;
+
+	spec->fast_prefix = p_strdup(pool, str_c(prefix));
+	spec->fast_signed = is_signed;
+	spec->fast_multi_fraction = multi_fraction;
+	return TRUE;
+}
+
+static const char *ext_spamvirustest_header_spec_match_fast
+(const struct ext_spamvirustest_header_spec *spec, const char *value)
+{
+	size_t prefix_len = strlen(spec->fast_prefix);
+	const char *p, *start, *num;
+
+	/* Find the leftmost prefix that is followed by a number */
+	start = value;
+	while ( (start=strstr(start, spec->fast_prefix)) != NULL ) {
+		num = p = start + prefix_len;
+		if ( spec->fast_signed && *p == '-' )
+			p++;
+		if ( i_isdigit(*p) ) {
+			while ( i_isdigit(*p) ) p++;
+			if ( *p == '.' && i_isdigit(p[1]) ) {
+				p += 2;
+				if ( spec->fast_multi_fraction ) {
+					while ( i_isdigit(*p) ) p++;
+				}
+				return t_strdup_until(num, p);
+			}
+		}
+		start++;
+	}
+	return NULL;
+}
+
 /*
  * Configuration parser
  */
@@ -144,6 +245,7 @@ static bool ext_spamvirustest_header_spec_parse
 		return FALSE;
 	}
 
+	(void)ext_spamvirustest_header_spec_parse_fast(spec, pool, p);
 	return TRUE;
 }
 
@@ -521,7 +623,16 @@ int ext_spamvirustest_get_value
 				goto failed;
 			}
 
-			if ( max_header->regexp_match ) {
+			if ( max_header->fast_prefix != NULL ) {
+				max = ext_spamvirustest_header_spec_match_fast
+					(max_header, header_value);
+				if ( max == NULL ) {
+					sieve_runtime_trace(renv, SIEVE_TRLVL_TESTS,
+						"regexp for header '%s' did not match "
+						"on value '%s'", max_header->header_name, header_value);
+					goto failed;
+				}
+			} else if ( max_header->regexp_match ) {
 				/* Execute regex */
 				if ( regexec(&max_header->regexp, header_value, 2, match_values, 0)
 					!= 0 ) {
@@ -578,8 +689,17 @@ int ext_spamvirustest_get_value
 		goto failed;
 	}
 
-	/* Execute regex */
-	if ( status_header->regexp_match ) {
+	if ( status_header->fast_prefix != NULL ) {
+		status = ext_spamvirustest_header_spec_match_fast
+			(status_header, header_value);
+		if ( status == NULL ) {
+			sieve_runtime_trace(renv, SIEVE_TRLVL_TESTS,
+				"regexp for header '%s' did not match on value '%s'",
+				status_header->header_name, header_value);
+			goto failed;
+		}
+	} else if ( status_header->regexp_match ) {
+		/* Execute regex */
 		if ( regexec(&status_header->regexp, header_value, 2, match_values, 0)
 			!= 0 ) {
 			sieve_runtime_trace(renv, SIEVE_TRLVL_TESTS,
@@ -733,9 +733,10 @@ static int act_vacation_check_duplicate
 	const struct sieve_action *act_other)
 {
 	if ( !act_other->executed ) {
-		sieve_runtime_error(renv, act->location,
+		sieve_runtime_error(renv, sieve_action_get_location(act),
 			"duplicate vacation action not allowed "
-			"(previously triggered one was here: %s)", act_other->location);
+			"(previously triggered one was here: %s)",
+			sieve_action_get_location(act_other));
 		return -1;
 	}
 
@@ -750,10 +751,10 @@ int act_vacation_check_conflict
 {
 	if ( (act_other->def->flags & SIEVE_ACTFLAG_SENDS_RESPONSE) > 0 ) {
 		if ( !act_other->executed && !act->executed) {
-			sieve_runtime_error(renv, act->location,
+			sieve_runtime_error(renv, sieve_action_get_location(act),
 				"vacation action conflicts with other action: "
 				"the %s action (%s) also sends a response back to the sender",
-				act_other->def->name, act_other->location);
+				act_other->def->name, sieve_action_get_location(act_other));
 			return -1;
 		} else {
 			/* Not an error if executed in preceeding script */
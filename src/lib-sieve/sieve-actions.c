@@ -19,6 +19,7 @@
 #include "rfc2822.h"
 
 #include "sieve-code.h"
+#include "sieve-error.h"
 #include "sieve-settings.h"
 #include "sieve-extensions.h"
 #include "sieve-binary.h"
@@ -28,6 +29,8 @@
 #include "sieve-actions.h"
 #include "sieve-message.h"
 #include "sieve-smtp.h"
+#include "sieve-duplicate.h"
+#include "sieve-store-session.h"
 
 #include <ctype.h>
 
@@ -188,6 +191,8 @@ static int act_store_check_duplicate
 	(const struct sieve_runtime_env *renv,
 		const struct sieve_action *act,
 		const struct sieve_action *act_other);
+static const char *act_store_get_duplicate_key
+	(const struct sieve_script_env *senv, const struct sieve_action *act);
 static void act_store_print
 	(const struct sieve_action *action,
 		const struct sieve_result_print_env *rpenv, bool *keep);
@@ -214,6 +219,7 @@ const struct sieve_action_def act_store = {
 		SIEVE_ACTFLAG_MAIL_STORAGE,
 	.equals = act_store_equals,
 	.check_duplicate = act_store_check_duplicate,
+	.get_duplicate_key = act_store_get_duplicate_key,
 	.print = act_store_print,
 	.start = act_store_start,
 	.execute = act_store_execute,
@@ -328,6 +334,21 @@ static int act_store_check_duplicate
 	return ( act_store_equals(renv->scriptenv, act, act_other) ? 1 : 0 );
 }
 
+static const char *act_store_get_duplicate_key
+(const struct sieve_script_env *senv, const struct sieve_action *act)
+{
+	struct act_store_context *st_ctx =
+		( act == NULL ? NULL : (struct act_store_context *) act->context );
+	const char *mailbox;
+
+	/* Must match act_store_equals() */
+	mailbox = ( st_ctx == NULL ?
+		SIEVE_SCRIPT_DEFAULT_MAILBOX(senv) : st_ctx->mailbox );
+	if ( strcasecmp(mailbox, "INBOX") == 0 )
+		return "INBOX";
+	return mailbox;
+}
+
 /* Result printing */
 
 static void act_store_print
@@ -363,7 +384,8 @@ static bool act_store_mailbox_open
 (const struct sieve_action_exec_env *aenv, const char *mailbox,
 	struct mailbox **box_r, enum mail_error *error_code_r, const char **error_r)
 {
-	struct mailbox *box;
+	struct sieve_store_session *session = aenv->scriptenv->store_session;
+	struct mailbox *box = NULL;
 	struct mail_storage **storage = &(aenv->exec_status->last_storage);
 	enum mailbox_flags flags = 0;
 
@@ -380,12 +402,25 @@ static bool act_store_mailbox_open
 		return FALSE;
 	}
 
-	if (aenv->scriptenv->mailbox_autocreate)
-		flags |= MAILBOX_FLAG_AUTO_CREATE;
-	if (aenv->scriptenv->mailbox_autosubscribe)
-		flags |= MAILBOX_FLAG_AUTO_SUBSCRIBE;
-	*box_r = box = mailbox_alloc_delivery(
-		aenv->scriptenv->user, mailbox, flags);
+	/* Reuse the mailbox of an earlier delivery in this session */
+	if ( session != NULL ) {
+		box = sieve_store_session_lookup_mailbox
+			(session, aenv->scriptenv->user, mailbox);
+	}
+
+	if ( box == NULL ) {
+		if (aenv->scriptenv->mailbox_autocreate)
+			flags |= MAILBOX_FLAG_AUTO_CREATE;
+		if (aenv->scriptenv->mailbox_autosubscribe)
+			flags |= MAILBOX_FLAG_AUTO_SUBSCRIBE;
+		box = mailbox_alloc_delivery(
+			aenv->scriptenv->user, mailbox, flags);
+		if ( session != NULL ) {
+			sieve_store_session_add_mailbox
+				(session, aenv->scriptenv->user, mailbox, box);
+		}
+	}
+	*box_r = box;
 	*storage = mailbox_get_storage(box);
 
 	if (mailbox_open(box) == 0)
@@ -394,6 +429,23 @@ static bool act_store_mailbox_open
 	return FALSE;
 }
 
+static void act_store_mailbox_close
+(const struct sieve_action_exec_env *aenv, struct mailbox **_box)
+{
+	struct sieve_store_session *session = aenv->scriptenv->store_session;
+
+	if ( *_box == NULL )
+		return;
+
+	/* Mailboxes of a session stay open until it ends */
+	if ( session != NULL &&
+		sieve_store_session_has_mailbox(session, *_box) ) {
+		*_box = NULL;
+		return;
+	}
+	mailbox_free(_box);
+}
+
 static int act_store_start
 (const struct sieve_action *action,
 	const struct sieve_action_exec_env *aenv, void **tr_context)
@@ -480,6 +532,43 @@ static struct mail_keywords *act_store_keywords_create
 	return box_keywords;
 }
 
+static int act_store_save
+(const struct sieve_action *action,
+	const struct sieve_action_exec_env *aenv,
+	struct act_store_transaction *trans,
+	struct mailbox_transaction_context *mail_trans)
+{
+	struct mail *mail =	( action->mail != NULL ?
+		action->mail : aenv->msgdata->mail );
+	struct mail_save_context *save_ctx;
+	struct mail_keywords *keywords = NULL;
+	int status = SIEVE_EXEC_OK;
+
+	save_ctx = mailbox_save_alloc(mail_trans);
+
+	/* Apply keywords and flags that side-effects may have added */
+	if ( trans->flags_altered ) {
+		keywords = act_store_keywords_create(aenv, &trans->keywords, trans->box);
+
+		mailbox_save_set_flags(save_ctx, trans->flags, keywords);
+	} else {
+		mailbox_save_copy_flags(save_ctx, mail);
+	}
+
+	if ( mailbox_save_using_mail(&save_ctx, mail) < 0 ) {
+		sieve_act_store_get_storage_error(aenv, trans);
+		status = ( trans->error_code == MAIL_ERROR_TEMP ?
+			SIEVE_EXEC_TEMP_FAILURE : SIEVE_EXEC_FAILURE );
+	}
+
+	/* Deallocate keywords */
+ 	if ( keywords != NULL ) {
+ 		mailbox_keywords_unref(&keywords);
+ 	}
+
+	return status;
+}
+
 static int act_store_execute
 (const struct sieve_action *action,
 	const struct sieve_action_exec_env *aenv, void *tr_context)
@@ -488,10 +577,8 @@ static int act_store_execute
 		(struct act_store_transaction *) tr_context;
 	struct mail *mail =	( action->mail != NULL ?
 		action->mail : aenv->msgdata->mail );
-	struct mail_save_context *save_ctx;
 	struct mail_keywords *keywords = NULL;
 	bool backends_equal = FALSE;
-	int status = SIEVE_EXEC_OK;
 
 	/* Verify transaction */
 	if ( trans == NULL ) return SIEVE_EXEC_FAILURE;
@@ -568,34 +655,18 @@ static int act_store_execute
 	 */
 	aenv->exec_status->last_storage = mailbox_get_storage(trans->box);
 
+	/* Within a session, the message is saved into the session's transaction
+	   once this result is committed, so that nothing needs to be undone when
+	   it is rolled back */
+	if ( aenv->scriptenv->store_session != NULL )
+		return SIEVE_EXEC_OK;
+
 	/* Start mail transaction */
 	trans->mail_trans = mailbox_transaction_begin
 		(trans->box, MAILBOX_TRANSACTION_FLAG_EXTERNAL, __func__);
 
 	/* Store the message */
-	save_ctx = mailbox_save_alloc(trans->mail_trans);
-
-	/* Apply keywords and flags that side-effects may have added */
-	if ( trans->flags_altered ) {
-		keywords = act_store_keywords_create(aenv, &trans->keywords, trans->box);
-
-		mailbox_save_set_flags(save_ctx, trans->flags, keywords);
-	} else {
-		mailbox_save_copy_flags(save_ctx, mail);
-	}
-
-	if ( mailbox_save_using_mail(&save_ctx, mail) < 0 ) {
-		sieve_act_store_get_storage_error(aenv, trans);
-		status = ( trans->error_code == MAIL_ERROR_TEMP ?
-			SIEVE_EXEC_TEMP_FAILURE : SIEVE_EXEC_FAILURE );
-	}
-
-	/* Deallocate keywords */
- 	if ( keywords != NULL ) {
- 		mailbox_keywords_unref(&keywords);
- 	}
-
-	return status;
+	return act_store_save(action, aenv, trans, trans->mail_trans);
 }
 
 static void act_store_log_status
@@ -669,11 +740,12 @@ static void act_store_log_status
 }
 
 static int act_store_commit
-(const struct sieve_action *action ATTR_UNUSED,
+(const struct sieve_action *action,
 	const struct sieve_action_exec_env *aenv, void *tr_context, bool *keep)
 {
 	struct act_store_transaction *trans =
 		(struct act_store_transaction *) tr_context;
+	struct sieve_store_session *session = aenv->scriptenv->store_session;
 	bool status = TRUE;
 
 	/* Verify transaction */
@@ -683,15 +755,13 @@ static int act_store_commit
 	if ( trans->disabled ) {
 		act_store_log_status(trans, aenv, FALSE, status);
 		*keep = FALSE;
-		if ( trans->box != NULL )
-			mailbox_free(&trans->box);
+		act_store_mailbox_close(aenv, &trans->box);
 		return SIEVE_EXEC_OK;
 	} else if ( trans->redundant ) {
 		act_store_log_status(trans, aenv, FALSE, status);
 		aenv->exec_status->keep_original = TRUE;
 		aenv->exec_status->message_saved = TRUE;
-		if ( trans->box != NULL )
-			mailbox_free(&trans->box);
+		act_store_mailbox_close(aenv, &trans->box);
 		return SIEVE_EXEC_OK;
 	}
 
@@ -700,8 +770,16 @@ static int act_store_commit
 	 */
 	aenv->exec_status->last_storage = mailbox_get_storage(trans->box);
 
-	/* Commit mailbox transaction */
-	status = ( mailbox_transaction_commit(&trans->mail_trans) == 0 );
+	if ( session != NULL ) {
+		/* Save into the session's transaction, which is committed when the
+		   session ends */
+		status = ( act_store_save(action, aenv, trans,
+			sieve_store_session_get_transaction(session, trans->box)) ==
+			SIEVE_EXEC_OK );
+	} else {
+		/* Commit mailbox transaction */
+		status = ( mailbox_transaction_commit(&trans->mail_trans) == 0 );
+	}
 
 	/* Note the fact that the message was stored at least once */
 	if ( status )
@@ -716,8 +794,7 @@ static int act_store_commit
 	*keep = !status;
 
 	/* Close mailbox */
-	if ( trans->box != NULL )
-		mailbox_free(&trans->box);
+	act_store_mailbox_close(aenv, &trans->box);
 
 	if (status)
 		return SIEVE_EXEC_OK;
@@ -750,7 +827,7 @@ static void act_store_rollback
 		mailbox_transaction_rollback(&trans->mail_trans);
 
 	/* Close the mailbox */
-	mailbox_free(&trans->box);
+	act_store_mailbox_close(aenv, &trans->box);
 }
 
 /*
@@ -778,6 +855,15 @@ int sieve_act_redirect_add_to_result
 	return SIEVE_EXEC_OK;
 }
 
+/*
+ * Action instance
+ */
+
+const char *sieve_action_get_location(const struct sieve_action *act)
+{
+	return sieve_error_script_location(act->script, act->source_line);
+}
+
 /*
  * Action utility functions
  */
@@ -787,12 +873,16 @@ int sieve_act_redirect_add_to_result
 bool sieve_action_duplicate_check_available
 (const struct sieve_script_env *senv)
 {
+	if ( senv->duplicate_db != NULL )
+		return TRUE;
 	return ( senv->duplicate_check != NULL && senv->duplicate_mark != NULL );
 }
 
 bool sieve_action_duplicate_check
 (const struct sieve_script_env *senv, const void *id, size_t id_size)
 {
+	if ( senv->duplicate_db != NULL )
+		return sieve_duplicate_db_check(senv->duplicate_db, id, id_size);
 	if ( senv->duplicate_check == NULL || senv->duplicate_mark == NULL)
 		return FALSE;
 
@@ -803,6 +893,10 @@ void sieve_action_duplicate_mark
 (const struct sieve_script_env *senv, const void *id, size_t id_size,
 	time_t time)
 {
+	if ( senv->duplicate_db != NULL ) {
+		sieve_duplicate_db_mark(senv->duplicate_db, id, id_size, time);
+		return;
+	}
 	if ( senv->duplicate_check == NULL || senv->duplicate_mark == NULL)
 		return;
 
@@ -812,6 +906,10 @@ void sieve_action_duplicate_mark
 void sieve_action_duplicate_flush
 (const struct sieve_script_env *senv)
 {
+	if ( senv->duplicate_db != NULL ) {
+		(void)sieve_duplicate_db_flush(senv->duplicate_db);
+		return;
+	}
 	if ( senv->duplicate_flush == NULL )
 		return;
 	senv->duplicate_flush(senv);
@@ -29,8 +29,6 @@ struct sieve_action_exec_env {
 	struct sieve_exec_status *exec_status;
 };
 
-const char *sieve_action_get_location(const struct sieve_action_exec_env *aenv);
-
 /*
  * Action flags
  */
@@ -63,6 +61,12 @@ struct sieve_action_def {
 		(const struct sieve_runtime_env *renv,
 			const struct sieve_action *act,
 			const struct sieve_action *act_other);
+	/* Optional: returns a key that is equal for two actions exactly when
+	   check_duplicate() considers them duplicates. This allows the result
+	   to find duplicates without comparing against every prior action. */
+	const char *(*get_duplicate_key)
+		(const struct sieve_script_env *senv,
+			const struct sieve_action *act);
 
 	/* Result printing */
 
@@ -100,12 +104,18 @@ struct sieve_action {
 	const struct sieve_action_def *def;
 	const struct sieve_extension *ext;
 
-	const char *location;
+	/* Source location; only formatted when needed, using
+	   sieve_action_get_location() */
+	struct sieve_script *script;
+	unsigned int source_line;
+
 	void *context;
 	struct mail *mail;
 	bool executed;
 };
 
+const char *sieve_action_get_location(const struct sieve_action *act);
+
 #define sieve_action_is(act, definition) \
 	( (act)->def == &(definition) )
 
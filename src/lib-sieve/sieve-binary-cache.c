@@ -0,0 +1,411 @@
+/* Copyright (c) 2002-2018 Pigeonhole authors, see the included COPYING file
+ */
+
+#include "lib.h"
+#include "hash.h"
+#include "llist.h"
+#include "sha1.h"
+#include "hex-binary.h"
+#include "istream.h"
+
+#include "sieve-common.h"
+#include "sieve-config.h"
+#include "sieve-error.h"
+#include "sieve-extensions.h"
+#include "sieve-script.h"
+
+#include "sieve-binary-private.h"
+
+#include <sys/stat.h>
+
+/*
+ * Binary cache
+ */
+
+/* Binaries loaded from disk are kept by the Sieve instance, so that opening
+ * the same script again does not need to load its binary anew. Before a cached
+ * binary is reused, it is verified that the binary file was not replaced and
+ * that the binary is still up-to-date with the script. Binaries that include
+ * other scripts are not kept, since their dependencies are only checked while
+ * the binary is loaded.
+ */
+
+struct sieve_binary_cache_entry {
+	struct sieve_binary_cache_entry *prev, *next;
+
+	char *key;
+	struct sieve_binary *sbin;
+};
+
+struct sieve_binary_cache {
+	HASH_TABLE(const char *, struct sieve_binary_cache_entry *) entries;
+
+	/* Most recently used first */
+	struct sieve_binary_cache_entry *head, *tail;
+	unsigned int count;
+
+	unsigned int hits;
+};
+
+static bool
+sieve_binary_has_include(struct sieve_binary *sbin)
+{
+	const struct sieve_extension *ext;
+	int count, i;
+
+	count = sieve_binary_extensions_count(sbin);
+	for ( i = 0; i < count; i++ ) {
+		ext = sieve_binary_extension_get_by_index(sbin, i);
+		if ( ext != NULL && strcmp(sieve_extension_name(ext), "include") == 0 )
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static const char *
+sieve_binary_cache_key(struct sieve_script *script,
+	enum sieve_compile_flags flags)
+{
+	return t_strdup_printf("%x:%s", (unsigned int)flags,
+		sieve_script_location(script));
+}
+
+static void
+sieve_binary_cache_entry_free(struct sieve_binary_cache *cache,
+	struct sieve_binary_cache_entry *entry)
+{
+	hash_table_remove(cache->entries, entry->key);
+	DLLIST2_REMOVE(&cache->head, &cache->tail, entry);
+	cache->count--;
+
+	sieve_binary_unref(&entry->sbin);
+	i_free(entry->key);
+	i_free(entry);
+}
+
+void sieve_binary_cache_free(struct sieve_instance *svinst)
+{
+	struct sieve_binary_cache *cache = svinst->binary_cache;
+
+	if ( cache == NULL )
+		return;
+
+	while ( cache->head != NULL )
+		sieve_binary_cache_entry_free(cache, cache->head);
+	hash_table_destroy(&cache->entries);
+	i_free(cache);
+	svinst->binary_cache = NULL;
+}
+
+static bool
+sieve_binary_cache_entry_valid(struct sieve_binary_cache_entry *entry,
+	struct sieve_script *script, enum sieve_compile_flags flags)
+{
+	struct sieve_binary *sbin = entry->sbin;
+	const struct stat *bst = &sbin->file->st;
+	struct sieve_binary_block *sblock;
+	sieve_size_t offset = 0;
+	struct stat st;
+
+	/* Check whether the binary file was replaced or modified */
+	if ( stat(sbin->path, &st) < 0 ) {
+		if ( errno != ENOENT ) {
+			sieve_sys_error(sbin->svinst,
+				"binary cache: stat(%s) failed: %m", sbin->path);
+		}
+		return FALSE;
+	}
+	if ( st.st_ino != bst->st_ino || !CMP_DEV_T(st.st_dev, bst->st_dev) ||
+		st.st_size != bst->st_size || st.st_mtime != bst->st_mtime ||
+		ST_MTIME_NSEC(st) != ST_MTIME_NSEC(*bst) )
+		return FALSE;
+
+	/* Check the binary against the script as it was opened just now. The
+	 * binary may still be in use elsewhere, so it keeps referring to the script
+	 * it was loaded for. */
+	sblock = sieve_binary_block_get(sbin, SBIN_SYSBLOCK_SCRIPT_DATA);
+	if ( sblock == NULL ||
+		sieve_script_binary_read_metadata(script, sblock, &offset) <= 0 )
+		return FALSE;
+	return sieve_binary_extensions_up_to_date(sbin, flags);
+}
+
+struct sieve_binary *sieve_binary_cache_lookup
+(struct sieve_script *script, enum sieve_compile_flags flags)
+{
+	struct sieve_instance *svinst = sieve_script_svinst(script);
+	struct sieve_binary_cache *cache = svinst->binary_cache;
+	struct sieve_binary_cache_entry *entry;
+
+	if ( cache == NULL )
+		return NULL;
+
+	entry = hash_table_lookup(cache->entries,
+		sieve_binary_cache_key(script, flags));
+	if ( entry == NULL )
+		return NULL;
+
+	if ( !sieve_binary_cache_entry_valid(entry, script, flags) ) {
+		if ( svinst->debug ) {
+			sieve_sys_debug(svinst,
+				"binary cache: dropping outdated binary %s",
+				sieve_binary_path(entry->sbin));
+		}
+		sieve_binary_cache_entry_free(cache, entry);
+		return NULL;
+	}
+
+	DLLIST2_REMOVE(&cache->head, &cache->tail, entry);
+	DLLIST2_PREPEND(&cache->head, &cache->tail, entry);
+	cache->hits++;
+
+	sieve_binary_ref(entry->sbin);
+	return entry->sbin;
+}
+
+void sieve_binary_cache_add
+(struct sieve_binary *sbin, enum sieve_compile_flags flags)
+{
+	struct sieve_instance *svinst = sbin->svinst;
+	struct sieve_binary_cache *cache = svinst->binary_cache;
+	struct sieve_binary_cache_entry *entry;
+	const char *key;
+
+	/* Only binaries loaded from disk can be verified later on */
+	if ( svinst->binary_cache_size == 0 ||
+		sbin->file == NULL || sbin->script == NULL ||
+		sieve_binary_has_include(sbin) )
+		return;
+
+	if ( cache == NULL ) {
+		cache = svinst->binary_cache = i_new(struct sieve_binary_cache, 1);
+		hash_table_create(&cache->entries, default_pool, 0, str_hash, strcmp);
+	}
+
+	key = sieve_binary_cache_key(sbin->script, flags);
+	if ( (entry=hash_table_lookup(cache->entries, key)) != NULL )
+		sieve_binary_cache_entry_free(cache, entry);
+
+	/* Evict least recently used binaries */
+	while ( cache->count >= svinst->binary_cache_size )
+		sieve_binary_cache_entry_free(cache, cache->tail);
+
+	entry = i_new(struct sieve_binary_cache_entry, 1);
+	entry->key = i_strdup(key);
+	entry->sbin = sbin;
+	sieve_binary_ref(sbin);
+
+	DLLIST2_PREPEND(&cache->head, &cache->tail, entry);
+	hash_table_insert(cache->entries, entry->key, entry);
+	cache->count++;
+}
+
+unsigned int sieve_binary_cache_hits(struct sieve_instance *svinst)
+{
+	struct sieve_binary_cache *cache = svinst->binary_cache;
+
+	return ( cache == NULL ? 0 : cache->hits );
+}
+
+/*
+ * Shared binaries
+ */
+
+/* With sieve_binary_shared_dir configured, binaries stored there by an
+ * administrator (sievec -s) are used for any script with identical content.
+ * The file name is a hash of the script content, the compile flags and the
+ * enabled extensions. The directory is only ever read during delivery and its
+ * contents are ignored unless neither the directory nor the binary can be
+ * modified by anyone but root or sieve_binary_shared_owner. Binaries that
+ * include other scripts depend on more than the script content and are not
+ * shared.
+ */
+
+static const char *
+sieve_binary_shared_path(struct sieve_script *script,
+	enum sieve_compile_flags flags)
+{
+	struct sieve_instance *svinst = sieve_script_svinst(script);
+	unsigned char digest[SHA1_RESULTLEN];
+	struct sha1_ctxt ctx;
+	struct istream *input;
+	const unsigned char *data;
+	const char *extra;
+	uoff_t start_offset;
+	size_t size;
+	bool failed = FALSE;
+
+	if ( sieve_script_get_stream(script, &input, NULL) < 0 )
+		return NULL;
+
+	sha1_init(&ctx);
+	start_offset = input->v_offset;
+	while ( i_stream_read_more(input, &data, &size) > 0 ) {
+		sha1_loop(&ctx, data, size);
+		i_stream_skip(input, size);
+	}
+	if ( input->stream_errno != 0 ) {
+		sieve_sys_error(svinst, "binary shared: read(%s) failed: %s",
+			i_stream_get_name(input), i_stream_get_error(input));
+		failed = TRUE;
+	}
+	i_stream_seek(input, start_offset);
+	if ( failed )
+		return NULL;
+
+	extra = t_strdup_printf("\n%x\n%s", (unsigned int)flags,
+		sieve_extensions_get_string(svinst));
+	sha1_loop(&ctx, extra, strlen(extra));
+	sha1_result(&ctx, digest);
+
+	return t_strconcat(svinst->binary_shared_dir, "/",
+		binary_to_hex(digest, sizeof(digest)), "."SIEVE_BINARY_FILEEXT, NULL);
+}
+
+static bool
+sieve_binary_shared_trusted(struct sieve_instance *svinst,
+	const char *path, const struct stat *st)
+{
+	if ( st->st_uid != 0 &&
+		(svinst->binary_shared_uid == (uid_t)-1 ||
+			st->st_uid != svinst->binary_shared_uid) ) {
+		sieve_sys_warning(svinst,
+			"binary shared: ignoring %s: owned by untrusted uid %ld",
+			path, (long)st->st_uid);
+		return FALSE;
+	}
+	if ( (st->st_mode & (S_IWGRP | S_IWOTH)) != 0 ) {
+		sieve_sys_warning(svinst,
+			"binary shared: ignoring %s: writable by group or others "
+			"(mode=0%o)", path, (unsigned int)(st->st_mode & 07777));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+struct sieve_binary *sieve_binary_shared_lookup
+(struct sieve_script *script, enum sieve_compile_flags flags)
+{
+	struct sieve_instance *svinst = sieve_script_svinst(script);
+	struct sieve_binary *sbin;
+	struct sieve_binary_block *sblock;
+	const struct stat *bst;
+	struct stat st;
+	sieve_size_t offset = 0;
+	const char *path;
+
+	if ( svinst->binary_shared_dir == NULL )
+		return NULL;
+
+	if ( stat(svinst->binary_shared_dir, &st) < 0 ) {
+		if ( errno != ENOENT ) {
+			sieve_sys_error(svinst, "binary shared: stat(%s) failed: %m",
+				svinst->binary_shared_dir);
+		}
+		return NULL;
+	}
+	if ( !S_ISDIR(st.st_mode) ||
+		!sieve_binary_shared_trusted(svinst, svinst->binary_shared_dir, &st) )
+		return NULL;
+
+	if ( (path=sieve_binary_shared_path(script, flags)) == NULL )
+		return NULL;
+
+	if ( lstat(path, &st) < 0 ) {
+		if ( errno != ENOENT ) {
+			sieve_sys_error(svinst,
+				"binary shared: lstat(%s) failed: %m", path);
+		}
+		return NULL;
+	}
+	if ( !S_ISREG(st.st_mode) ||
+		!sieve_binary_shared_trusted(svinst, path, &st) )
+		return NULL;
+
+	if ( (sbin=sieve_binary_open(svinst, path, script, NULL)) == NULL )
+		return NULL;
+
+	/* Make sure the file that was opened is the one checked above */
+	bst = sieve_binary_stat(sbin);
+	if ( bst->st_ino != st.st_ino || !CMP_DEV_T(bst->st_dev, st.st_dev) ) {
+		sieve_sys_warning(svinst,
+			"binary shared: ignoring %s: replaced while opening it", path);
+		sieve_binary_unref(&sbin);
+		return NULL;
+	}
+
+	/* The script metadata refers to the script the binary was compiled from
+	 * first; the content is identical, so only the storage class, its version
+	 * and the extensions need to agree.
+	 */
+	sblock = sieve_binary_block_get(sbin, SBIN_SYSBLOCK_SCRIPT_DATA);
+	if ( sblock == NULL ||
+		sieve_script_binary_read_shared_metadata(script, sblock, &offset) <= 0 ||
+		!sieve_binary_extensions_up_to_date(sbin, flags) ||
+		sieve_binary_has_include(sbin) ) {
+		sieve_binary_unref(&sbin);
+		return NULL;
+	}
+
+	/* Describe this script instead, so that a copy saved for it is valid. This
+	 * only changes the loaded binary; the shared file is never written here.
+	 */
+	sieve_binary_block_clear(sblock);
+	sieve_script_binary_write_metadata(script, sblock);
+
+	return sbin;
+}
+
+int sieve_binary_shared_save
+(struct sieve_binary *sbin, enum sieve_compile_flags flags,
+	enum sieve_error *error_r)
+{
+	struct sieve_instance *svinst = sbin->svinst;
+	const char *path, *orig_path;
+	int ret;
+
+	if ( error_r != NULL )
+		*error_r = SIEVE_ERROR_NONE;
+
+	if ( svinst->binary_shared_dir == NULL ) {
+		sieve_sys_error(svinst,
+			"binary shared: sieve_binary_shared_dir is not configured");
+		if ( error_r != NULL )
+			*error_r = SIEVE_ERROR_NOT_POSSIBLE;
+		return -1;
+	}
+	if ( sbin->script == NULL ) {
+		sieve_sys_error(svinst,
+			"binary shared: binary is not associated with a script");
+		if ( error_r != NULL )
+			*error_r = SIEVE_ERROR_NOT_POSSIBLE;
+		return -1;
+	}
+
+	/* Never share binaries that depend on other scripts */
+	if ( sieve_binary_has_include(sbin) ) {
+		sieve_sys_error(svinst,
+			"binary shared: script %s uses the include extension",
+			sieve_script_location(sbin->script));
+		if ( error_r != NULL )
+			*error_r = SIEVE_ERROR_NOT_POSSIBLE;
+		return -1;
+	}
+
+	if ( (path=sieve_binary_shared_path(sbin->script, flags)) == NULL ) {
+		if ( error_r != NULL )
+			*error_r = SIEVE_ERROR_TEMP_FAILURE;
+		return -1;
+	}
+
+	orig_path = sbin->path;
+	ret = sieve_binary_save(sbin, path, TRUE, 0644, error_r);
+	sbin->path = orig_path;
+
+	if ( ret > 0 && svinst->debug ) {
+		sieve_sys_debug(svinst,
+			"binary shared: stored binary for script %s as %s",
+			sieve_script_location(sbin->script), path);
+	}
+	return ret;
+}
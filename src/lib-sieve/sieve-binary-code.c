@@ -34,6 +34,7 @@ static inline sieve_size_t sieve_binary_emit_dynamic_data
 static inline void _sieve_binary_emit_data
 (struct sieve_binary_block *sblock, const void *data, sieve_size_t size)
 {
+	sieve_binary_block_make_writable(sblock);
 	buffer_append(sblock->data, data, size);
 }
 
@@ -47,6 +48,7 @@ static inline void _sieve_binary_update_data
 (struct sieve_binary_block *sblock, sieve_size_t address, const void *data,
 	sieve_size_t size)
 {
+	sieve_binary_block_make_writable(sblock);
 	buffer_write(sblock->data, address, data, size);
 }
 
@@ -402,3 +404,61 @@ const void *sieve_binary_read_extension_object
 
 	return ((const void *const *) objs->objects)[code];
 }
+
+/* Operations */
+
+static inline bool sieve_binary_operation_cache_init
+(struct sieve_binary_block *sblock)
+{
+	size_t size = _sieve_binary_block_get_size(sblock);
+
+	if ( sblock->op_map != NULL && sblock->op_map_size == size )
+		return TRUE;
+
+	/* Block changed since the cache was built (or cache is new) */
+	if ( size == 0 || size >= (uint32_t)-1 )
+		return FALSE;
+
+	sblock->op_map = p_new(sblock->sbin->pool, uint32_t, size);
+	sblock->op_map_size = size;
+	if ( !array_is_created(&sblock->operations) )
+		p_array_init(&sblock->operations, sblock->sbin->pool, 64);
+	else
+		array_clear(&sblock->operations);
+	return TRUE;
+}
+
+bool sieve_binary_read_operation
+(struct sieve_binary_block *sblock, sieve_size_t *address,
+	struct sieve_operation *oprtn)
+{
+	const struct sieve_binary_operation *bop;
+	struct sieve_binary_operation *new_bop;
+	sieve_size_t op_address = *address;
+	uint32_t index;
+
+	if ( !sieve_binary_operation_cache_init(sblock) ||
+		op_address >= sblock->op_map_size )
+		return sieve_operation_read(sblock, address, oprtn);
+
+	if ( (index=sblock->op_map[op_address]) > 0 ) {
+		/* Decoded before */
+		bop = array_idx(&sblock->operations, index - 1);
+		oprtn->def = bop->def;
+		oprtn->ext = bop->ext;
+		oprtn->address = op_address;
+		*address = bop->operands;
+		return TRUE;
+	}
+
+	if ( !sieve_operation_read(sblock, address, oprtn) )
+		return FALSE;
+
+	/* Remember decoded operation */
+	new_bop = array_append_space(&sblock->operations);
+	new_bop->def = oprtn->def;
+	new_bop->ext = oprtn->ext;
+	new_bop->operands = *address;
+	sblock->op_map[op_address] = array_count(&sblock->operations);
+	return TRUE;
+}
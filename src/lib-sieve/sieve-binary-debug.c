@@ -3,6 +3,7 @@
 
 #include "lib.h"
 #include "str.h"
+#include "array.h"
 
 #include "sieve-common.h"
 #include "sieve-error.h"
@@ -113,15 +114,20 @@ void sieve_binary_debug_emit
  * Debug reader
  */
 
-struct sieve_binary_debug_reader {
-	struct sieve_binary_block *sblock;
+/* The line program is decoded once, into a table of (address, line) rows
+ * sorted by address. Lines are then looked up with a binary search, so that
+ * reading them in arbitrary order does not replay the program each time.
+ */
 
-	sieve_size_t address, last_address;
-	unsigned long int line, last_line;
+struct sieve_binary_debug_line {
+	sieve_size_t address;
+	unsigned int line;
+};
 
-	unsigned long int column;
+struct sieve_binary_debug_reader {
+	struct sieve_binary_block *sblock;
 
-	sieve_size_t state;
+	ARRAY(struct sieve_binary_debug_line) lines;
 };
 
 struct sieve_binary_debug_reader *sieve_binary_debug_reader_init
@@ -138,119 +144,109 @@ struct sieve_binary_debug_reader *sieve_binary_debug_reader_init
 void sieve_binary_debug_reader_deinit
 (struct sieve_binary_debug_reader **dreader)
 {
+	if ( array_is_created(&(*dreader)->lines) )
+		array_free(&(*dreader)->lines);
 	i_free(*dreader);
 	*dreader = NULL;
 }
 
-void sieve_binary_debug_reader_reset
+static void sieve_binary_debug_reader_index
 (struct sieve_binary_debug_reader *dreader)
 {
-	dreader->address = 0;
-	dreader->line = 0;
-	dreader->column = 0;
-	dreader->state = 0;
-}
-
-unsigned int sieve_binary_debug_read_line
-(struct sieve_binary_debug_reader *dreader, sieve_size_t code_address)
-{
+	struct sieve_binary_debug_line *row;
 	size_t linprog_size;
-	sieve_size_t address;
-	unsigned long int line;
-
-	if ( code_address < dreader->last_address )
-		sieve_binary_debug_reader_reset(dreader);
-
-	if ( code_address >= dreader->last_address &&
-		code_address < dreader->address ) {
-		debug_printf("%08llx: NOOP [%08llx]\n",
-			(unsigned long long) dreader->state, (unsigned long long) code_address);
-		return dreader->last_line;
-	}
-
-	address = dreader->address;
-	line = dreader->line;
-
-	debug_printf("%08llx: READ [%08llx]\n",
-		(unsigned long long) dreader->state, (unsigned long long) code_address);
+	sieve_size_t state = 0, address = 0;
+	unsigned long int line = 0;
 
 	linprog_size = sieve_binary_block_get_size(dreader->sblock);
-	while ( dreader->state < linprog_size ) {
+	i_array_init(&dreader->lines, linprog_size / 2 + 1);
+
+	while ( state < linprog_size ) {
 		unsigned int opcode;
 		unsigned int value;
 
-		if ( sieve_binary_read_byte(dreader->sblock, &dreader->state, &opcode) ) {
-			switch ( opcode ) {
-
-			case LINPROG_OP_COPY:
-				debug_printf("%08llx: COPY ==> %08llx: %ld\n",
-					(unsigned long long) dreader->state, (unsigned long long) address,
-					line);
-
-				dreader->last_address = dreader->address;
-				dreader->last_line = dreader->line;
-
-				dreader->address = address;
-				dreader->line = line;
-
-				if ( code_address < address ) {
-					return dreader->last_line;
-				} else if ( code_address == address ) {
-					return dreader->line;
-				}
-				break;
-
-			case LINPROG_OP_ADVANCE_PC:
-				debug_printf("%08llx: ADV_PC\n", (unsigned long long) dreader->state);
-				if ( !sieve_binary_read_unsigned
-					(dreader->sblock, &dreader->state, &value) ) {
-					sieve_binary_debug_reader_reset(dreader);
-					return 0;
-				}
-				debug_printf("        : + %d\n", value);
-				address += value;
-				break;
-
-			case LINPROG_OP_ADVANCE_LINE:
-				debug_printf("%08llx: ADV_LINE\n", (unsigned long long) dreader->state);
-				if ( !sieve_binary_read_unsigned
-					(dreader->sblock, &dreader->state, &value) ) {
-					sieve_binary_debug_reader_reset(dreader);
-					return 0;
-				}
-				debug_printf("        : + %d\n", value);
-				line += value;
-				break;
-
-			case LINPROG_OP_SET_COLUMN:
-				debug_printf("%08llx: SET_COL\n", (unsigned long long) dreader->state);
-				if ( !sieve_binary_read_unsigned
-					(dreader->sblock, &dreader->state, &value) ) {
-					sieve_binary_debug_reader_reset(dreader);
-					return 0;
-				}
-				debug_printf("        : = %d\n", value);
-				dreader->column = value;
-				break;
-
-			default:
-				opcode -= LINPROG_OP_SPECIAL_BASE;
-
-				address += (opcode / LINPROG_LINE_RANGE);
-				line += LINPROG_LINE_BASE + (opcode % LINPROG_LINE_RANGE);
-
-				debug_printf("%08llx: SPECIAL\n", (unsigned long long) dreader->state);
-				debug_printf("        :  +A %d +L %d\n", (opcode / LINPROG_LINE_RANGE),
-					LINPROG_LINE_BASE + (opcode % LINPROG_LINE_RANGE));
-				break;
-			}
-		} else {
+		if ( !sieve_binary_read_byte(dreader->sblock, &state, &opcode) ) {
 			debug_printf("OPCODE READ FAILED\n");
-			sieve_binary_debug_reader_reset(dreader);
-			return 0;
+			break;
 		}
-	}
 
-	return dreader->line;
+		switch ( opcode ) {
+		case LINPROG_OP_COPY:
+			debug_printf("%08llx: COPY ==> %08llx: %ld\n",
+				(unsigned long long) state, (unsigned long long) address, line);
+
+			row = array_append_space(&dreader->lines);
+			row->address = address;
+			row->line = line;
+			break;
+
+		case LINPROG_OP_ADVANCE_PC:
+			debug_printf("%08llx: ADV_PC\n", (unsigned long long) state);
+			if ( !sieve_binary_read_unsigned
+				(dreader->sblock, &state, &value) )
+				return;
+			debug_printf("        : + %d\n", value);
+			address += value;
+			break;
+
+		case LINPROG_OP_ADVANCE_LINE:
+			debug_printf("%08llx: ADV_LINE\n", (unsigned long long) state);
+			if ( !sieve_binary_read_unsigned
+				(dreader->sblock, &state, &value) )
+				return;
+			debug_printf("        : + %d\n", value);
+			line += value;
+			break;
+
+		case LINPROG_OP_SET_COLUMN:
+			debug_printf("%08llx: SET_COL\n", (unsigned long long) state);
+			if ( !sieve_binary_read_unsigned
+				(dreader->sblock, &state, &value) )
+				return;
+			debug_printf("        : = %d\n", value);
+			break;
+
+		default:
+			opcode -= LINPROG_OP_SPECIAL_BASE;
+
+			address += (opcode / LINPROG_LINE_RANGE);
+			line += LINPROG_LINE_BASE + (opcode % LINPROG_LINE_RANGE);
+
+			debug_printf("%08llx: SPECIAL\n", (unsigned long long) state);
+			debug_printf("        :  +A %d +L %d\n", (opcode / LINPROG_LINE_RANGE),
+				LINPROG_LINE_BASE + (opcode % LINPROG_LINE_RANGE));
+			break;
+		}
+	}
 }
 
+unsigned int sieve_binary_debug_read_line
+(struct sieve_binary_debug_reader *dreader, sieve_size_t code_address)
+{
+	const struct sieve_binary_debug_line *rows;
+	unsigned int count, left, right, idx;
+
+	if ( !array_is_created(&dreader->lines) )
+		sieve_binary_debug_reader_index(dreader);
+
+	rows = array_get(&dreader->lines, &count);
+	if ( count == 0 )
+		return 0;
+
+	/* Find the first row at or beyond the code address */
+	left = 0; right = count;
+	while ( left < right ) {
+		idx = left + (right - left) / 2;
+		if ( rows[idx].address < code_address )
+			left = idx + 1;
+		else
+			right = idx;
+	}
+
+	/* Without an exact match, the code belongs to the preceding row */
+	if ( left < count && rows[left].address == code_address )
+		return rows[left].line;
+	if ( left == 0 )
+		return 0;
+	return rows[left-1].line;
+}
@@ -4,6 +4,8 @@
 #ifndef __SIEVE_BINARY_PRIVATE_H
 #define __SIEVE_BINARY_PRIVATE_H
 
+#include "hash.h"
+
 #include "sieve-common.h"
 #include "sieve-binary.h"
 #include "sieve-extensions.h"
@@ -27,6 +29,10 @@ struct sieve_binary_file {
 		(struct sieve_binary_file *file, off_t *offset, size_t size);
 	buffer_t *(*load_buffer)
 		(struct sieve_binary_file *file, off_t *offset, size_t size);
+	void (*close)(struct sieve_binary_file *file);
+
+	/* Loaded data refers to a read-only memory mapping of the file */
+	bool mapped:1;
 };
 
 bool sieve_binary_file_open
@@ -60,6 +66,16 @@ struct sieve_binary_extension_reg {
 	unsigned int block_id;
 };
 
+/* Decoded operation */
+
+struct sieve_binary_operation {
+	const struct sieve_operation_def *def;
+	const struct sieve_extension *ext;
+
+	/* Address of the first operand */
+	sieve_size_t operands;
+};
+
 /* Block */
 
 struct sieve_binary_block {
@@ -70,8 +86,36 @@ struct sieve_binary_block {
 	buffer_t *data;
 
 	uoff_t offset;
+
+	/* Operations decoded so far by the interpreter. The op_map is indexed by
+	 * code address and holds the (index + 1) of the decoded operation in the
+	 * operations array, or 0 when no operation was decoded at that address
+	 * yet.
+	 */
+	uint32_t *op_map;
+	size_t op_map_size;
+	ARRAY(struct sieve_binary_operation) operations;
+
+	/* Data derived from the code at a particular address at runtime, kept for
+	 * as long as the binary exists (code address + 1 -> data)
+	 */
+	HASH_TABLE(void *, void *) runtime_data;
+
+	/* The data buffer refers to the memory-mapped binary file; it is copied
+	 * before the block is modified.
+	 */
+	bool data_mapped:1;
 };
 
+void sieve_binary_block_copy_mapped(struct sieve_binary_block *sblock);
+
+static inline void
+sieve_binary_block_make_writable(struct sieve_binary_block *sblock)
+{
+	if ( sblock->data_mapped )
+		sieve_binary_block_copy_mapped(sblock);
+}
+
 /*
  * Binary object
  */
@@ -112,6 +112,19 @@ static inline void sieve_binary_extensions_free(struct sieve_binary *sbin)
 	}
 }
 
+static inline void sieve_binary_blocks_free(struct sieve_binary *sbin)
+{
+	struct sieve_binary_block *const *blocks;
+	unsigned int count, i;
+
+	blocks = array_get(&sbin->blocks, &count);
+	for ( i = 0; i < count; i++ ) {
+		if ( blocks[i] != NULL &&
+			hash_table_is_created(blocks[i]->runtime_data) )
+			hash_table_destroy(&blocks[i]->runtime_data);
+	}
+}
+
 void sieve_binary_unref(struct sieve_binary **sbin)
 {
 	i_assert((*sbin)->refcount > 0);
@@ -120,6 +133,7 @@ void sieve_binary_unref(struct sieve_binary **sbin)
 		return;
 
 	sieve_binary_extensions_free(*sbin);
+	sieve_binary_blocks_free(*sbin);
 
 	if ( (*sbin)->file != NULL )
 		sieve_binary_file_close(&(*sbin)->file);
@@ -278,9 +292,23 @@ struct sieve_binary_block *sieve_binary_block_get
 	return sblock;
 }
 
+void sieve_binary_block_copy_mapped(struct sieve_binary_block *sblock)
+{
+	struct sieve_binary *sbin = sblock->sbin;
+	buffer_t *data;
+
+	i_assert( sblock->data_mapped );
+
+	data = buffer_create_dynamic(sbin->pool, sblock->data->used + 64);
+	buffer_append(data, sblock->data->data, sblock->data->used);
+	sblock->data = data;
+	sblock->data_mapped = FALSE;
+}
+
 void sieve_binary_block_clear
 (struct sieve_binary_block *sblock)
 {
+	sieve_binary_block_make_writable(sblock);
 	buffer_set_used_size(sblock->data, 0);
 }
 
@@ -311,6 +339,28 @@ size_t sieve_binary_block_get_size
 	return _sieve_binary_block_get_size(sblock);
 }
 
+void *sieve_binary_block_get_runtime_data
+(struct sieve_binary_block *sblock, sieve_size_t address)
+{
+	if ( !hash_table_is_created(sblock->runtime_data) )
+		return NULL;
+
+	return hash_table_lookup(sblock->runtime_data,
+		POINTER_CAST(address + 1));
+}
+
+void sieve_binary_block_set_runtime_data
+(struct sieve_binary_block *sblock, sieve_size_t address, void *data)
+{
+	if ( !hash_table_is_created(sblock->runtime_data) ) {
+		hash_table_create_direct
+			(&sblock->runtime_data, sblock->sbin->pool, 0);
+	}
+
+	hash_table_update(sblock->runtime_data,
+		POINTER_CAST(address + 1), data);
+}
+
 /*
  * Up-to-date checking
  */
@@ -318,10 +368,8 @@ size_t sieve_binary_block_get_size
 bool sieve_binary_up_to_date
 (struct sieve_binary *sbin, enum sieve_compile_flags cpflags)
 {
-	struct sieve_binary_extension_reg *const *regs;
 	struct sieve_binary_block *sblock;
 	sieve_size_t offset = 0;
-	unsigned int ext_count, i;
 	int ret;
 
 	i_assert(sbin->file != NULL);
@@ -344,6 +392,15 @@ bool sieve_binary_up_to_date
 		return FALSE;
 	}
 
+	return sieve_binary_extensions_up_to_date(sbin, cpflags);
+}
+
+bool sieve_binary_extensions_up_to_date
+(struct sieve_binary *sbin, enum sieve_compile_flags cpflags)
+{
+	struct sieve_binary_extension_reg *const *regs;
+	unsigned int ext_count, i;
+
 	regs = array_get(&sbin->extensions, &ext_count);
 	for ( i = 0; i < ext_count; i++ ) {
 		const struct sieve_binary_extension *binext = regs[i]->binext;
@@ -74,6 +74,27 @@ struct sieve_binary *sieve_binary_open
 		struct sieve_script *script, enum sieve_error *error_r);
 bool sieve_binary_up_to_date
 	(struct sieve_binary *sbin, enum sieve_compile_flags cpflags);
+bool sieve_binary_extensions_up_to_date
+	(struct sieve_binary *sbin, enum sieve_compile_flags cpflags);
+
+/*
+ * Caching loaded binaries
+ */
+
+struct sieve_binary *sieve_binary_cache_lookup
+	(struct sieve_script *script, enum sieve_compile_flags flags);
+void sieve_binary_cache_add
+	(struct sieve_binary *sbin, enum sieve_compile_flags flags);
+void sieve_binary_cache_free(struct sieve_instance *svinst);
+
+/* Number of times a cached binary was reused */
+unsigned int sieve_binary_cache_hits(struct sieve_instance *svinst);
+
+struct sieve_binary *sieve_binary_shared_lookup
+	(struct sieve_script *script, enum sieve_compile_flags flags);
+int sieve_binary_shared_save
+	(struct sieve_binary *sbin, enum sieve_compile_flags flags,
+		enum sieve_error *error_r);
 
 /*
  * Block management
@@ -107,6 +128,19 @@ struct sieve_binary *sieve_binary_block_get_binary
 unsigned int sieve_binary_block_get_id
 	(const struct sieve_binary_block *sblock);
 
+/* Runtime data
+
+   Allows associating data derived from the (immutable) code at a particular
+   address in a block with the binary, so that it does not need to be derived
+   again for the next execution. The data should be allocated from the binary
+   pool.
+ */
+
+void *sieve_binary_block_get_runtime_data
+	(struct sieve_binary_block *sblock, sieve_size_t address);
+void sieve_binary_block_set_runtime_data
+	(struct sieve_binary_block *sblock, sieve_size_t address, void *data);
+
 /*
  * Extension support
  */
@@ -247,6 +281,12 @@ const void *sieve_binary_read_extension_object
 	(struct sieve_binary_block *sblock, sieve_size_t *address,
     const struct sieve_extension_objects *objs);
 
+/* Operations */
+
+bool sieve_binary_read_operation
+	(struct sieve_binary_block *sblock, sieve_size_t *address,
+		struct sieve_operation *oprtn);
+
 /*
  * Debug info
  */
@@ -271,9 +311,6 @@ struct sieve_binary_debug_reader *sieve_binary_debug_reader_init
 void sieve_binary_debug_reader_deinit
 	(struct sieve_binary_debug_reader **dreader);
 
-void sieve_binary_debug_reader_reset
-	(struct sieve_binary_debug_reader *dreader);
-
 unsigned int sieve_binary_debug_read_line
 	(struct sieve_binary_debug_reader *dreader, sieve_size_t code_address);
 
@@ -31,6 +31,10 @@ static void sieve_code_stringlist_reset
 	(struct sieve_stringlist *_strlist);
 static int sieve_code_stringlist_get_length
 	(struct sieve_stringlist *_strlist);
+static bool sieve_code_stringlist_get_code_address
+	(struct sieve_stringlist *_strlist, sieve_size_t *address_r);
+static bool sieve_code_stringlist_is_literal
+	(struct sieve_stringlist *_strlist);
 
 /* Coded stringlist object */
 
@@ -59,6 +63,8 @@ static struct sieve_stringlist *sieve_code_stringlist_create
 	strlist->strlist.next_item = sieve_code_stringlist_next_item;
 	strlist->strlist.reset = sieve_code_stringlist_reset;
 	strlist->strlist.get_length = sieve_code_stringlist_get_length;
+	strlist->strlist.get_code_address = sieve_code_stringlist_get_code_address;
+	strlist->strlist.is_literal = sieve_code_stringlist_is_literal;
 	strlist->start_address = start_address;
 	strlist->current_offset = start_address;
 	strlist->end_address = end;
@@ -115,6 +121,36 @@ static int sieve_code_stringlist_get_length
 	return strlist->length;
 }
 
+static bool sieve_code_stringlist_get_code_address
+(struct sieve_stringlist *_strlist, sieve_size_t *address_r)
+{
+	struct sieve_code_stringlist *strlist =
+		(struct sieve_code_stringlist *) _strlist;
+
+	*address_r = strlist->start_address;
+	return TRUE;
+}
+
+static bool sieve_code_stringlist_is_literal
+(struct sieve_stringlist *_strlist)
+{
+	struct sieve_code_stringlist *strlist =
+		(struct sieve_code_stringlist *) _strlist;
+	struct sieve_binary_block *sblock = _strlist->runenv->sblock;
+	sieve_size_t address = strlist->start_address;
+	struct sieve_operand operand;
+	int i;
+
+	/* Check that all items are plain string operands */
+	for ( i = 0; i < strlist->length; i++ ) {
+		if ( !sieve_operand_read(sblock, &address, NULL, &operand) ||
+			!sieve_operand_is_string_literal(&operand) ||
+			!sieve_binary_read_string(sblock, &address, NULL) )
+			return FALSE;
+	}
+	return TRUE;
+}
+
 static bool sieve_code_stringlist_dump
 (const struct sieve_dumptime_env *denv, sieve_size_t *address,
 	unsigned int length, sieve_size_t end, const char *field_name)
@@ -188,9 +188,15 @@ struct sieve_instance {
 	/* Storage class registry */
 	struct sieve_storage_class_registry *storage_reg;
 
+	/* Duplicate database driver registry */
+	struct sieve_duplicate_db_registry *duplicate_reg;
+
 	/* System error handler */
 	struct sieve_error_handler *system_ehandler;
 
+	/* Loaded binaries kept for reuse */
+	struct sieve_binary_cache *binary_cache;
+
 	/* Plugin modules */
 	struct sieve_plugin *plugins;
 	enum sieve_env_location env_location;
@@ -200,6 +206,9 @@ struct sieve_instance {
 	size_t max_script_size;
 	unsigned int max_actions;
 	unsigned int max_redirects;
+	unsigned int binary_cache_size;
+	const char *binary_shared_dir;
+	uid_t binary_shared_uid;
 	const struct smtp_address *user_email, *user_email_implicit;
 	struct sieve_address_source redirect_from;
 	unsigned int redirect_duplicate_period;
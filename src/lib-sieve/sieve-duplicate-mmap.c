@@ -0,0 +1,553 @@
+/* Copyright (c) 2002-2018 Pigeonhole authors, see the included COPYING file
+ */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "array.h"
+#include "hostpid.h"
+#include "md5.h"
+#include "mmap-util.h"
+#include "file-lock.h"
+#include "write-full.h"
+
+#include "sieve-common.h"
+#include "sieve-error.h"
+
+#include "sieve-duplicate-private.h"
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+ * Database file format
+ */
+
+/* The file consists of a header followed by an open-addressing hash table of
+ * slots with linear probing. Slots are keyed by the MD5 digest of the user name
+ * and the ID, so that one file can be shared by several users. An empty slot
+ * has an expiry time of 0; expired slots are reused when an ID is inserted and
+ * dropped when the table is rebuilt.
+ *
+ * Slots are updated in place while the table is less than 3/4 full. Otherwise,
+ * the table is rebuilt into a new file of adequate size, which replaces the
+ * old one. Writers hold an exclusive fcntl() lock on the file while changing
+ * it. Lookups hold a shared lock while reading the mapping, since a slot that
+ * is being rewritten for another ID must never be seen half-updated.
+ */
+
+#define SIEVE_DUPLICATE_DB_MAGIC 0x53564450
+#define SIEVE_DUPLICATE_DB_VERSION 1
+
+#define SIEVE_DUPLICATE_DB_MIN_SLOTS 16
+#define SIEVE_DUPLICATE_DB_LOCK_TIMEOUT_SECS 10
+
+struct sieve_duplicate_db_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t slot_count;
+	uint32_t used_count;
+};
+
+struct sieve_duplicate_db_slot {
+	unsigned char hash[MD5_RESULTLEN];
+	uint64_t expire_time;
+};
+
+/*
+ * Database object
+ */
+
+struct sieve_duplicate_db_mark {
+	unsigned char hash[MD5_RESULTLEN];
+	time_t time;
+};
+
+struct sieve_mmap_duplicate_db {
+	struct sieve_duplicate_db db;
+
+	int fd;
+
+	void *mmap_base;
+	size_t mmap_size;
+	const struct sieve_duplicate_db_header *hdr;
+	const struct sieve_duplicate_db_slot *slots;
+
+	/* Marks not yet written to the file */
+	ARRAY(struct sieve_duplicate_db_mark) marks;
+};
+
+static void sieve_mmap_duplicate_unmap(struct sieve_mmap_duplicate_db *mdb)
+{
+	if ( mdb->mmap_base != NULL ) {
+		if ( munmap(mdb->mmap_base, mdb->mmap_size) < 0 ) {
+			sieve_sys_error(mdb->db.svinst,
+				"duplicate db: munmap(%s) failed: %m", mdb->db.path);
+		}
+	}
+	mdb->mmap_base = NULL;
+	mdb->mmap_size = 0;
+	mdb->hdr = NULL;
+	mdb->slots = NULL;
+}
+
+static int sieve_mmap_duplicate_map(struct sieve_mmap_duplicate_db *mdb)
+{
+	const struct sieve_duplicate_db_header *hdr;
+	struct stat st;
+
+	if ( fstat(mdb->fd, &st) < 0 ) {
+		sieve_sys_error(mdb->db.svinst,
+			"duplicate db: fstat(%s) failed: %m", mdb->db.path);
+		return -1;
+	}
+
+	if ( mdb->mmap_base != NULL && (size_t)st.st_size == mdb->mmap_size )
+		return 0;
+	sieve_mmap_duplicate_unmap(mdb);
+
+	/* New database */
+	if ( st.st_size == 0 )
+		return 0;
+
+	mdb->mmap_base = mmap(NULL, (size_t)st.st_size, PROT_READ,
+		MAP_SHARED, mdb->fd, 0);
+	if ( mdb->mmap_base == MAP_FAILED ) {
+		mdb->mmap_base = NULL;
+		sieve_sys_error(mdb->db.svinst,
+			"duplicate db: mmap(%s) failed: %m", mdb->db.path);
+		return -1;
+	}
+	mdb->mmap_size = (size_t)st.st_size;
+
+	hdr = (const struct sieve_duplicate_db_header *)mdb->mmap_base;
+	if ( mdb->mmap_size < sizeof(*hdr) ||
+		hdr->magic != SIEVE_DUPLICATE_DB_MAGIC ||
+		hdr->version != SIEVE_DUPLICATE_DB_VERSION ||
+		hdr->slot_count == 0 ||
+		(hdr->slot_count & (hdr->slot_count - 1)) != 0 ||
+		mdb->mmap_size != sizeof(*hdr) +
+			(size_t)hdr->slot_count * sizeof(struct sieve_duplicate_db_slot) ) {
+		/* Treated as empty; the next flush rebuilds it */
+		sieve_sys_warning(mdb->db.svinst,
+			"duplicate db: file %s is corrupt; rebuilding it", mdb->db.path);
+		return 0;
+	}
+
+	mdb->hdr = hdr;
+	mdb->slots = (const struct sieve_duplicate_db_slot *)(hdr + 1);
+	return 0;
+}
+
+static int sieve_mmap_duplicate_fd_open(struct sieve_mmap_duplicate_db *mdb)
+{
+	mdb->fd = open(mdb->db.path, O_RDWR | O_CREAT, 0600);
+	if ( mdb->fd < 0 ) {
+		sieve_sys_error(mdb->db.svinst,
+			"duplicate db: open(%s) failed: %m", mdb->db.path);
+		return -1;
+	}
+	return 0;
+}
+
+static void sieve_mmap_duplicate_fd_close(struct sieve_mmap_duplicate_db *mdb)
+{
+	sieve_mmap_duplicate_unmap(mdb);
+	if ( mdb->fd != -1 && close(mdb->fd) < 0 ) {
+		sieve_sys_error(mdb->db.svinst,
+			"duplicate db: close(%s) failed: %m", mdb->db.path);
+	}
+	mdb->fd = -1;
+}
+
+/*
+ * Locking
+ */
+
+/* Locks the database file and brings the mapping up to date with it. The file
+   is reopened when it was replaced by a rebuild in the meantime. */
+static int sieve_mmap_duplicate_lock
+(struct sieve_mmap_duplicate_db *mdb, int lock_type,
+	struct file_lock **lock_r)
+{
+	struct stat st, fst;
+	const char *error;
+	int ret;
+
+	*lock_r = NULL;
+	for (;;) {
+		ret = file_wait_lock(mdb->fd, mdb->db.path, lock_type,
+			FILE_LOCK_METHOD_FCNTL, SIEVE_DUPLICATE_DB_LOCK_TIMEOUT_SECS,
+			lock_r, &error);
+		if ( ret <= 0 ) {
+			sieve_sys_error(mdb->db.svinst,
+				"duplicate db: %s", error);
+			return -1;
+		}
+
+		/* Check whether the file was replaced while waiting for the lock */
+		if ( fstat(mdb->fd, &fst) < 0 ) {
+			sieve_sys_error(mdb->db.svinst,
+				"duplicate db: fstat(%s) failed: %m", mdb->db.path);
+			file_unlock(lock_r);
+			return -1;
+		}
+		if ( stat(mdb->db.path, &st) < 0 ) {
+			if ( errno != ENOENT ) {
+				sieve_sys_error(mdb->db.svinst,
+					"duplicate db: stat(%s) failed: %m", mdb->db.path);
+				file_unlock(lock_r);
+				return -1;
+			}
+		} else if ( st.st_ino == fst.st_ino &&
+			CMP_DEV_T(st.st_dev, fst.st_dev) ) {
+			break;
+		}
+
+		file_unlock(lock_r);
+		sieve_mmap_duplicate_fd_close(mdb);
+		if ( sieve_mmap_duplicate_fd_open(mdb) < 0 )
+			return -1;
+	}
+
+	if ( sieve_mmap_duplicate_map(mdb) < 0 ) {
+		file_unlock(lock_r);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Hash table
+ */
+
+/* Returns 1 and the index of the slot holding the hash when it is present.
+   Otherwise, returns 0 and the index of the first empty or expired slot on
+   the probe sequence, or -1 when there is none. */
+static int sieve_duplicate_table_probe
+(const struct sieve_duplicate_db_slot *slots, unsigned int slot_count,
+	const unsigned char hash[MD5_RESULTLEN], unsigned int *idx_r)
+{
+	unsigned int mask = slot_count - 1, idx, n;
+	bool have_free = FALSE;
+	uint32_t hash32;
+
+	memcpy(&hash32, hash, sizeof(hash32));
+	idx = hash32 & mask;
+
+	for ( n = 0; n < slot_count; n++, idx = (idx + 1) & mask ) {
+		const struct sieve_duplicate_db_slot *slot = &slots[idx];
+
+		if ( slot->expire_time == 0 ) {
+			if ( !have_free )
+				*idx_r = idx;
+			return 0;
+		}
+		if ( memcmp(slot->hash, hash, MD5_RESULTLEN) == 0 ) {
+			*idx_r = idx;
+			return 1;
+		}
+		if ( !have_free && slot->expire_time < (uint64_t)ioloop_time ) {
+			*idx_r = idx;
+			have_free = TRUE;
+		}
+	}
+	return ( have_free ? 0 : -1 );
+}
+
+static bool sieve_duplicate_table_insert
+(struct sieve_duplicate_db_slot *slots, unsigned int slot_count,
+	const unsigned char hash[MD5_RESULTLEN], uint64_t expire_time)
+{
+	unsigned int idx;
+	int ret;
+
+	ret = sieve_duplicate_table_probe(slots, slot_count, hash, &idx);
+	i_assert( ret >= 0 );
+
+	memcpy(slots[idx].hash, hash, MD5_RESULTLEN);
+	slots[idx].expire_time = expire_time;
+	return ( ret == 0 );
+}
+
+/*
+ * Database instance
+ */
+
+static struct sieve_duplicate_db *sieve_mmap_duplicate_alloc(void)
+{
+	struct sieve_mmap_duplicate_db *mdb;
+	pool_t pool;
+
+	pool = pool_alloconly_create("sieve_mmap_duplicate_db", 512);
+	mdb = p_new(pool, struct sieve_mmap_duplicate_db, 1);
+	mdb->db = sieve_duplicate_db_mmap;
+	mdb->db.pool = pool;
+	mdb->fd = -1;
+	p_array_init(&mdb->marks, pool, 16);
+
+	return &mdb->db;
+}
+
+static int
+sieve_mmap_duplicate_init(struct sieve_duplicate_db *db,
+	const char *path ATTR_UNUSED)
+{
+	struct sieve_mmap_duplicate_db *mdb =
+		(struct sieve_mmap_duplicate_db *)db;
+
+	return sieve_mmap_duplicate_fd_open(mdb);
+}
+
+static int sieve_mmap_duplicate_flush(struct sieve_duplicate_db *db);
+
+static void sieve_mmap_duplicate_destroy(struct sieve_duplicate_db *db)
+{
+	struct sieve_mmap_duplicate_db *mdb =
+		(struct sieve_mmap_duplicate_db *)db;
+
+	if ( mdb->fd != -1 )
+		(void)sieve_mmap_duplicate_flush(db);
+	sieve_mmap_duplicate_fd_close(mdb);
+}
+
+/*
+ * Checking and marking
+ */
+
+static void sieve_mmap_duplicate_hash
+(struct sieve_duplicate_db *db, const void *id, size_t id_size,
+	unsigned char hash_r[])
+{
+	struct md5_context md5ctx;
+
+	/* User names cannot contain NUL, so the terminator separates both */
+	md5_init(&md5ctx);
+	md5_update(&md5ctx, db->username, strlen(db->username) + 1);
+	md5_update(&md5ctx, id, id_size);
+	md5_final(&md5ctx, hash_r);
+}
+
+static bool sieve_mmap_duplicate_check
+(struct sieve_duplicate_db *db, const void *id, size_t id_size)
+{
+	struct sieve_mmap_duplicate_db *mdb =
+		(struct sieve_mmap_duplicate_db *)db;
+	const struct sieve_duplicate_db_mark *mark;
+	struct file_lock *lock;
+	unsigned char hash[MD5_RESULTLEN];
+	unsigned int idx;
+	bool duplicate = FALSE;
+
+	sieve_mmap_duplicate_hash(db, id, id_size, hash);
+
+	array_foreach(&mdb->marks, mark) {
+		if ( memcmp(mark->hash, hash, MD5_RESULTLEN) == 0 )
+			return ( mark->time >= ioloop_time );
+	}
+
+	if ( sieve_mmap_duplicate_lock(mdb, F_RDLCK, &lock) < 0 )
+		return FALSE;
+
+	if ( mdb->hdr != NULL && sieve_duplicate_table_probe
+		(mdb->slots, mdb->hdr->slot_count, hash, &idx) > 0 ) {
+		duplicate =
+			( mdb->slots[idx].expire_time >= (uint64_t)ioloop_time );
+	}
+
+	file_unlock(&lock);
+	return duplicate;
+}
+
+static void sieve_mmap_duplicate_mark
+(struct sieve_duplicate_db *db, const void *id, size_t id_size,
+	time_t time)
+{
+	struct sieve_mmap_duplicate_db *mdb =
+		(struct sieve_mmap_duplicate_db *)db;
+	struct sieve_duplicate_db_mark *mark;
+	unsigned char hash[MD5_RESULTLEN];
+
+	sieve_mmap_duplicate_hash(db, id, id_size, hash);
+
+	array_foreach_modifiable(&mdb->marks, mark) {
+		if ( memcmp(mark->hash, hash, MD5_RESULTLEN) == 0 ) {
+			mark->time = time;
+			return;
+		}
+	}
+
+	mark = array_append_space(&mdb->marks);
+	memcpy(mark->hash, hash, MD5_RESULTLEN);
+	mark->time = time;
+}
+
+/*
+ * Flushing marks
+ */
+
+static int sieve_mmap_duplicate_update(struct sieve_mmap_duplicate_db *mdb)
+{
+	const struct sieve_duplicate_db_mark *mark;
+	struct sieve_duplicate_db_slot slot;
+	uint32_t used_count = mdb->hdr->used_count;
+	unsigned int idx;
+
+	array_foreach(&mdb->marks, mark) {
+		if ( sieve_duplicate_table_probe
+			(mdb->slots, mdb->hdr->slot_count, mark->hash, &idx) < 0 )
+			i_unreached();
+		if ( mdb->slots[idx].expire_time == 0 )
+			used_count++;
+
+		memcpy(slot.hash, mark->hash, MD5_RESULTLEN);
+		slot.expire_time = (uint64_t)mark->time;
+		if ( pwrite_full(mdb->fd, &slot, sizeof(slot),
+			sizeof(*mdb->hdr) + (off_t)idx * sizeof(slot)) < 0 ) {
+			sieve_sys_error(mdb->db.svinst,
+				"duplicate db: pwrite(%s) failed: %m", mdb->db.path);
+			return -1;
+		}
+	}
+
+	if ( pwrite_full(mdb->fd, &used_count, sizeof(used_count),
+		offsetof(struct sieve_duplicate_db_header, used_count)) < 0 ) {
+		sieve_sys_error(mdb->db.svinst,
+			"duplicate db: pwrite(%s) failed: %m", mdb->db.path);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+sieve_mmap_duplicate_rebuild(struct sieve_mmap_duplicate_db *mdb, int *fd_r)
+{
+	const struct sieve_duplicate_db_mark *mark;
+	struct sieve_duplicate_db_header *hdr;
+	struct sieve_duplicate_db_slot *slots;
+	const char *temp_path;
+	unsigned int slot_count, live_count, i;
+	size_t size;
+	int fd;
+
+	/* Size the new table to be at most half full */
+	live_count = array_count(&mdb->marks);
+	if ( mdb->hdr != NULL ) {
+		for ( i = 0; i < mdb->hdr->slot_count; i++ ) {
+			if ( mdb->slots[i].expire_time >= (uint64_t)ioloop_time )
+				live_count++;
+		}
+	}
+	slot_count = SIEVE_DUPLICATE_DB_MIN_SLOTS;
+	while ( slot_count / 2 < live_count )
+		slot_count *= 2;
+
+	size = sizeof(*hdr) + (size_t)slot_count * sizeof(*slots);
+	hdr = i_malloc(size);
+	hdr->magic = SIEVE_DUPLICATE_DB_MAGIC;
+	hdr->version = SIEVE_DUPLICATE_DB_VERSION;
+	hdr->slot_count = slot_count;
+	slots = (struct sieve_duplicate_db_slot *)(hdr + 1);
+
+	if ( mdb->hdr != NULL ) {
+		for ( i = 0; i < mdb->hdr->slot_count; i++ ) {
+			if ( mdb->slots[i].expire_time < (uint64_t)ioloop_time )
+				continue;
+			if ( sieve_duplicate_table_insert(slots, slot_count,
+				mdb->slots[i].hash, mdb->slots[i].expire_time) )
+				hdr->used_count++;
+		}
+	}
+	array_foreach(&mdb->marks, mark) {
+		if ( sieve_duplicate_table_insert(slots, slot_count,
+			mark->hash, (uint64_t)mark->time) )
+			hdr->used_count++;
+	}
+
+	/* Write the new table and replace the old file with it */
+	temp_path = t_strdup_printf("%s.%s.tmp", mdb->db.path, my_pid);
+	fd = open(temp_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if ( fd < 0 ) {
+		sieve_sys_error(mdb->db.svinst,
+			"duplicate db: open(%s) failed: %m", temp_path);
+		i_free(hdr);
+		return -1;
+	}
+	if ( write_full(fd, hdr, size) < 0 ) {
+		sieve_sys_error(mdb->db.svinst,
+			"duplicate db: write(%s) failed: %m", temp_path);
+		i_close_fd(&fd);
+		i_unlink(temp_path);
+		i_free(hdr);
+		return -1;
+	}
+	i_free(hdr);
+
+	if ( rename(temp_path, mdb->db.path) < 0 ) {
+		sieve_sys_error(mdb->db.svinst,
+			"duplicate db: rename(%s, %s) failed: %m",
+			temp_path, mdb->db.path);
+		i_close_fd(&fd);
+		i_unlink(temp_path);
+		return -1;
+	}
+
+	*fd_r = fd;
+	return 0;
+}
+
+static int sieve_mmap_duplicate_flush(struct sieve_duplicate_db *db)
+{
+	struct sieve_mmap_duplicate_db *mdb =
+		(struct sieve_mmap_duplicate_db *)db;
+	struct file_lock *lock;
+	unsigned int mark_count = array_count(&mdb->marks);
+	int new_fd = -1, ret;
+
+	if ( mark_count == 0 )
+		return 0;
+
+	if ( sieve_mmap_duplicate_lock(mdb, F_WRLCK, &lock) < 0 ) {
+		array_clear(&mdb->marks);
+		return -1;
+	}
+
+	if ( mdb->hdr == NULL ||
+		((uint64_t)mdb->hdr->used_count + mark_count) * 4 >
+			(uint64_t)mdb->hdr->slot_count * 3 ) {
+		T_BEGIN {
+			ret = sieve_mmap_duplicate_rebuild(mdb, &new_fd);
+		} T_END;
+	} else {
+		ret = sieve_mmap_duplicate_update(mdb);
+	}
+	file_unlock(&lock);
+
+	/* Continue with the rebuilt file */
+	if ( new_fd != -1 ) {
+		sieve_mmap_duplicate_fd_close(mdb);
+		mdb->fd = new_fd;
+		if ( sieve_mmap_duplicate_map(mdb) < 0 )
+			ret = -1;
+	}
+
+	array_clear(&mdb->marks);
+	return ret;
+}
+
+/*
+ * Driver definition
+ */
+
+const struct sieve_duplicate_db sieve_duplicate_db_mmap = {
+	.driver_name = "mmap",
+	.v = {
+		.alloc = sieve_mmap_duplicate_alloc,
+		.destroy = sieve_mmap_duplicate_destroy,
+		.init = sieve_mmap_duplicate_init,
+
+		.check = sieve_mmap_duplicate_check,
+		.mark = sieve_mmap_duplicate_mark,
+		.flush = sieve_mmap_duplicate_flush
+	}
+};
@@ -0,0 +1,62 @@
+/* Copyright (c) 2002-2018 Pigeonhole authors, see the included COPYING file
+ */
+
+#ifndef __SIEVE_DUPLICATE_PRIVATE_H
+#define __SIEVE_DUPLICATE_PRIVATE_H
+
+#include "sieve-duplicate.h"
+
+/*
+ * Duplicate database driver
+ */
+
+struct sieve_duplicate_db_vfuncs {
+	struct sieve_duplicate_db *(*alloc)(void);
+	void (*destroy)(struct sieve_duplicate_db *db);
+	int (*init)(struct sieve_duplicate_db *db, const char *path);
+
+	/* Returns TRUE when the ID is marked and its mark has not expired yet */
+	bool (*check)
+		(struct sieve_duplicate_db *db, const void *id, size_t id_size);
+	/* Marks may be deferred until flush() is called */
+	void (*mark)
+		(struct sieve_duplicate_db *db, const void *id, size_t id_size,
+			time_t time);
+	int (*flush)(struct sieve_duplicate_db *db);
+};
+
+struct sieve_duplicate_db {
+	pool_t pool;
+	struct sieve_instance *svinst;
+
+	const char *driver_name;
+	struct sieve_duplicate_db_vfuncs v;
+
+	const char *path;
+	/* IDs are tracked separately for each user, so that a database shared
+	   by several users never reports another user's mark */
+	const char *username;
+};
+
+/*
+ * Driver registry
+ */
+
+void sieve_duplicate_dbs_init(struct sieve_instance *svinst);
+void sieve_duplicate_dbs_deinit(struct sieve_instance *svinst);
+
+void sieve_duplicate_db_driver_register
+	(struct sieve_instance *svinst, const struct sieve_duplicate_db *driver);
+void sieve_duplicate_db_driver_unregister
+	(struct sieve_instance *svinst, const struct sieve_duplicate_db *driver);
+const struct sieve_duplicate_db *sieve_duplicate_db_find_driver
+	(struct sieve_instance *svinst, const char *name);
+
+/*
+ * Built-in drivers
+ */
+
+/* File holding an open-addressing hash table, read through mmap() */
+extern const struct sieve_duplicate_db sieve_duplicate_db_mmap;
+
+#endif /* __SIEVE_DUPLICATE_PRIVATE_H */
@@ -0,0 +1,227 @@
+/* Copyright (c) 2002-2018 Pigeonhole authors, see the included COPYING file
+ */
+
+#include "lib.h"
+#include "array.h"
+#include "home-expand.h"
+
+#include "sieve-common.h"
+#include "sieve-settings.h"
+#include "sieve-error.h"
+
+#include "sieve-duplicate-private.h"
+
+/*
+ * Driver registry
+ */
+
+struct sieve_duplicate_db_registry {
+	ARRAY(const struct sieve_duplicate_db *) drivers;
+};
+
+void sieve_duplicate_dbs_init(struct sieve_instance *svinst)
+{
+	svinst->duplicate_reg =
+		p_new(svinst->pool, struct sieve_duplicate_db_registry, 1);
+	p_array_init(&svinst->duplicate_reg->drivers, svinst->pool, 4);
+
+	sieve_duplicate_db_driver_register(svinst, &sieve_duplicate_db_mmap);
+}
+
+void sieve_duplicate_dbs_deinit(struct sieve_instance *svinst ATTR_UNUSED)
+{
+	/* nothing yet */
+}
+
+void sieve_duplicate_db_driver_register
+(struct sieve_instance *svinst, const struct sieve_duplicate_db *driver)
+{
+	struct sieve_duplicate_db_registry *reg = svinst->duplicate_reg;
+
+	if ( sieve_duplicate_db_find_driver(svinst, driver->driver_name) != NULL ) {
+		i_panic("sieve_duplicate_db_driver_register(%s): Already registered",
+			driver->driver_name);
+	}
+
+	array_append(&reg->drivers, &driver, 1);
+}
+
+void sieve_duplicate_db_driver_unregister
+(struct sieve_instance *svinst, const struct sieve_duplicate_db *driver)
+{
+	struct sieve_duplicate_db_registry *reg = svinst->duplicate_reg;
+	const struct sieve_duplicate_db *const *drivers;
+	unsigned int i, count;
+
+	drivers = array_get(&reg->drivers, &count);
+	for ( i = 0; i < count; i++ ) {
+		if ( drivers[i] == driver ) {
+			array_delete(&reg->drivers, i, 1);
+			break;
+		}
+	}
+}
+
+const struct sieve_duplicate_db *sieve_duplicate_db_find_driver
+(struct sieve_instance *svinst, const char *name)
+{
+	struct sieve_duplicate_db_registry *reg = svinst->duplicate_reg;
+	const struct sieve_duplicate_db *const *drivers;
+	unsigned int i, count;
+
+	drivers = array_get(&reg->drivers, &count);
+	for ( i = 0; i < count; i++ ) {
+		if ( strcasecmp(drivers[i]->driver_name, name) == 0 )
+			return drivers[i];
+	}
+	return NULL;
+}
+
+/*
+ * Database instance
+ */
+
+static int sieve_duplicate_db_location_parse
+(struct sieve_instance *svinst, const char *location,
+	const struct sieve_duplicate_db **driver_r, const char **path_r)
+{
+	const char *p, *driver;
+
+	/* [<driver>:]<path> */
+	p = strchr(location, ':');
+	if ( p == NULL ) {
+		*driver_r = &sieve_duplicate_db_mmap;
+		*path_r = location;
+		return 0;
+	}
+
+	driver = t_strdup_until(location, p);
+	*path_r = p + 1;
+
+	*driver_r = sieve_duplicate_db_find_driver(svinst, driver);
+	if ( *driver_r == NULL ) {
+		sieve_sys_error(svinst,
+			"duplicate db: Unknown driver module `%s'", driver);
+		return -1;
+	}
+	return 0;
+}
+
+static struct sieve_duplicate_db *sieve_duplicate_db_init
+(struct sieve_instance *svinst, const struct sieve_duplicate_db *driver,
+	const char *path, const char *username)
+{
+	struct sieve_duplicate_db *db;
+
+	i_assert( driver->v.alloc != NULL );
+
+	db = driver->v.alloc();
+	db->svinst = svinst;
+	db->driver_name = driver->driver_name;
+	db->v = driver->v;
+	db->path = p_strdup(db->pool, path);
+	db->username = p_strdup(db->pool, username);
+
+	if ( db->v.init != NULL && db->v.init(db, db->path) < 0 ) {
+		sieve_duplicate_db_close(&db);
+		return NULL;
+	}
+	return db;
+}
+
+struct sieve_duplicate_db *sieve_duplicate_db_open
+(struct sieve_instance *svinst, const char *location,
+	const char *username)
+{
+	const struct sieve_duplicate_db *driver;
+	struct sieve_duplicate_db *db;
+	const char *path;
+
+	T_BEGIN {
+		if ( sieve_duplicate_db_location_parse
+			(svinst, location, &driver, &path) < 0 )
+			db = NULL;
+		else
+			db = sieve_duplicate_db_init(svinst, driver, path, username);
+	} T_END;
+
+	return db;
+}
+
+int sieve_duplicate_db_open_default
+(struct sieve_instance *svinst, const char *username,
+	struct sieve_duplicate_db **db_r)
+{
+	const struct sieve_duplicate_db *driver;
+	const char *location, *path;
+	int ret = 1;
+
+	*db_r = NULL;
+
+	location = sieve_setting_get(svinst, "sieve_duplicate_db");
+	if ( location == NULL || *location == '\0' )
+		return 0;
+
+	T_BEGIN {
+		if ( sieve_duplicate_db_location_parse
+			(svinst, location, &driver, &path) < 0 ) {
+			ret = -1;
+
+		/* Expand home dir if necessary */
+		} else if ( path[0] != '/' && svinst->home_dir == NULL ) {
+			sieve_sys_error(svinst,
+				"duplicate db: relative path `%s' requires a home directory",
+				path);
+			ret = -1;
+		} else {
+			if ( path[0] == '~' )
+				path = home_expand_tilde(path, svinst->home_dir);
+			else if ( path[0] != '/' )
+				path = t_strconcat(svinst->home_dir, "/", path, NULL);
+
+			if ( (*db_r=sieve_duplicate_db_init
+				(svinst, driver, path, username)) == NULL )
+				ret = -1;
+		}
+	} T_END;
+
+	return ret;
+}
+
+void sieve_duplicate_db_close(struct sieve_duplicate_db **_db)
+{
+	struct sieve_duplicate_db *db = *_db;
+
+	*_db = NULL;
+
+	if ( db->v.destroy != NULL )
+		db->v.destroy(db);
+	pool_unref(&db->pool);
+}
+
+/*
+ * Checking and marking
+ */
+
+bool sieve_duplicate_db_check
+(struct sieve_duplicate_db *db, const void *id, size_t id_size)
+{
+	return db->v.check(db, id, id_size);
+}
+
+void sieve_duplicate_db_mark
+(struct sieve_duplicate_db *db, const void *id, size_t id_size,
+	time_t time)
+{
+	if ( time <= 0 )
+		return;
+
+	db->v.mark(db, id, id_size, time);
+}
+
+int sieve_duplicate_db_flush(struct sieve_duplicate_db *db)
+{
+	if ( db->v.flush == NULL )
+		return 0;
+	return db->v.flush(db);
+}
@@ -0,0 +1,43 @@
+/* Copyright (c) 2002-2018 Pigeonhole authors, see the included COPYING file
+ */
+
+#ifndef __SIEVE_DUPLICATE_H
+#define __SIEVE_DUPLICATE_H
+
+#include "sieve-common.h"
+
+/*
+ * Duplicate tracking database
+ */
+
+/* Database of duplicate IDs and their expiry times, implemented by one of the
+ * registered duplicate database drivers (see sieve-duplicate-private.h). A
+ * location has the form [<driver>:]<path>; the "mmap" driver is used when no
+ * driver is specified.
+ *
+ * A script environment that has a duplicate_db assigned uses it instead of its
+ * duplicate_check()/duplicate_mark()/duplicate_flush() callbacks. The database
+ * is opened for one user and keeps the marks of different users apart, just
+ * like the LDA duplicate database does.
+ */
+
+struct sieve_duplicate_db;
+
+/* Opens the database configured with the sieve_duplicate_db setting. Returns
+   0 when none is configured and -1 when it cannot be opened. */
+int sieve_duplicate_db_open_default
+	(struct sieve_instance *svinst, const char *username,
+		struct sieve_duplicate_db **db_r);
+struct sieve_duplicate_db *sieve_duplicate_db_open
+	(struct sieve_instance *svinst, const char *location,
+		const char *username);
+void sieve_duplicate_db_close(struct sieve_duplicate_db **_db);
+
+bool sieve_duplicate_db_check
+	(struct sieve_duplicate_db *db, const void *id, size_t id_size);
+void sieve_duplicate_db_mark
+	(struct sieve_duplicate_db *db, const void *id, size_t id_size,
+		time_t time);
+int sieve_duplicate_db_flush(struct sieve_duplicate_db *db);
+
+#endif /* __SIEVE_DUPLICATE_H */
@@ -889,6 +889,21 @@ bool sieve_interpreter_get_test_result
  * Code execute
  */
 
+/* Number of operations executed within a single data stack frame when not
+   tracing */
+#define SIEVE_INTERPRETER_OPS_PER_FRAME 32
+
+static inline bool sieve_interpreter_check_loop_limit
+(struct sieve_interpreter *interp)
+{
+	if ( interp->loop_limit != 0 && interp->runenv.pc > interp->loop_limit ) {
+		sieve_runtime_trace_error(&interp->runenv,
+			"program crossed loop boundary");
+		return FALSE;
+	}
+	return TRUE;
+}
+
 static int sieve_interpreter_operation_execute
 (struct sieve_interpreter *interp)
 {
@@ -924,6 +939,43 @@ static int sieve_interpreter_operation_execute
 	return SIEVE_EXEC_BIN_CORRUPT;
 }
 
+static int sieve_interpreter_operations_dispatch
+(struct sieve_interpreter *interp)
+{
+	const struct sieve_runtime_env *renv = &interp->runenv;
+	struct sieve_operation *oprtn = &(interp->oprtn);
+	sieve_size_t *address = &(interp->runenv.pc);
+	size_t code_size = sieve_binary_block_get_size(renv->sblock);
+	unsigned int count = 0;
+	int ret = SIEVE_EXEC_OK;
+
+	/* Executes a run of operations using the decoded operations cached in the
+	   binary block, without the per-operation overhead needed for tracing. */
+	T_BEGIN {
+		while ( ret == SIEVE_EXEC_OK && !interp->interrupted &&
+			*address < code_size && count++ < SIEVE_INTERPRETER_OPS_PER_FRAME ) {
+			if ( !sieve_interpreter_check_loop_limit(interp) ) {
+				ret = SIEVE_EXEC_BIN_CORRUPT;
+				break;
+			}
+
+			if ( !sieve_binary_read_operation(renv->sblock, address, oprtn) ) {
+				sieve_runtime_trace_error(renv, "Encountered invalid operation");
+				ret = SIEVE_EXEC_BIN_CORRUPT;
+				break;
+			}
+
+			/* Reset cached command location */
+			interp->command_line = 0;
+
+			if ( oprtn->def->execute != NULL )
+				ret = oprtn->def->execute(renv, address);
+		}
+	} T_END;
+
+	return ret;
+}
+
 int sieve_interpreter_continue
 (struct sieve_interpreter *interp, bool *interrupted)
 {
@@ -939,9 +991,12 @@ int sieve_interpreter_continue
 
 	while ( ret == SIEVE_EXEC_OK && !interp->interrupted &&
 		*address < sieve_binary_block_get_size(renv->sblock) ) {
-		if ( interp->loop_limit != 0 && *address > interp->loop_limit ) {
-			sieve_runtime_trace_error(renv,
-				"program crossed loop boundary");
+		if ( renv->trace == NULL ) {
+			ret = sieve_interpreter_operations_dispatch(interp);
+			continue;
+		}
+
+		if ( !sieve_interpreter_check_loop_limit(interp) ) {
 			ret = SIEVE_EXEC_BIN_CORRUPT;
 			break;
 		}
@@ -42,4 +42,6 @@
 #define SIEVE_DEFAULT_MAX_ACTIONS      32
 #define SIEVE_DEFAULT_MAX_REDIRECTS    4
 
+#define SIEVE_DEFAULT_BINARY_CACHE_SIZE 16
+
 #endif /* __SIEVE_LIMITS_H */
@@ -5,6 +5,7 @@
 #include "mempool.h"
 #include "hash.h"
 #include "array.h"
+#include "str.h"
 #include "str-sanitize.h"
 
 #include "sieve-extensions.h"
@@ -22,6 +23,284 @@
 
 #include "sieve-match.h"
 
+/*
+ * Multi-key matching
+ */
+
+/* For literal key lists used with the :is or :contains match types and the
+ * i;octet or i;ascii-casemap comparators, the keys are compiled into a key set
+ * that allows matching a value against all keys in a single pass. For :is
+ * this is a hash set of the keys and for :contains this is an Aho-Corasick
+ * automaton. The key set is built once and stored with the binary, indexed by
+ * the code address of the key list.
+ */
+
+/* Key lists with fewer items are matched one key at a time */
+#define SIEVE_MATCH_KEY_SET_MIN_KEYS 4
+
+struct sieve_match_ac_node {
+	unsigned int first_child, next_sibling;
+	unsigned int fail;
+
+	unsigned char c;
+	bool output;
+};
+
+struct sieve_match_key_set {
+	const struct sieve_match_type_def *mcht_def;
+	const struct sieve_comparator_def *cmp_def;
+
+	/* :is */
+	HASH_TABLE(const char *, void *) keys;
+
+	/* :contains */
+	struct sieve_match_ac_node *nodes;
+	unsigned int root_next[256];
+
+	bool icase:1;
+	bool have_empty_key:1;
+	bool unusable:1;
+};
+
+static inline unsigned int
+sieve_match_ac_child(const struct sieve_match_ac_node *nodes,
+	unsigned int state, unsigned char c)
+{
+	unsigned int child;
+
+	for ( child = nodes[state].first_child; child != 0;
+		child = nodes[child].next_sibling ) {
+		if ( nodes[child].c == c )
+			return child;
+	}
+	return 0;
+}
+
+static bool sieve_match_key_set_build_is
+(struct sieve_match_key_set *kset, pool_t pool,
+	string_t *const *keys, unsigned int count)
+{
+	unsigned int i;
+
+	if ( kset->icase ) {
+		hash_table_create
+			(&kset->keys, pool, count, strcase_hash, strcasecmp);
+	} else {
+		hash_table_create(&kset->keys, pool, count, str_hash, strcmp);
+	}
+
+	for ( i = 0; i < count; i++ ) {
+		const char *key = str_c(keys[i]);
+
+		/* Keys with embedded NUL characters cannot be used as hash key */
+		if ( strlen(key) != str_len(keys[i]) )
+			return FALSE;
+
+		if ( str_len(keys[i]) == 0 )
+			kset->have_empty_key = TRUE;
+		hash_table_update(kset->keys, p_strdup(pool, key), POINTER_CAST(1));
+	}
+	return TRUE;
+}
+
+static bool sieve_match_key_set_build_contains
+(struct sieve_match_key_set *kset, pool_t pool,
+	string_t *const *keys, unsigned int count)
+{
+	ARRAY(struct sieve_match_ac_node) nodes;
+	ARRAY(unsigned int) queue;
+	struct sieve_match_ac_node *node;
+	unsigned int i, state, child, fail, head, nodes_count;
+
+	t_array_init(&nodes, 256);
+	(void)array_append_space(&nodes); /* root */
+
+	/* Build trie of all keys */
+	for ( i = 0; i < count; i++ ) {
+		const unsigned char *key = str_data(keys[i]);
+		size_t key_size = str_len(keys[i]), j;
+
+		if ( key_size == 0 ) {
+			kset->have_empty_key = TRUE;
+			continue;
+		}
+
+		state = 0;
+		for ( j = 0; j < key_size; j++ ) {
+			unsigned char c = ( kset->icase ? i_tolower(key[j]) : key[j] );
+
+			child = sieve_match_ac_child
+				(array_idx(&nodes, 0), state, c);
+			if ( child == 0 ) {
+				child = array_count(&nodes);
+				node = array_append_space(&nodes);
+				node->c = c;
+				node->next_sibling =
+					array_idx(&nodes, state)->first_child;
+				array_idx_modifiable(&nodes, state)->first_child = child;
+			}
+			state = child;
+		}
+		array_idx_modifiable(&nodes, state)->output = TRUE;
+	}
+
+	/* Compute failure links breadth-first */
+	node = array_get_modifiable(&nodes, &nodes_count);
+	t_array_init(&queue, nodes_count);
+	for ( child = node[0].first_child; child != 0;
+		child = node[child].next_sibling ) {
+		node[child].fail = 0;
+		array_append(&queue, &child, 1);
+	}
+	for ( head = 0; head < array_count(&queue); head++ ) {
+		state = *array_idx(&queue, head);
+
+		for ( child = node[state].first_child; child != 0;
+			child = node[child].next_sibling ) {
+			fail = node[state].fail;
+			while ( fail != 0 &&
+				sieve_match_ac_child(node, fail, node[child].c) == 0 )
+				fail = node[fail].fail;
+			node[child].fail =
+				sieve_match_ac_child(node, fail, node[child].c);
+			if ( node[node[child].fail].output )
+				node[child].output = TRUE;
+			array_append(&queue, &child, 1);
+		}
+	}
+
+	/* Copy automaton into permanent storage */
+	kset->nodes = p_new(pool, struct sieve_match_ac_node, nodes_count);
+	memcpy(kset->nodes, node, sizeof(*node) * nodes_count);
+	for ( i = 0; i < N_ELEMENTS(kset->root_next); i++ )
+		kset->root_next[i] = sieve_match_ac_child(node, 0, (unsigned char)i);
+	return TRUE;
+}
+
+static struct sieve_match_key_set *sieve_match_key_set_build
+(struct sieve_match_context *mctx, struct sieve_stringlist *key_list)
+{
+	const struct sieve_runtime_env *renv = mctx->runenv;
+	pool_t pool = sieve_binary_pool
+		(sieve_binary_block_get_binary(renv->sblock));
+	struct sieve_match_key_set *kset;
+	ARRAY(string_t *) keys;
+	string_t *key_item = NULL;
+	string_t *const *key_items;
+	unsigned int count;
+	int ret;
+
+	kset = p_new(pool, struct sieve_match_key_set, 1);
+	kset->mcht_def = mctx->match_type->def;
+	kset->cmp_def = mctx->comparator->def;
+	kset->icase = ( kset->cmp_def == &i_ascii_casemap_comparator );
+
+	if ( !sieve_stringlist_is_literal(key_list) ) {
+		kset->unusable = TRUE;
+		return kset;
+	}
+
+	/* Read all keys */
+	t_array_init(&keys, 64);
+	sieve_stringlist_reset(key_list);
+	while ( (ret=sieve_stringlist_next_item(key_list, &key_item)) > 0 )
+		array_append(&keys, &key_item, 1);
+	sieve_stringlist_reset(key_list);
+
+	key_items = array_get(&keys, &count);
+	if ( ret < 0 || count < SIEVE_MATCH_KEY_SET_MIN_KEYS ) {
+		kset->unusable = TRUE;
+		return kset;
+	}
+
+	if ( kset->mcht_def == &is_match_type ) {
+		if ( !sieve_match_key_set_build_is(kset, pool, key_items, count) )
+			kset->unusable = TRUE;
+	} else {
+		if ( !sieve_match_key_set_build_contains
+			(kset, pool, key_items, count) )
+			kset->unusable = TRUE;
+	}
+	return kset;
+}
+
+static const struct sieve_match_key_set *sieve_match_key_set_get
+(struct sieve_match_context *mctx, struct sieve_stringlist *key_list)
+{
+	const struct sieve_runtime_env *renv = mctx->runenv;
+	const struct sieve_match_type *mcht = mctx->match_type;
+	const struct sieve_comparator *cmp = mctx->comparator;
+	struct sieve_match_key_set *kset;
+	sieve_size_t address;
+
+	if ( mcht->def != &is_match_type && mcht->def != &contains_match_type )
+		return NULL;
+	if ( cmp->def != &i_octet_comparator &&
+		cmp->def != &i_ascii_casemap_comparator )
+		return NULL;
+	if ( !sieve_stringlist_get_code_address(key_list, &address) )
+		return NULL;
+
+	kset = (struct sieve_match_key_set *)
+		sieve_binary_block_get_runtime_data(renv->sblock, address);
+	if ( kset == NULL || kset->mcht_def != mcht->def ||
+		kset->cmp_def != cmp->def ) {
+		kset = sieve_match_key_set_build(mctx, key_list);
+		sieve_binary_block_set_runtime_data(renv->sblock, address, kset);
+	}
+
+	return ( kset->unusable ? NULL : kset );
+}
+
+static inline unsigned int
+sieve_match_ac_step(const struct sieve_match_key_set *kset,
+	unsigned int state, unsigned char c)
+{
+	const struct sieve_match_ac_node *nodes = kset->nodes;
+	unsigned int next;
+
+	if ( kset->icase )
+		c = i_tolower(c);
+
+	for (;;) {
+		if ( state == 0 )
+			return kset->root_next[c];
+		if ( (next=sieve_match_ac_child(nodes, state, c)) != 0 )
+			return next;
+		state = nodes[state].fail;
+	}
+}
+
+static int sieve_match_key_set_match
+(const struct sieve_match_key_set *kset, const char *value,
+	size_t value_size)
+{
+	const unsigned char *vp = (const unsigned char *)value;
+	const unsigned char *vend = vp + value_size;
+	unsigned int state = 0;
+
+	if ( kset->mcht_def == &is_match_type ) {
+		/* Values with embedded NUL characters are matched one key at a
+		   time */
+		if ( memchr(value, '\0', value_size) != NULL )
+			return -1;
+
+		value = t_strndup(value, value_size);
+		return ( hash_table_lookup(kset->keys, value) != NULL ? 1 : 0 );
+	}
+
+	if ( value_size == 0 || kset->have_empty_key )
+		return ( kset->have_empty_key ? 1 : 0 );
+
+	/* Run the Aho-Corasick automaton over the value */
+	for ( ; vp < vend; vp++ ) {
+		state = sieve_match_ac_step(kset, state, *vp);
+		if ( kset->nodes[state].output )
+			return 1;
+	}
+	return 0;
+}
+
 /*
  * Matching implementation
  */
@@ -87,7 +366,20 @@ int sieve_match_value
 
 	sieve_runtime_trace_descend(renv);
 
-	if ( mcht->def->match_keys != NULL ) {
+	/* Obtain key set for literal key list (not used when tracing, since keys
+	   are then traced one by one) */
+	if ( !mctx->trace &&
+		(!mctx->key_set_checked || mctx->key_list != key_list) ) {
+		mctx->key_set = sieve_match_key_set_get(mctx, key_list);
+		mctx->key_list = key_list;
+		mctx->key_set_checked = TRUE;
+	}
+
+	if ( mctx->key_set != NULL &&
+		(match=sieve_match_key_set_match
+			(mctx->key_set, value, value_size)) >= 0 ) {
+		/* Matched against all keys at once */
+	} else if ( mcht->def->match_keys != NULL ) {
 		/* Call match-type's own key match handler */
 		match = mcht->def->match_keys(mctx, value, value_size, key_list);
 	} else {
@@ -195,6 +487,180 @@ int sieve_match
 	return match;
 }
 
+/*
+ * Incremental matching
+ */
+
+/* Values that are too large to be kept in memory as a whole can be matched
+ * chunk by chunk. This is only possible for :contains and for :matches keys
+ * of the form `*literal*', which are both matched with an Aho-Corasick
+ * automaton. The automaton state carries partial matches across chunk
+ * boundaries, so no value data needs to be retained between chunks.
+ */
+
+struct sieve_match_stream {
+	struct sieve_match_context *mctx;
+
+	struct sieve_match_key_set kset;
+	unsigned int state;
+
+	int match;
+};
+
+static bool sieve_match_stream_key_glob
+(string_t *key, string_t **literal_r)
+{
+	const char *kp = str_c(key);
+	size_t len = str_len(key), i;
+	string_t *literal;
+
+	/* Key must start with a wildcard */
+	for ( i = 0; i < len && kp[i] == '*'; i++ );
+	if ( i == 0 )
+		return FALSE;
+
+	literal = t_str_new(len);
+	if ( i == len ) {
+		*literal_r = literal;
+		return TRUE;
+	}
+
+	for ( ; i < len; i++ ) {
+		switch ( kp[i] ) {
+		case '\\':
+			if ( ++i == len )
+				return FALSE;
+			str_append_c(literal, kp[i]);
+			break;
+		case '?':
+			return FALSE;
+		case '*':
+			/* Only trailing wildcards may follow */
+			for ( ; i < len; i++ ) {
+				if ( kp[i] != '*' )
+					return FALSE;
+			}
+			*literal_r = literal;
+			return TRUE;
+		default:
+			str_append_c(literal, kp[i]);
+		}
+	}
+
+	/* Key must end with a wildcard */
+	return FALSE;
+}
+
+struct sieve_match_stream *sieve_match_stream_begin
+(struct sieve_match_context *mctx, struct sieve_stringlist *key_list)
+{
+	const struct sieve_match_type *mcht = mctx->match_type;
+	const struct sieve_comparator *cmp = mctx->comparator;
+	struct sieve_match_stream *mstream;
+	bool usable = TRUE;
+
+	/* Keys are traced one at a time when tracing */
+	if ( mctx->trace )
+		return NULL;
+	if ( cmp->def != &i_octet_comparator &&
+		cmp->def != &i_ascii_casemap_comparator )
+		return NULL;
+	if ( mcht->def == &matches_match_type ) {
+		/* Match values need the full value */
+		if ( sieve_match_values_are_enabled(mctx->runenv) )
+			return NULL;
+	} else if ( mcht->def != &contains_match_type ) {
+		return NULL;
+	}
+
+	mstream = p_new(mctx->pool, struct sieve_match_stream, 1);
+	mstream->mctx = mctx;
+	mstream->kset.mcht_def = &contains_match_type;
+	mstream->kset.cmp_def = cmp->def;
+	mstream->kset.icase = ( cmp->def == &i_ascii_casemap_comparator );
+
+	T_BEGIN {
+		ARRAY(string_t *) keys;
+		string_t *key_item = NULL, *literal;
+		string_t *const *key_items;
+		unsigned int count;
+		int ret = 0;
+
+		/* Read all keys */
+		t_array_init(&keys, 16);
+		sieve_stringlist_reset(key_list);
+		while ( (ret=sieve_stringlist_next_item(key_list, &key_item)) > 0 ) {
+			if ( mcht->def == &matches_match_type ) {
+				if ( !sieve_match_stream_key_glob(key_item, &literal) ) {
+					usable = FALSE;
+					break;
+				}
+				key_item = literal;
+			}
+			array_append(&keys, &key_item, 1);
+		}
+		sieve_stringlist_reset(key_list);
+
+		/* Key list errors are reported by the regular match */
+		if ( ret < 0 )
+			usable = FALSE;
+
+		if ( usable ) {
+			key_items = array_get(&keys, &count);
+			usable = sieve_match_key_set_build_contains
+				(&mstream->kset, mctx->pool, key_items, count);
+		}
+	} T_END;
+
+	return ( usable ? mstream : NULL );
+}
+
+static inline void
+sieve_match_stream_update_status(struct sieve_match_stream *mstream)
+{
+	struct sieve_match_context *mctx = mstream->mctx;
+
+	if ( mctx->match_status >= 0 && mstream->match > mctx->match_status )
+		mctx->match_status = mstream->match;
+}
+
+void sieve_match_stream_value_begin(struct sieve_match_stream *mstream)
+{
+	mstream->state = 0;
+	mstream->match = ( mstream->kset.have_empty_key ? 1 : 0 );
+	sieve_match_stream_update_status(mstream);
+}
+
+int sieve_match_stream_value_more
+(struct sieve_match_stream *mstream, const unsigned char *data,
+	size_t size)
+{
+	const struct sieve_match_key_set *kset = &mstream->kset;
+	const unsigned char *dp = data, *dend = data + size;
+	unsigned int state = mstream->state;
+
+	if ( mstream->match > 0 )
+		return 1;
+
+	for ( ; dp < dend; dp++ ) {
+		state = sieve_match_ac_step(kset, state, *dp);
+		if ( kset->nodes[state].output ) {
+			mstream->match = 1;
+			sieve_match_stream_update_status(mstream);
+			break;
+		}
+	}
+
+	mstream->state = state;
+	return mstream->match;
+}
+
+int sieve_match_stream_value_end(struct sieve_match_stream *mstream)
+{
+	sieve_match_stream_update_status(mstream);
+	return mstream->match;
+}
+
 /*
  * Reading match operands
  */
@@ -20,10 +20,15 @@ struct sieve_match_context {
 
 	void *data;
 
+	/* Multi-key matcher for literal key lists (if applicable) */
+	struct sieve_stringlist *key_list;
+	const struct sieve_match_key_set *key_set;
+
 	int match_status;
 	int exec_status;
 
 	bool trace:1;
+	bool key_set_checked:1;
 };
 
 /*
@@ -49,6 +54,19 @@ int sieve_match
 		struct sieve_stringlist *key_list,
 		int *exec_status);
 
+/* Incremental matching (for values that are not available as a whole);
+   sieve_match_stream_begin() returns NULL when the match type, comparator or
+   key list do not allow this. */
+struct sieve_match_stream;
+
+struct sieve_match_stream *sieve_match_stream_begin
+	(struct sieve_match_context *mctx, struct sieve_stringlist *key_list);
+void sieve_match_stream_value_begin(struct sieve_match_stream *mstream);
+int sieve_match_stream_value_more
+	(struct sieve_match_stream *mstream, const unsigned char *data,
+		size_t size);
+int sieve_match_stream_value_end(struct sieve_match_stream *mstream);
+
 /*
  * Read matching operands
  */
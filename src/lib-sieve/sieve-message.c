@@ -5,6 +5,7 @@
 #include "ioloop.h"
 #include "mempool.h"
 #include "array.h"
+#include "hash.h"
 #include "str.h"
 #include "str-sanitize.h"
 #include "istream.h"
@@ -78,6 +79,26 @@ struct sieve_message_part {
 	bool epilogue:1;  /* this is a multipart epilogue */
 };
 
+struct sieve_message_cache {
+	pool_t pool;
+	int refcount;
+
+	/* The message (version) the cache was filled from */
+	struct mail *mail;
+
+	ARRAY(struct sieve_message_part *) body_parts;
+	buffer_t *raw_body;
+
+	/* Number of times the message was read for this cache */
+	unsigned int reads;
+};
+
+struct sieve_message_header_field {
+	/* Right-trimmed values, NULL-terminated; NULL until first read */
+	const char *const *raw_values;
+	const char *const *utf8_values;
+};
+
 struct sieve_message_version {
 	struct mail *mail;
 	struct mailbox *box;
@@ -105,16 +126,63 @@ struct sieve_message_context {
 
 	ARRAY(void *) ext_contexts;
 
+	/* Header fields read so far */
+
+	HASH_TABLE(const char *, struct sieve_message_header_field *) header_index;
+
 	/* Body */
 
-	ARRAY(struct sieve_message_part *) cached_body_parts;
+	struct sieve_message_cache *cache;
+	ARRAY(struct sieve_message_cache *) retired_caches;
 	ARRAY(struct sieve_message_part_data) return_body_parts;
-	buffer_t *raw_body;
 
 	bool edit_snapshot:1;
 	bool substitute_snapshot:1;
 };
 
+/*
+ * Parsed message cache
+ */
+
+struct sieve_message_cache *sieve_message_cache_create(struct mail *mail)
+{
+	struct sieve_message_cache *cache;
+	pool_t pool;
+
+	pool = pool_alloconly_create("sieve_message_cache", 4096);
+	cache = p_new(pool, struct sieve_message_cache, 1);
+	cache->pool = pool;
+	cache->refcount = 1;
+	cache->mail = mail;
+	p_array_init(&cache->body_parts, pool, 8);
+
+	return cache;
+}
+
+void sieve_message_cache_ref(struct sieve_message_cache *cache)
+{
+	i_assert(cache->refcount > 0);
+	cache->refcount++;
+}
+
+void sieve_message_cache_unref(struct sieve_message_cache **_cache)
+{
+	struct sieve_message_cache *cache = *_cache;
+
+	*_cache = NULL;
+
+	i_assert(cache->refcount > 0);
+	if (--cache->refcount != 0)
+		return;
+
+	pool_unref(&cache->pool);
+}
+
+unsigned int sieve_message_cache_get_reads(struct sieve_message_cache *cache)
+{
+	return cache->reads;
+}
+
 /*
  * Message versions
  */
@@ -187,6 +255,7 @@ void sieve_message_context_ref(struct sieve_message_context *msgctx)
 static void sieve_message_context_clear(struct sieve_message_context *msgctx)
 {
 	struct sieve_message_version *versions;
+	struct sieve_message_cache **caches;
 	unsigned int count, i;
 
 	if ( msgctx->pool != NULL ) {
@@ -196,6 +265,10 @@ static void sieve_message_context_clear(struct sieve_message_context *msgctx)
 			sieve_message_version_free(&versions[i]);
 		}
 
+		caches = array_get_modifiable(&msgctx->retired_caches, &count);
+		for ( i = 0; i < count; i++ )
+			sieve_message_cache_unref(&caches[i]);
+
 		pool_unref(&(msgctx->pool));
 	}
 }
@@ -212,6 +285,10 @@ void sieve_message_context_unref(struct sieve_message_context **msgctx)
 
 	sieve_message_context_clear(*msgctx);
 
+	if ( (*msgctx)->cache != NULL )
+		sieve_message_cache_unref(&(*msgctx)->cache);
+	if ( hash_table_is_created((*msgctx)->header_index) )
+		hash_table_destroy(&(*msgctx)->header_index);
 	if ( (*msgctx)->context_pool != NULL )
 		pool_unref(&((*msgctx)->context_pool));
 
@@ -219,10 +296,47 @@ void sieve_message_context_unref(struct sieve_message_context **msgctx)
 	*msgctx = NULL;
 }
 
+static void
+sieve_message_context_retire_cache(struct sieve_message_context *msgctx)
+{
+	if ( msgctx->cache == NULL )
+		return;
+
+	/* Part iterators may still refer to it, so keep it until reset */
+	array_append(&msgctx->retired_caches, &msgctx->cache, 1);
+	msgctx->cache = NULL;
+}
+
+static struct sieve_message_cache *
+sieve_message_context_get_cache(struct sieve_message_context *msgctx)
+{
+	struct mail *mail = sieve_message_get_mail(msgctx);
+
+	/* The cache only describes the message version it was filled from;
+	   once the message is edited or substituted, start a new one */
+	if ( msgctx->cache != NULL && msgctx->cache->mail != mail )
+		sieve_message_context_retire_cache(msgctx);
+	if ( msgctx->cache == NULL )
+		msgctx->cache = sieve_message_cache_create(mail);
+	return msgctx->cache;
+}
+
+void sieve_message_context_set_cache(struct sieve_message_context *msgctx,
+	struct sieve_message_cache *cache)
+{
+	i_assert( cache->mail == sieve_message_get_mail(msgctx) );
+
+	sieve_message_context_retire_cache(msgctx);
+	sieve_message_cache_ref(cache);
+	msgctx->cache = cache;
+}
+
 static void sieve_message_context_flush(struct sieve_message_context *msgctx)
 {
 	pool_t pool;
 
+	if ( hash_table_is_created(msgctx->header_index) )
+		hash_table_destroy(&msgctx->header_index);
 	if ( msgctx->context_pool != NULL )
 		pool_unref(&(msgctx->context_pool));
 
@@ -232,9 +346,9 @@ static void sieve_message_context_flush(struct sieve_message_context *msgctx)
 	p_array_init(&msgctx->ext_contexts, pool,
 		sieve_extensions_get_count(msgctx->svinst));
 
-	p_array_init(&msgctx->cached_body_parts, pool, 8);
 	p_array_init(&msgctx->return_body_parts, pool, 8);
-	msgctx->raw_body = NULL;
+
+	sieve_message_context_retire_cache(msgctx);
 }
 
 void sieve_message_context_reset(struct sieve_message_context *msgctx)
@@ -244,6 +358,7 @@ void sieve_message_context_reset(struct sieve_message_context *msgctx)
 	msgctx->pool = pool_alloconly_create("sieve_message_context", 1024);
 
 	p_array_init(&msgctx->versions, msgctx->pool, 4);
+	p_array_init(&msgctx->retired_caches, msgctx->pool, 4);
 
 	sieve_message_context_flush(msgctx);
 }
@@ -402,6 +517,11 @@ struct edit_mail *sieve_message_edit
 
 	version = sieve_message_version_get(msgctx);
 
+	/* The caller is about to modify the header; values read before remain
+	   allocated for lists still returning them */
+	if ( hash_table_is_created(msgctx->header_index) )
+		hash_table_clear(msgctx->header_index, TRUE);
+
 	if ( version->edit_mail == NULL ) {
 		version->edit_mail = edit_mail_wrap
 			(( version->mail == NULL ? msgctx->msgdata->mail : version->mail ));
@@ -468,23 +588,65 @@ struct sieve_header_list *sieve_message_header_list_create
 	return &hdrlist->hdrlist;
 }
 
-// NOTE: get rid of this once we have a proper Sieve string type
-static inline string_t *_header_right_trim(const char *raw)
+/* Header index */
+
+static const char *const *
+_header_values_right_trim(pool_t pool, const char *const *raw)
 {
-	string_t *result;
-	const char *p, *pend;
+	const char **values;
+	unsigned int count, i;
 
-	pend = raw + strlen(raw);
-	if (raw == pend) {
-		result = t_str_new(1);
-	} else {
-		for ( p = pend-1; p >= raw; p-- ) {
-			if ( *p != ' ' && *p != '\t' ) break;
-		}
-		result = t_str_new(p - raw + 1);
-		str_append_n(result, raw, p - raw + 1);
+	count = ( raw == NULL ? 0 : str_array_length(raw) );
+	values = p_new(pool, const char *, count + 1);
+	for ( i = 0; i < count; i++ ) {
+		const char *pend = raw[i] + strlen(raw[i]);
+
+		while ( pend > raw[i] && (pend[-1] == ' ' || pend[-1] == '\t') )
+			pend--;
+		values[i] = p_strdup_until(pool, raw[i], pend);
 	}
-	return result;
+	return values;
+}
+
+static int sieve_message_get_header_values
+(struct sieve_message_context *msgctx, const char *field_name,
+	bool mime_decode, const char *const **values_r)
+{
+	pool_t pool = msgctx->context_pool;
+	struct sieve_message_header_field *field;
+	const char *const **values;
+
+	if ( !hash_table_is_created(msgctx->header_index) ) {
+		hash_table_create(&msgctx->header_index, pool, 0,
+			strcase_hash, strcasecmp);
+	}
+
+	field = hash_table_lookup(msgctx->header_index, field_name);
+	if ( field == NULL ) {
+		field = p_new(pool, struct sieve_message_header_field, 1);
+		hash_table_insert(msgctx->header_index,
+			p_strdup(pool, field_name), field);
+	}
+
+	values = ( mime_decode ? &field->utf8_values : &field->raw_values );
+	if ( *values == NULL ) {
+		struct mail *mail = sieve_message_get_mail(msgctx);
+		const char *const *headers = NULL;
+		int ret;
+
+		if ( mime_decode )
+			ret = mail_get_headers_utf8(mail, field_name, &headers);
+		else
+			ret = mail_get_headers(mail, field_name, &headers);
+		if ( ret < 0 )
+			return -1;
+
+		*values = _header_values_right_trim
+			(pool, ( ret == 0 ? NULL : headers ));
+	}
+
+	*values_r = *values;
+	return ( (*values)[0] == NULL ? 0 : 1 );
 }
 
 /* String list implementation */
@@ -496,7 +658,7 @@ static int sieve_message_header_list_next_item
 	struct sieve_message_header_list *hdrlist =
 		(struct sieve_message_header_list *) _hdrlist;
 	const struct sieve_runtime_env *renv = _hdrlist->strlist.runenv;
-	struct mail *mail = sieve_message_get_mail(renv->msgctx);
+	const char *value;
 
 	if ( name_r != NULL )
 		*name_r = NULL;
@@ -529,22 +691,18 @@ static int sieve_message_header_list_next_item
 		}
 
 		/* Fetch all matching headers from the e-mail */
-		if ( hdrlist->mime_decode ) {
-			ret = mail_get_headers_utf8(mail,
-				str_c(hdr_item), &hdrlist->headers);
-		} else {
-			ret = mail_get_headers(mail,
-				str_c(hdr_item), &hdrlist->headers);
-		}
-
+		ret = sieve_message_get_header_values(renv->msgctx,
+			str_c(hdr_item), hdrlist->mime_decode, &hdrlist->headers);
 		if (ret < 0) {
+			struct mail *mail = sieve_message_get_mail(renv->msgctx);
+
 			_hdrlist->strlist.exec_status =
 				sieve_runtime_mail_error(renv, mail,
 					"failed to read header field `%s'", str_c(hdr_item));
 			return -1;
 		}
 
-		if ( ret == 0 || hdrlist->headers[0] == NULL ) {
+		if ( ret == 0 ) {
 			/* Try next item when no headers found */
 			hdrlist->headers = NULL;
 		}
@@ -553,7 +711,8 @@ static int sieve_message_header_list_next_item
 	/* Return next item */
 	if ( name_r != NULL )
 		*name_r = hdrlist->header_name;
-	*value_r = _header_right_trim(hdrlist->headers[hdrlist->headers_index++]);
+	value = hdrlist->headers[hdrlist->headers_index++];
+	*value_r = t_str_new_const(value, strlen(value));
 	return 1;
 }
 
@@ -907,12 +1066,14 @@ static bool sieve_message_body_get_return_parts
 	bool extract_text)
 {
 	struct sieve_message_context *msgctx = renv->msgctx;
+	struct sieve_message_cache *cache =
+		sieve_message_context_get_cache(msgctx);
 	struct sieve_message_part *const *body_parts;
 	unsigned int i, count;
 	struct sieve_message_part_data *return_part;
 
 	/* Check whether any body parts are cached already */
-	body_parts = array_get(&msgctx->cached_body_parts, &count);
+	body_parts = array_get(&cache->body_parts, &count);
 	if ( count == 0 )
 		return FALSE;
 
@@ -964,7 +1125,7 @@ static void sieve_message_part_save
 	bool extract_text)
 {
 	struct sieve_message_context *msgctx = renv->msgctx;
-	pool_t pool = msgctx->context_pool;
+	pool_t pool = msgctx->cache->pool;
 	buffer_t *result_buf, *text_buf = NULL;
 	char *part_data;
 	size_t part_size;
@@ -1016,6 +1177,123 @@ static void sieve_message_part_save
 	buffer_set_used_size(buf, 0);
 }
 
+/* Streamed body parts */
+
+struct sieve_message_part_stream {
+	struct sieve_message_body_sink *sink;
+	const char *const *content_types;
+	bool extract_text;
+
+	struct sieve_message_part *part;
+	struct mail_html2text *html2text;
+	buffer_t *text_buf;
+
+	bool stopped:1;
+};
+
+static void sieve_message_part_stream_end
+(struct sieve_message_part_stream *pstream)
+{
+	struct sieve_message_body_sink *sink = pstream->sink;
+
+	if ( pstream->part == NULL )
+		return;
+
+	if ( pstream->html2text != NULL )
+		mail_html2text_deinit(&pstream->html2text);
+	if ( !pstream->stopped && sink->part_end(sink) > 0 )
+		pstream->stopped = TRUE;
+	pstream->part = NULL;
+}
+
+static void sieve_message_part_stream_more
+(struct sieve_message_part_stream *pstream,
+	struct sieve_message_part *body_part,
+	const unsigned char *data, size_t size)
+{
+	struct sieve_message_body_sink *sink = pstream->sink;
+
+	if ( pstream->stopped )
+		return;
+
+	/* Start new part */
+	if ( pstream->part != body_part ) {
+		sieve_message_part_stream_end(pstream);
+		if ( pstream->stopped )
+			return;
+
+		pstream->part = body_part;
+		if ( pstream->extract_text && body_part->children == NULL &&
+			!body_part->epilogue && mail_html2text_content_type_match
+				(body_part->content_type) ) {
+			/* Remove HTML markup while streaming */
+			pstream->html2text = mail_html2text_init(0);
+			if ( pstream->text_buf == NULL ) {
+				pstream->text_buf =
+					buffer_create_dynamic(default_pool, 4096);
+			}
+		}
+		sink->part_begin(sink);
+	}
+
+	if ( pstream->html2text != NULL ) {
+		mail_html2text_more(pstream->html2text, data, size,
+			pstream->text_buf);
+		data = pstream->text_buf->data;
+		size = pstream->text_buf->used;
+	}
+
+	if ( size > 0 && sink->part_more(sink, data, size) > 0 )
+		pstream->stopped = TRUE;
+
+	if ( pstream->html2text != NULL )
+		buffer_set_used_size(pstream->text_buf, 0);
+}
+
+static void sieve_message_part_finish
+(const struct sieve_runtime_env *renv,
+	struct sieve_message_part_stream *pstream, buffer_t *buf,
+	struct sieve_message_part *body_part, bool extract_text)
+{
+	if ( pstream->sink == NULL ) {
+		sieve_message_part_save(renv, buf, body_part, extract_text);
+		return;
+	}
+
+	/* Parts without a body never match and unwanted message/rfc822 headers
+	   are skipped, just like sieve_message_body_get_return_parts() does */
+	if ( body_part->have_body && _is_wanted_content_type
+		(pstream->content_types, body_part->content_type) ) {
+		/* Buffer only holds message/rfc822 headers when streaming */
+		sieve_message_part_stream_more
+			(pstream, body_part, buf->data, buf->used);
+		sieve_message_part_stream_end(pstream);
+	}
+
+	buffer_set_used_size(buf, 0);
+}
+
+static void sieve_message_body_sink_return_parts
+(struct sieve_message_context *msgctx,
+	struct sieve_message_body_sink *sink)
+{
+	const struct sieve_message_part_data *parts;
+	unsigned int count, i;
+
+	parts = array_get(&msgctx->return_body_parts, &count);
+	for ( i = 0; i < count; i++ ) {
+		if ( parts[i].content == NULL )
+			break;
+
+		sink->part_begin(sink);
+		if ( parts[i].size > 0 && sink->part_more(sink,
+			(const unsigned char *)parts[i].content, parts[i].size) > 0 )
+			break;
+		if ( sink->part_end(sink) > 0 )
+			break;
+	}
+}
+
 static const char *
 _parse_content_type(const struct message_header_line *hdr)
 {
@@ -1065,22 +1343,30 @@ _parse_content_disposition(const struct message_header_line *hdr)
 }
 
 /* sieve_message_parts_add_missing():
- *   Add requested message body parts to the cache that are missing.
+ *   Add requested message body parts to the cache that are missing. When a
+ *   sink is provided, the requested parts are streamed to it instead and the
+ *   cache is left untouched.
  */
 static int sieve_message_parts_add_missing
 (const struct sieve_runtime_env *renv,
 	const char *const *content_types,
-	bool extract_text, bool iter_all)
-	ATTR_NULL(2)
+	bool extract_text, bool iter_all,
+	struct sieve_message_body_sink *sink)
+	ATTR_NULL(2, 5)
 {
 	struct sieve_message_context *msgctx = renv->msgctx;
-	pool_t pool = msgctx->context_pool;
+	struct sieve_message_cache *cache =
+		sieve_message_context_get_cache(msgctx);
+	pool_t pool = ( sink == NULL ?
+		cache->pool : pool_datastack_create() );
 	struct mail *mail = sieve_message_get_mail(renv->msgctx);
 	enum message_parser_flags mparser_flags =
 		MESSAGE_PARSER_FLAG_INCLUDE_MULTIPART_BLOCKS;
 	enum message_header_parser_flags hparser_flags =
 		MESSAGE_HEADER_PARSER_FLAG_SKIP_INITIAL_LWSP;
 	ARRAY(struct sieve_message_header) headers;
+	ARRAY(struct sieve_message_part *) stream_parts, *parts;
+	struct sieve_message_part_stream pstream;
 	struct sieve_message_part *body_part, *header_part, *last_part;
 	struct message_parser_ctx *parser;
 	struct message_decoder_context *decoder;
@@ -1097,14 +1383,31 @@ static int sieve_message_parts_add_missing
 	if ( !iter_all && sieve_message_body_get_return_parts
 		(renv, content_types, extract_text) ) {
 		/* Cache hit; all are present */
+		if ( sink != NULL )
+			sieve_message_body_sink_return_parts(msgctx, sink);
 		return SIEVE_EXEC_OK;
 	}
 
+	/* Streamed parts are not retained */
+	i_zero(&pstream);
+	if ( sink != NULL ) {
+		i_assert( !iter_all );
+		t_array_init(&stream_parts, 8);
+		parts = &stream_parts;
+
+		pstream.sink = sink;
+		pstream.content_types = content_types;
+		pstream.extract_text = extract_text;
+	} else {
+		parts = &cache->body_parts;
+	}
+
 	/* Get the message stream */
 	if ( mail_get_stream(mail, NULL, NULL, &input) < 0 ) {
 		return sieve_runtime_mail_error(renv, mail,
 			"failed to open input message");
 	}
+	cache->reads++;
 	if (mail_get_parts(mail, &mparts) < 0) {
 		return sieve_runtime_mail_error(renv, mail,
 			"failed to parse input message parts");
@@ -1136,6 +1439,10 @@ static int sieve_message_parts_add_missing
 		struct sieve_message_header *header;
 		unsigned char *data;
 
+		/* Sink needs no further content */
+		if ( pstream.stopped )
+			break;
+
 		if ( block.part != prev_mpart ) {
 			bool message_rfc822 = FALSE;
 
@@ -1147,8 +1454,8 @@ static int sieve_message_parts_add_missing
 					message_rfc822 = TRUE;
 				} else {
 					if ( save_body ) {
-						sieve_message_part_save
-							(renv, buf, body_part, extract_text);
+						sieve_message_part_finish
+							(renv, &pstream, buf, body_part, extract_text);
 					}
 				}
 				if ( iter_all && !array_is_created(&body_part->headers) &&
@@ -1160,8 +1467,7 @@ static int sieve_message_parts_add_missing
 			}
 
 			/* Start processing next part */
-			body_part_idx = array_idx_get_space
-				(&msgctx->cached_body_parts, idx);
+			body_part_idx = array_idx_get_space(parts, idx);
 			if ( *body_part_idx == NULL )
 				*body_part_idx = p_new(pool, struct sieve_message_part, 1);
 			body_part = *body_part_idx;
@@ -1216,8 +1522,7 @@ static int sieve_message_parts_add_missing
 			 */
 			if ( message_rfc822 ) {
 				i_assert(idx > 0);
-				body_part_idx = array_idx_modifiable
-					(&msgctx->cached_body_parts, idx-1);
+				body_part_idx = array_idx_modifiable(parts, idx-1);
 				header_part = *body_part_idx;
 			} else {
 				header_part = NULL;
@@ -1244,8 +1549,8 @@ static int sieve_message_parts_add_missing
 			if ( hdr == NULL ) {
 				/* Save headers for message/rfc822 part */
 				if ( header_part != NULL ) {
-					sieve_message_part_save
-						(renv, buf, header_part, FALSE);
+					sieve_message_part_finish
+						(renv, &pstream, buf, header_part, FALSE);
 					header_part = NULL;
 				}
 
@@ -1372,17 +1677,22 @@ static int sieve_message_parts_add_missing
 		if ( save_body ) {
 			(void)message_decoder_decode_next_block
 					(decoder, &block, &decoded);
-			buffer_append(buf, decoded.data, decoded.size);
+			if ( sink != NULL ) {
+				sieve_message_part_stream_more
+					(&pstream, body_part, decoded.data, decoded.size);
+			} else {
+				buffer_append(buf, decoded.data, decoded.size);
+			}
 		}
 	}
 
 	/* Save last body part if necessary */
 	if ( header_part != NULL ) {
-		sieve_message_part_save
-			(renv, buf, header_part, FALSE);
+		sieve_message_part_finish
+			(renv, &pstream, buf, header_part, FALSE);
 	} else if ( body_part != NULL && save_body ) {
-		sieve_message_part_save
-			(renv, buf, body_part, extract_text);
+		sieve_message_part_finish
+			(renv, &pstream, buf, body_part, extract_text);
 	}
 	if ( iter_all && !array_is_created(&body_part->headers) &&
 		array_count(&headers) > 0 ) {
@@ -1392,8 +1702,9 @@ static int sieve_message_parts_add_missing
 	}
 
 	/* Try to fill the return_body_parts array once more */
-	have_all = iter_all || sieve_message_body_get_return_parts
-		(renv, content_types, extract_text);
+	have_all = iter_all || sink != NULL ||
+		sieve_message_body_get_return_parts
+			(renv, content_types, extract_text);
 
 	/* This time, failure is a bug */
 	i_assert(have_all);
@@ -1402,6 +1713,11 @@ static int sieve_message_parts_add_missing
 	(void)message_parser_deinit(&parser, &mparts);
 	message_decoder_deinit(&decoder);
 	buffer_free(&buf);
+	if ( sink != NULL ) {
+		sieve_message_part_stream_end(&pstream);
+		if ( pstream.text_buf != NULL )
+			buffer_free(&pstream.text_buf);
+	}
 
 	/* Return status */
 	if ( input->stream_errno != 0 ) {
@@ -1426,7 +1742,7 @@ int sieve_message_body_get_content
 	T_BEGIN {
 		/* Fill the return_body_parts array */
 		status = sieve_message_parts_add_missing
-			(renv, content_types, FALSE, FALSE);
+			(renv, content_types, FALSE, FALSE, NULL);
 	} T_END;
 
 	/* Check status */
@@ -1460,7 +1776,7 @@ int sieve_message_body_get_text
 	T_BEGIN {
 		/* Fill the return_body_parts array */
 		status = sieve_message_parts_add_missing
-			(renv, _text_content_types, TRUE, FALSE);
+			(renv, _text_content_types, TRUE, FALSE, NULL);
 	} T_END;
 
 	/* Check status */
@@ -1479,10 +1795,12 @@ int sieve_message_body_get_raw
 	struct sieve_message_part_data **parts_r)
 {
 	struct sieve_message_context *msgctx = renv->msgctx;
+	struct sieve_message_cache *cache =
+		sieve_message_context_get_cache(msgctx);
 	struct sieve_message_part_data *return_part;
 	buffer_t *buf;
 
-	if ( msgctx->raw_body == NULL ) {
+	if ( cache->raw_body == NULL ) {
 		struct mail *mail = sieve_message_get_mail(renv->msgctx);
 		struct istream *input;
 		struct message_size hdr_size, body_size;
@@ -1490,14 +1808,14 @@ int sieve_message_body_get_raw
 		size_t size;
 		int ret;
 
-		msgctx->raw_body = buf = buffer_create_dynamic
-			(msgctx->context_pool, 1024*64);
+		buf = buffer_create_dynamic(cache->pool, 1024*64);
 
 		/* Get stream for message */
  		if ( mail_get_stream(mail, &hdr_size, &body_size, &input) < 0 ) {
 			return sieve_runtime_mail_error(renv, mail,
 				"failed to open input message");
 		}
+		cache->reads++;
 
 		/* Skip stream to beginning of body */
 		i_stream_skip(input, hdr_size.physical_size);
@@ -1521,8 +1839,10 @@ int sieve_message_body_get_raw
 		/* Add terminating NUL to the body part buffer */
 		buffer_append_c(buf, '\0');
 
+		/* Only a completely read body is cached */
+		cache->raw_body = buf;
 	} else {
-		buf = msgctx->raw_body;
+		buf = cache->raw_body;
 	}
 
 	/* Clear result array */
@@ -1547,6 +1867,103 @@ int sieve_message_body_get_raw
 	return SIEVE_EXEC_OK;
 }
 
+int sieve_message_body_stream_content
+(const struct sieve_runtime_env *renv,
+	const char * const *content_types,
+	struct sieve_message_body_sink *sink)
+{
+	int status;
+
+	T_BEGIN {
+		status = sieve_message_parts_add_missing
+			(renv, content_types, FALSE, FALSE, sink);
+	} T_END;
+
+	return status;
+}
+
+int sieve_message_body_stream_text
+(const struct sieve_runtime_env *renv,
+	struct sieve_message_body_sink *sink)
+{
+	static const char * const _text_content_types[] =
+		{ "application/xhtml+xml", "text", NULL };
+	int status;
+
+	/* See sieve_message_body_get_text() */
+
+	T_BEGIN {
+		status = sieve_message_parts_add_missing
+			(renv, _text_content_types, TRUE, FALSE, sink);
+	} T_END;
+
+	return status;
+}
+
+int sieve_message_body_stream_raw
+(const struct sieve_runtime_env *renv,
+	struct sieve_message_body_sink *sink)
+{
+	struct sieve_message_cache *cache =
+		sieve_message_context_get_cache(renv->msgctx);
+	struct mail *mail;
+	struct istream *input;
+	struct message_size hdr_size, body_size;
+	const unsigned char *data;
+	size_t size;
+	bool started = FALSE, stopped = FALSE;
+	int ret;
+
+	/* Use the raw body if it was read before */
+	if ( cache->raw_body != NULL ) {
+		if ( cache->raw_body->used > 1 ) {
+			sink->part_begin(sink);
+			if ( sink->part_more(sink, cache->raw_body->data,
+				cache->raw_body->used - 1) == 0 )
+				(void)sink->part_end(sink);
+		}
+		return SIEVE_EXEC_OK;
+	}
+
+	/* Get stream for message */
+	mail = sieve_message_get_mail(renv->msgctx);
+	if ( mail_get_stream(mail, &hdr_size, &body_size, &input) < 0 ) {
+		return sieve_runtime_mail_error(renv, mail,
+			"failed to open input message");
+	}
+	cache->reads++;
+
+	/* Skip stream to beginning of body */
+	i_stream_skip(input, hdr_size.physical_size);
+
+	/* Stream raw message body */
+	while ( !stopped &&
+		(ret=i_stream_read_more(input, &data, &size)) > 0 ) {
+		/* An empty body is not passed to the sink */
+		if ( !started ) {
+			sink->part_begin(sink);
+			started = TRUE;
+		}
+		if ( sink->part_more(sink, data, size) > 0 )
+			stopped = TRUE;
+
+		i_stream_skip(input, size);
+	}
+
+	if ( !stopped && ret < 0 && input->stream_errno != 0 ) {
+		sieve_runtime_critical(renv, NULL,
+			"failed to read input message",
+			"read(%s) failed: %s",
+			i_stream_get_name(input),
+			i_stream_get_error(input));
+		return SIEVE_EXEC_TEMP_FAILURE;
+	}
+
+	if ( started && !stopped )
+		(void)sink->part_end(sink);
+	return SIEVE_EXEC_OK;
+}
+
 /*
  * Message part iterator
  */
@@ -1563,7 +1980,7 @@ int sieve_message_part_iter_init
 	T_BEGIN {
 		/* Fill the return_body_parts array */
 		status = sieve_message_parts_add_missing
-			(renv, NULL, TRUE, TRUE);
+			(renv, NULL, TRUE, TRUE, NULL);
 	} T_END;
 
 	/* Check status */
@@ -1572,10 +1989,11 @@ int sieve_message_part_iter_init
 
 	i_zero(iter);
 	iter->renv = renv;
+	iter->cache = msgctx->cache;
 	iter->index = 0;
 	iter->offset = 0;
 
-	parts = array_get(&msgctx->cached_body_parts, &count);
+	parts = array_get(&iter->cache->body_parts, &count);
 	if (count == 0)
 		iter->root = NULL;
 	else
@@ -1587,14 +2005,12 @@ int sieve_message_part_iter_init
 void sieve_message_part_iter_subtree(struct sieve_message_part_iter *iter,
 	struct sieve_message_part_iter *subtree)
 {
-	const struct sieve_runtime_env *renv = iter->renv;
-	struct sieve_message_context *msgctx = renv->msgctx;
 	struct sieve_message_part *const *parts;
 	unsigned int count;
 
 	*subtree = *iter;
 
-	parts = array_get(&msgctx->cached_body_parts, &count);
+	parts = array_get(&iter->cache->body_parts, &count);
 	if ( subtree->index >= count)
 		subtree->root = NULL;
 	else
@@ -1605,14 +2021,12 @@ void sieve_message_part_iter_subtree(struct sieve_message_part_iter *iter,
 void sieve_message_part_iter_children(struct sieve_message_part_iter *iter,
 	struct sieve_message_part_iter *child)
 {
-	const struct sieve_runtime_env *renv = iter->renv;
-	struct sieve_message_context *msgctx = renv->msgctx;
 	struct sieve_message_part *const *parts;
 	unsigned int count;
 
 	*child = *iter;
 
-	parts = array_get(&msgctx->cached_body_parts, &count);	
+	parts = array_get(&iter->cache->body_parts, &count);
 	if ( (child->index+1) >= count || parts[child->index]->children == NULL)
 		child->root = NULL;
 	else
@@ -1623,15 +2037,13 @@ void sieve_message_part_iter_children(struct sieve_message_part_iter *iter,
 struct sieve_message_part *sieve_message_part_iter_current
 (struct sieve_message_part_iter *iter)
 {
-	const struct sieve_runtime_env *renv = iter->renv;
-	struct sieve_message_context *msgctx = renv->msgctx;
 	struct sieve_message_part *const *parts;
 	unsigned int count;
 
 	if ( iter->root == NULL )
 		return NULL;
 
-	parts = array_get(&msgctx->cached_body_parts, &count);
+	parts = array_get(&iter->cache->body_parts, &count);
 	if ( iter->index >= count )
 		return NULL;
 	do {
@@ -1648,10 +2060,7 @@ struct sieve_message_part *sieve_message_part_iter_current
 struct sieve_message_part *sieve_message_part_iter_next
 (struct sieve_message_part_iter *iter)
 {
-	const struct sieve_runtime_env *renv = iter->renv;
-	struct sieve_message_context *msgctx = renv->msgctx;
-
-	if ( iter->index >= array_count(&msgctx->cached_body_parts) )
+	if ( iter->index >= array_count(&iter->cache->body_parts) )
 		return NULL;
 	iter->index++;
 
@@ -14,6 +14,24 @@
 
 const char *sieve_message_get_new_id(const struct sieve_instance *svinst);
 
+/*
+ * Parsed message cache
+ */
+
+/* Holds the MIME structure and the decoded body parts parsed from one mail.
+   It can be shared between the message contexts of all recipients of that
+   mail; a context stops using it once it edits or substitutes the message. */
+
+struct sieve_message_cache;
+
+struct sieve_message_cache *sieve_message_cache_create(struct mail *mail);
+void sieve_message_cache_ref(struct sieve_message_cache *cache);
+void sieve_message_cache_unref(struct sieve_message_cache **_cache);
+
+/* Returns how many times the mail was read to fill the cache or to stream
+   (part of) it to a test; mainly useful for testing and debugging. */
+unsigned int sieve_message_cache_get_reads(struct sieve_message_cache *cache);
+
 /*
  * Message context
  */
@@ -28,6 +46,9 @@ void sieve_message_context_unref(struct sieve_message_context **msgctx);
 
 void sieve_message_context_reset(struct sieve_message_context *msgctx);
 
+void sieve_message_context_set_cache(struct sieve_message_context *msgctx,
+	struct sieve_message_cache *cache);
+
 pool_t sieve_message_context_pool
 	(struct sieve_message_context *msgctx) ATTR_PURE;
 void sieve_message_context_time(struct sieve_message_context *msgctx,
@@ -244,12 +265,36 @@ int sieve_message_body_get_raw
 	(const struct sieve_runtime_env *renv,
 		struct sieve_message_part_data **parts_r);
 
+/* Streamed body: rather than being stored in the message context, the
+   requested body parts are passed to the sink chunk by chunk while they are
+   decoded. The part_more() and part_end() callbacks return 1 when no further
+   content is needed, which ends the extraction early. */
+
+struct sieve_message_body_sink {
+	void (*part_begin)(struct sieve_message_body_sink *sink);
+	int (*part_more)(struct sieve_message_body_sink *sink,
+		const unsigned char *data, size_t size);
+	int (*part_end)(struct sieve_message_body_sink *sink);
+};
+
+int sieve_message_body_stream_content
+	(const struct sieve_runtime_env *renv,
+		const char * const *content_types,
+		struct sieve_message_body_sink *sink);
+int sieve_message_body_stream_text
+	(const struct sieve_runtime_env *renv,
+		struct sieve_message_body_sink *sink);
+int sieve_message_body_stream_raw
+	(const struct sieve_runtime_env *renv,
+		struct sieve_message_body_sink *sink);
+
 /*
  * Message part iterator
  */
 
 struct sieve_message_part_iter {
 	const struct sieve_runtime_env *renv;
+	struct sieve_message_cache *cache;
 	struct sieve_message_part *root;
 	unsigned int index, offset;
 };
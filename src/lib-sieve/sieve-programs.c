@@ -0,0 +1,149 @@
+/* Copyright (c) 2002-2018 Pigeonhole authors, see the included COPYING file
+ */
+
+#include "lib.h"
+#include "hash.h"
+
+#include "sieve-common.h"
+#include "sieve-storage-private.h"
+
+#include "sieve-programs.h"
+
+/*
+ * Program locations
+ */
+
+#define SIEVE_PROGRAM_LOCATION_CACHE_SIZE (64*1024)
+
+enum {
+	SIEVE_PROGRAM_LOCATION_PATH = 0,
+	SIEVE_PROGRAM_LOCATION_TYPE,
+	SIEVE_PROGRAM_LOCATION_COUNT
+};
+
+static struct sieve_program_stats sieve_program_totals;
+static HASH_TABLE(char *, struct sieve_program_stats *) sieve_program_stats_table;
+
+static struct sieve_storage_cache *sieve_program_location_cache(void)
+{
+	return sieve_storage_cache_get("program location");
+}
+
+bool sieve_program_location_lookup
+(const char *key, const char **path_r, bool *is_socket_r)
+{
+	const char *values[SIEVE_PROGRAM_LOCATION_COUNT];
+
+	if ( !sieve_storage_cache_lookup(sieve_program_location_cache(),
+		key, SIEVE_PROGRAM_LOCATION_COUNT, values) ||
+		values[SIEVE_PROGRAM_LOCATION_PATH] == NULL )
+		return FALSE;
+
+	*path_r = values[SIEVE_PROGRAM_LOCATION_PATH];
+	*is_socket_r = ( values[SIEVE_PROGRAM_LOCATION_TYPE] != NULL );
+	return TRUE;
+}
+
+void sieve_program_location_update
+(const char *key, const char *path, bool is_socket, unsigned int ttl)
+{
+	const char *values[SIEVE_PROGRAM_LOCATION_COUNT];
+
+	values[SIEVE_PROGRAM_LOCATION_PATH] = path;
+	values[SIEVE_PROGRAM_LOCATION_TYPE] = ( is_socket ? "socket" : NULL );
+
+	sieve_storage_cache_update(sieve_program_location_cache(),
+		key, SIEVE_PROGRAM_LOCATION_COUNT, values,
+		ttl, SIEVE_PROGRAM_LOCATION_CACHE_SIZE);
+}
+
+void sieve_program_location_invalidate(const char *key)
+{
+	sieve_storage_cache_remove(sieve_program_location_cache(), key);
+}
+
+/*
+ * Run statistics
+ */
+
+static struct sieve_program_stats *sieve_program_stats_get_entry
+(const char *name)
+{
+	struct sieve_program_stats *stats;
+
+	if ( !hash_table_is_created(sieve_program_stats_table) ) {
+		hash_table_create(&sieve_program_stats_table,
+			default_pool, 0, str_hash, strcmp);
+	}
+
+	stats = hash_table_lookup(sieve_program_stats_table, name);
+	if ( stats == NULL ) {
+		stats = i_new(struct sieve_program_stats, 1);
+		hash_table_insert(sieve_program_stats_table, i_strdup(name), stats);
+	}
+	return stats;
+}
+
+static void sieve_program_stats_add
+(struct sieve_program_stats *stats, unsigned int msecs, bool success)
+{
+	if ( success )
+		stats->runs++;
+	else
+		stats->failures++;
+	stats->total_msecs += msecs;
+	if ( msecs > stats->max_msecs )
+		stats->max_msecs = msecs;
+}
+
+void sieve_program_stats_add_run
+(const char *name, unsigned int msecs, bool success)
+{
+	sieve_program_stats_add
+		(sieve_program_stats_get_entry(name), msecs, success);
+	sieve_program_stats_add(&sieve_program_totals, msecs, success);
+}
+
+void sieve_program_stats_add_location_hit(const char *name)
+{
+	sieve_program_stats_get_entry(name)->location_hits++;
+	sieve_program_totals.location_hits++;
+}
+
+void sieve_program_stats_get
+(const char *name, struct sieve_program_stats *stats_r)
+{
+	struct sieve_program_stats *stats = NULL;
+
+	if ( name == NULL ) {
+		*stats_r = sieve_program_totals;
+		return;
+	}
+
+	if ( hash_table_is_created(sieve_program_stats_table) )
+		stats = hash_table_lookup(sieve_program_stats_table, name);
+	if ( stats == NULL )
+		i_zero(stats_r);
+	else
+		*stats_r = *stats;
+}
+
+void sieve_programs_deinit(void)
+{
+	struct hash_iterate_context *iter;
+	struct sieve_program_stats *stats;
+	char *name;
+
+	i_zero(&sieve_program_totals);
+
+	if ( !hash_table_is_created(sieve_program_stats_table) )
+		return;
+
+	iter = hash_table_iterate_init(sieve_program_stats_table);
+	while ( hash_table_iterate(iter, sieve_program_stats_table, &name, &stats) ) {
+		i_free(name);
+		i_free(stats);
+	}
+	hash_table_iterate_deinit(&iter);
+	hash_table_destroy(&sieve_program_stats_table);
+}
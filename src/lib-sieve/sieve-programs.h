@@ -0,0 +1,50 @@
+/* Copyright (c) 2002-2018 Pigeonhole authors, see the included COPYING file
+ */
+
+#ifndef __SIEVE_PROGRAMS_H
+#define __SIEVE_PROGRAMS_H
+
+#include "sieve-common.h"
+
+/*
+ * External programs
+ */
+
+/* Process-wide state of the external programs that extensions (such as
+ * vnd.dovecot.pipe) run. Extensions built as plugins are unloaded together
+ * with each Sieve instance, so this is kept here to survive until the next
+ * delivery. It is freed by sieve_caches_deinit().
+ */
+
+/* Program locations: the key identifies a program within the directories
+   it is looked up in; the location is either a unix socket or an
+   executable. Entries expire after the TTL (in seconds); a TTL of 0 disables
+   caching. */
+bool sieve_program_location_lookup
+	(const char *key, const char **path_r, bool *is_socket_r);
+void sieve_program_location_update
+	(const char *key, const char *path, bool is_socket, unsigned int ttl);
+void sieve_program_location_invalidate(const char *key);
+
+/* Run statistics, kept for each program name */
+struct sieve_program_stats {
+	/* Runs that completed and that failed to run or returned an error */
+	unsigned int runs, failures;
+	/* Runs for which the location was found in the cache */
+	unsigned int location_hits;
+
+	uint64_t total_msecs;
+	unsigned int max_msecs;
+};
+
+void sieve_program_stats_add_run
+	(const char *name, unsigned int msecs, bool success);
+void sieve_program_stats_add_location_hit(const char *name);
+/* Returns the statistics of one program or, when name is NULL, the totals of
+   all programs */
+void sieve_program_stats_get
+	(const char *name, struct sieve_program_stats *stats_r);
+
+void sieve_programs_deinit(void);
+
+#endif /* __SIEVE_PROGRAMS_H */
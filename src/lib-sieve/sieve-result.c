@@ -28,6 +28,14 @@
  * Types
  */
 
+struct sieve_result_action_index {
+	/* All actions of one type, in result order */
+	ARRAY(struct sieve_result_action *) actions;
+
+	/* First action for each duplicate key (if the type provides keys) */
+	HASH_TABLE(const char *, struct sieve_result_action *) keys;
+};
+
 struct sieve_result_action {
 	struct sieve_action action;
 
@@ -83,9 +91,18 @@ struct sieve_result {
 
 	struct sieve_result_action *last_attempted_action;
 
+	/* Scripts referred to by action locations */
+	ARRAY(struct sieve_script *) scripts;
+
 	HASH_TABLE(const struct sieve_action_def *,
 			   struct sieve_result_action_context *) action_contexts;
 
+	/* Index of actions by type, used for duplicate detection */
+	HASH_TABLE(const struct sieve_action_def *,
+			   struct sieve_result_action_index *) action_index;
+	unsigned int conflict_action_count;
+
+	bool action_index_stale:1;
 	bool executed:1;
 	bool executed_delivery:1;
 };
@@ -125,6 +142,8 @@ struct sieve_result *sieve_result_create
 	return result;
 }
 
+static void sieve_result_action_index_deinit(struct sieve_result *result);
+
 void sieve_result_ref(struct sieve_result *result)
 {
 	result->refcount++;
@@ -139,9 +158,18 @@ void sieve_result_unref(struct sieve_result **result)
 
 	sieve_message_context_unref(&(*result)->action_env.msgctx);
 
+	if ( array_is_created(&(*result)->scripts) ) {
+		struct sieve_script **script;
+
+		array_foreach_modifiable(&(*result)->scripts, script)
+			sieve_script_unref(script);
+	}
+
 	if ( hash_table_is_created((*result)->action_contexts) )
         hash_table_destroy(&(*result)->action_contexts);
 
+	sieve_result_action_index_deinit(*result);
+
 	if ( (*result)->action_env.ehandler != NULL )
 		sieve_error_handler_unref(&(*result)->action_env.ehandler);
 
@@ -467,8 +495,174 @@ static void sieve_result_action_detach
 
 	if ( result->action_count > 0 )
 		result->action_count--;
+
+	result->action_index_stale = TRUE;
+}
+
+static void sieve_result_ref_script
+(struct sieve_result *result, struct sieve_script *script)
+{
+	struct sieve_script *const *scripts;
+	unsigned int count, i;
+
+	if ( script == NULL )
+		return;
+
+	if ( !array_is_created(&result->scripts) )
+		p_array_init(&result->scripts, result->pool, 4);
+
+	scripts = array_get(&result->scripts, &count);
+	for ( i = 0; i < count; i++ ) {
+		if ( scripts[i] == script )
+			return;
+	}
+
+	sieve_script_ref(script);
+	array_append(&result->scripts, &script, 1);
+}
+
+/*
+ * Action index
+ */
+
+static void sieve_result_action_index_deinit(struct sieve_result *result)
+{
+	struct hash_iterate_context *hctx;
+	const struct sieve_action_def *act_def;
+	struct sieve_result_action_index *aindex;
+
+	if ( !hash_table_is_created(result->action_index) )
+		return;
+
+	hctx = hash_table_iterate_init(result->action_index);
+	while ( hash_table_iterate(hctx, result->action_index, &act_def, &aindex) ) {
+		if ( hash_table_is_created(aindex->keys) )
+			hash_table_destroy(&aindex->keys);
+	}
+	hash_table_iterate_deinit(&hctx);
+
+	hash_table_destroy(&result->action_index);
+	result->conflict_action_count = 0;
+}
+
+static void sieve_result_action_index_add
+(struct sieve_result *result, struct sieve_result_action *raction)
+{
+	const struct sieve_action_def *act_def = raction->action.def;
+	struct sieve_result_action_index *aindex;
+
+	if ( act_def == NULL )
+		return;
+
+	if ( act_def->check_conflict != NULL )
+		result->conflict_action_count++;
+
+	aindex = hash_table_lookup(result->action_index, act_def);
+	if ( aindex == NULL ) {
+		aindex = p_new(result->pool, struct sieve_result_action_index, 1);
+		p_array_init(&aindex->actions, result->pool, 4);
+		if ( act_def->get_duplicate_key != NULL ) {
+			hash_table_create(&aindex->keys, result->pool, 0,
+				str_hash, strcmp);
+		}
+		hash_table_insert(result->action_index, act_def, aindex);
+	}
+
+	array_append(&aindex->actions, &raction, 1);
+
+	if ( hash_table_is_created(aindex->keys) ) {
+		const char *key = act_def->get_duplicate_key
+			(result->action_env.scriptenv, &raction->action);
+
+		/* Only the first action with a particular key is relevant */
+		if ( hash_table_lookup(aindex->keys, key) == NULL ) {
+			hash_table_insert(aindex->keys,
+				p_strdup(result->pool, key), raction);
+		}
+	}
 }
 
+static void sieve_result_action_index_update(struct sieve_result *result)
+{
+	struct sieve_result_action *raction;
+
+	if ( hash_table_is_created(result->action_index) &&
+		!result->action_index_stale )
+		return;
+
+	sieve_result_action_index_deinit(result);
+	hash_table_create_direct(&result->action_index, result->pool, 0);
+
+	raction = result->first_action;
+	while ( raction != NULL ) {
+		sieve_result_action_index_add(result, raction);
+		raction = raction->next;
+	}
+	result->action_index_stale = FALSE;
+}
+
+static bool sieve_result_action_index_usable
+(struct sieve_result *result, const struct sieve_action_def *act_def,
+	bool keep)
+{
+	/* Keep actions and conflict checks involve all other actions; for
+	   those the full result is scanned */
+	if ( keep || act_def == NULL || act_def->check_conflict != NULL )
+		return FALSE;
+
+	sieve_result_action_index_update(result);
+	return ( result->conflict_action_count == 0 );
+}
+
+static int sieve_result_action_index_find_duplicate
+(const struct sieve_runtime_env *renv, const struct sieve_action *action,
+	struct sieve_result_action **dup_r, unsigned int *instance_count_r)
+{
+	struct sieve_result *result = renv->result;
+	const struct sieve_action_def *act_def = action->def;
+	struct sieve_result_action_index *aindex;
+	struct sieve_result_action *const *ractions;
+	unsigned int count, i;
+	int ret;
+
+	*dup_r = NULL;
+	*instance_count_r = 0;
+
+	aindex = hash_table_lookup(result->action_index, act_def);
+	if ( aindex == NULL )
+		return 0;
+
+	ractions = array_get(&aindex->actions, &count);
+	*instance_count_r = count;
+
+	if ( act_def->check_duplicate == NULL )
+		return 0;
+
+	if ( hash_table_is_created(aindex->keys) ) {
+		const char *key = act_def->get_duplicate_key
+			(renv->scriptenv, action);
+
+		*dup_r = hash_table_lookup(aindex->keys, key);
+		return 0;
+	}
+
+	for ( i = 0; i < count; i++ ) {
+		if ( (ret=act_def->check_duplicate
+			(renv, action, &ractions[i]->action)) < 0 )
+			return ret;
+
+		if ( ret == 1 ) {
+			*dup_r = ractions[i];
+			break;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Adding actions
+ */
+
 static int _sieve_result_add_action
 (const struct sieve_runtime_env *renv, const struct sieve_extension *ext,
 	const struct sieve_action_def *act_def,
@@ -484,12 +678,25 @@ static int _sieve_result_add_action
 
 	action.def = act_def;
 	action.ext = ext;
-	action.location = sieve_runtime_get_full_command_location(renv);
+	action.script = renv->script;
+	action.source_line = sieve_runtime_get_command_location(renv);
 	action.context = context;
 	action.executed = FALSE;
 
 	/* First, check for duplicates or conflicts */
-	raction = result->first_action;
+	if ( sieve_result_action_index_usable(result, act_def, keep) ) {
+		if ( (ret=sieve_result_action_index_find_duplicate
+			(renv, &action, &raction, &instance_count)) < 0 )
+			return ret;
+
+		/* Duplicate: merge side-effects, but don't add new action */
+		if ( raction != NULL ) {
+			return sieve_result_side_effects_merge
+				(renv, &action, raction, seffects);
+		}
+	} else {
+		raction = result->first_action;
+	}
 	while ( raction != NULL ) {
 		const struct sieve_action *oact = &raction->action;
 
@@ -538,8 +745,9 @@ static int _sieve_result_add_action
 
 						if ( kaction == NULL ) {
 							raction->action.context = NULL;
-							raction->action.location =
-								p_strdup(result->pool, action.location);
+							raction->action.source_line = action.source_line;
+							sieve_result_ref_script(result, action.script);
+							raction->action.script = action.script;
 
 							/* Note that existing execution status is retained, making sure
 							 * that keep is not executed multiple times.
@@ -580,11 +788,12 @@ static int _sieve_result_add_action
 	if ( kaction != NULL ) {
 		/* Use existing keep action to define new one */
 		raction = kaction;
+		result->action_index_stale = TRUE;
 	} else {
 		/* Check policy limit on total number of actions */
 		if ( svinst->max_actions > 0 && result->action_count >= svinst->max_actions )
 		{
-			sieve_runtime_error(renv, action.location,
+			sieve_runtime_error(renv, NULL,
 				"total number of actions exceeds policy limit (%u > %u)",
 				result->action_count+1, svinst->max_actions);
 			return -1;
@@ -592,7 +801,7 @@ static int _sieve_result_add_action
 
 		/* Check policy limit on number of this class of actions */
 		if ( instance_limit > 0 && instance_count >= instance_limit ) {
-			sieve_runtime_error(renv, action.location,
+			sieve_runtime_error(renv, NULL,
 				"number of %s actions exceeds policy limit (%u > %u)",
 				act_def->name, instance_count+1, instance_limit);
 			return -1;
@@ -609,7 +818,9 @@ static int _sieve_result_add_action
 	raction->action.context = context;
 	raction->action.def = act_def;
 	raction->action.ext = ext;
-	raction->action.location = p_strdup(result->pool, action.location);
+	sieve_result_ref_script(result, action.script);
+	raction->action.script = action.script;
+	raction->action.source_line = action.source_line;
 	raction->keep = keep;
 
 	if ( raction->prev == NULL && raction != result->first_action ) {
@@ -627,6 +838,10 @@ static int _sieve_result_add_action
 		}
 		result->action_count++;
 
+		if ( hash_table_is_created(result->action_index) &&
+			!result->action_index_stale )
+			sieve_result_action_index_add(result, raction);
+
 		/* Apply any implicit side effects */
 		if ( hash_table_is_created(result->action_contexts) ) {
 			struct sieve_result_action_context *actctx;
@@ -969,7 +1184,8 @@ static int _sieve_result_implicit_keep
 			rac = rac->next;
 		}
 	} else if ( !rollback ) {
-		act_keep.location = kac->action.location;
+		act_keep.script = kac->action.script;
+		act_keep.source_line = kac->action.source_line;
 		act_keep.mail = kac->action.mail;
 		if ( kac->seffects != NULL )
 			rsef_first = kac->seffects->first_effect;
@@ -1519,6 +1735,8 @@ void sieve_result_iterate_delete
 	else
 		rac->next->prev = rac->prev;
 
+	result->action_index_stale = TRUE;
+
 	/* Skip to next action in iteration */
 
 	rictx->current_action = NULL;
@@ -361,12 +361,12 @@ unsigned int sieve_script_hash(const struct sieve_script *script)
  * Binary
  */
 
-int sieve_script_binary_read_metadata
+static int sieve_script_binary_read_class_metadata
 (struct sieve_script *script, struct sieve_binary_block *sblock,
 	sieve_size_t *offset)
 {
 	struct sieve_binary *sbin = sieve_binary_block_get_binary(sblock);
-	string_t *storage_class, *location;
+	string_t *storage_class;
 	unsigned int version;
 
 	if ( sieve_binary_block_get_size(sblock) - *offset == 0 )
@@ -407,6 +407,21 @@ int sieve_script_binary_read_metadata
 		 	version, script->storage->version);
 		return 0;
 	}
+	return 1;
+}
+
+int sieve_script_binary_read_metadata
+(struct sieve_script *script, struct sieve_binary_block *sblock,
+	sieve_size_t *offset)
+{
+	struct sieve_binary *sbin = sieve_binary_block_get_binary(sblock);
+	string_t *location;
+	int ret;
+
+	/* storage class, version */
+	if ( (ret=sieve_script_binary_read_class_metadata
+		(script, sblock, offset)) <= 0 )
+		return ret;
 
 	/* location */
 	if ( !sieve_binary_read_string(sblock, offset, &location) ) {
@@ -431,6 +446,30 @@ int sieve_script_binary_read_metadata
 	return script->v.binary_read_metadata(script, sblock, offset);
 }
 
+int sieve_script_binary_read_shared_metadata
+(struct sieve_script *script, struct sieve_binary_block *sblock,
+	sieve_size_t *offset)
+{
+	struct sieve_binary *sbin = sieve_binary_block_get_binary(sblock);
+	string_t *location;
+	int ret;
+
+	/* storage class, version */
+	if ( (ret=sieve_script_binary_read_class_metadata
+		(script, sblock, offset)) <= 0 )
+		return ret;
+
+	/* location; refers to the script the binary was compiled from */
+	if ( !sieve_binary_read_string(sblock, offset, &location) ) {
+		sieve_script_sys_error(script,
+			"Binary `%s' has invalid metadata for script `%s': "
+			"Invalid location",
+			sieve_binary_path(sbin), script->location);
+		return -1;
+	}
+	return 1;
+}
+
 void sieve_script_binary_write_metadata
 (struct sieve_script *script, struct sieve_binary_block *sblock)
 {
@@ -69,6 +69,11 @@ int sieve_script_check
 int sieve_script_binary_read_metadata
 	(struct sieve_script *script, struct sieve_binary_block *sblock,
 		sieve_size_t *offset);
+/* Only verifies the storage class and version, not whether the binary was
+   compiled from this particular script */
+int sieve_script_binary_read_shared_metadata
+	(struct sieve_script *script, struct sieve_binary_block *sblock,
+		sieve_size_t *offset);
 void sieve_script_binary_write_metadata
 	(struct sieve_script *script, struct sieve_binary_block *sblock);
 bool sieve_script_binary_dump_metadata
@@ -2,6 +2,7 @@
  */
 
 #include "lib.h"
+#include "ipwd.h"
 
 #include "sieve-common.h"
 #include "sieve-limits.h"
@@ -226,6 +227,38 @@ void sieve_settings_load
 		svinst->max_redirects = (unsigned int) uint_setting;
 	}
 
+	svinst->binary_cache_size = SIEVE_DEFAULT_BINARY_CACHE_SIZE;
+	if ( sieve_setting_get_uint_value
+		(svinst, "sieve_binary_cache_size", &uint_setting) ) {
+		svinst->binary_cache_size = (unsigned int) uint_setting;
+	}
+
+	svinst->binary_shared_dir = NULL;
+	str_setting = sieve_setting_get(svinst, "sieve_binary_shared_dir");
+	if ( str_setting != NULL && *str_setting != '\0' ) {
+		svinst->binary_shared_dir = p_strdup(svinst->pool, str_setting);
+	}
+
+	/* Besides root, only this user may own the shared binaries */
+	svinst->binary_shared_uid = (uid_t)-1;
+	str_setting = sieve_setting_get(svinst, "sieve_binary_shared_owner");
+	if ( str_setting != NULL && *str_setting != '\0' ) {
+		struct passwd pw;
+		int ret;
+
+		if ( (ret=i_getpwnam(str_setting, &pw)) > 0 ) {
+			svinst->binary_shared_uid = pw.pw_uid;
+		} else if ( ret == 0 ) {
+			sieve_sys_warning(svinst,
+				"unknown user for setting 'sieve_binary_shared_owner': '%s'",
+				str_setting);
+		} else {
+			sieve_sys_warning(svinst,
+				"getpwnam(%s) failed for setting "
+				"'sieve_binary_shared_owner': %m", str_setting);
+		}
+	}
+
 	(void)sieve_address_source_parse_from_setting(svinst,
 		svinst->pool, "sieve_redirect_envelope_from",
 		&svinst->redirect_from);
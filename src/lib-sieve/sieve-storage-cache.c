@@ -0,0 +1,167 @@
+/* Copyright (c) 2002-2018 Pigeonhole authors, see the included COPYING file
+ */
+
+#include "lib.h"
+#include "hash.h"
+#include "llist.h"
+#include "ioloop.h"
+
+#include "sieve-common.h"
+
+#include "sieve-storage-private.h"
+
+/*
+ * Lookup caches
+ */
+
+/* Storage drivers cache the results of lookups in their backend for the
+ * lifetime of the process. The caches are kept here rather than in the
+ * drivers, because storage drivers built as plugins are unloaded together with
+ * each Sieve instance, while these results need to survive until the next
+ * delivery. Each entry holds a fixed number of strings (any of which may be
+ * NULL), expires after a TTL and is dropped when the cache grows beyond its
+ * maximum size, least recently used first.
+ */
+
+struct sieve_storage_cache_entry {
+	struct sieve_storage_cache_entry *prev, *next;
+
+	char *key;
+	char **values;
+	unsigned int count;
+
+	time_t expires;
+	size_t size;
+};
+
+struct sieve_storage_cache {
+	struct sieve_storage_cache *next;
+	char *name;
+
+	HASH_TABLE(char *, struct sieve_storage_cache_entry *) entries;
+
+	/* Most recently used first */
+	struct sieve_storage_cache_entry *head, *tail;
+	size_t size;
+};
+
+static struct sieve_storage_cache *sieve_storage_caches = NULL;
+
+static void
+sieve_storage_cache_entry_free(struct sieve_storage_cache *cache,
+	struct sieve_storage_cache_entry *entry)
+{
+	unsigned int i;
+
+	hash_table_remove(cache->entries, entry->key);
+	DLLIST2_REMOVE(&cache->head, &cache->tail, entry);
+	cache->size -= entry->size;
+
+	for ( i = 0; i < entry->count; i++ )
+		i_free(entry->values[i]);
+	i_free(entry->values);
+	i_free(entry->key);
+	i_free(entry);
+}
+
+struct sieve_storage_cache *sieve_storage_cache_get(const char *name)
+{
+	struct sieve_storage_cache *cache;
+
+	for ( cache = sieve_storage_caches; cache != NULL; cache = cache->next ) {
+		if ( strcmp(cache->name, name) == 0 )
+			return cache;
+	}
+
+	cache = i_new(struct sieve_storage_cache, 1);
+	cache->name = i_strdup(name);
+	hash_table_create(&cache->entries, default_pool, 0, str_hash, strcmp);
+
+	cache->next = sieve_storage_caches;
+	sieve_storage_caches = cache;
+	return cache;
+}
+
+void sieve_storage_caches_deinit(void)
+{
+	struct sieve_storage_cache *cache;
+
+	while ( sieve_storage_caches != NULL ) {
+		cache = sieve_storage_caches;
+		sieve_storage_caches = cache->next;
+
+		while ( cache->head != NULL )
+			sieve_storage_cache_entry_free(cache, cache->head);
+		hash_table_destroy(&cache->entries);
+		i_free(cache->name);
+		i_free(cache);
+	}
+}
+
+bool sieve_storage_cache_lookup
+(struct sieve_storage_cache *cache, const char *key,
+	unsigned int count, const char **values_r)
+{
+	struct sieve_storage_cache_entry *entry;
+	unsigned int i;
+
+	entry = hash_table_lookup(cache->entries, key);
+	if ( entry == NULL )
+		return FALSE;
+	if ( entry->expires <= ioloop_time || entry->count != count ) {
+		sieve_storage_cache_entry_free(cache, entry);
+		return FALSE;
+	}
+
+	DLLIST2_REMOVE(&cache->head, &cache->tail, entry);
+	DLLIST2_PREPEND(&cache->head, &cache->tail, entry);
+
+	for ( i = 0; i < count; i++ )
+		values_r[i] = t_strdup(entry->values[i]);
+	return TRUE;
+}
+
+void sieve_storage_cache_update
+(struct sieve_storage_cache *cache, const char *key,
+	unsigned int count, const char *const *values,
+	unsigned int ttl, size_t max_size)
+{
+	struct sieve_storage_cache_entry *entry;
+	unsigned int i;
+
+	if ( ttl == 0 )
+		return;
+
+	entry = hash_table_lookup(cache->entries, key);
+	if ( entry != NULL )
+		sieve_storage_cache_entry_free(cache, entry);
+
+	entry = i_new(struct sieve_storage_cache_entry, 1);
+	entry->key = i_strdup(key);
+	entry->values = i_new(char *, count);
+	entry->count = count;
+	entry->expires = ioloop_time + ttl;
+	entry->size = sizeof(*entry) + strlen(key) + 1 + count * sizeof(char *);
+	for ( i = 0; i < count; i++ ) {
+		entry->values[i] = i_strdup(values[i]);
+		if ( values[i] != NULL )
+			entry->size += strlen(values[i]) + 1;
+	}
+
+	hash_table_insert(cache->entries, entry->key, entry);
+	DLLIST2_PREPEND(&cache->head, &cache->tail, entry);
+	cache->size += entry->size;
+
+	while ( cache->size > max_size && cache->tail != NULL )
+		sieve_storage_cache_entry_free(cache, cache->tail);
+}
+
+void sieve_storage_cache_remove
+(struct sieve_storage_cache *cache, const char *key)
+{
+	struct sieve_storage_cache_entry *entry;
+
+	entry = hash_table_lookup(cache->entries, key);
+	if ( entry != NULL )
+		sieve_storage_cache_entry_free(cache, entry);
+}
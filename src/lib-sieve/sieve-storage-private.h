@@ -224,6 +224,28 @@ extern const struct sieve_storage sieve_dict_storage;
 
 extern const struct sieve_storage sieve_ldap_storage;
 
+/*
+ * Lookup caches
+ */
+
+struct sieve_storage_cache;
+
+/* Returns the process-wide cache with the given name, creating it when it does
+   not exist yet */
+struct sieve_storage_cache *sieve_storage_cache_get(const char *name);
+void sieve_storage_caches_deinit(void);
+
+/* Each entry holds count strings, which may be NULL */
+bool sieve_storage_cache_lookup
+	(struct sieve_storage_cache *cache, const char *key,
+		unsigned int count, const char **values_r);
+void sieve_storage_cache_update
+	(struct sieve_storage_cache *cache, const char *key,
+		unsigned int count, const char *const *values,
+		unsigned int ttl, size_t max_size);
+void sieve_storage_cache_remove
+	(struct sieve_storage_cache *cache, const char *key);
+
 /*
  * Error handling
  */
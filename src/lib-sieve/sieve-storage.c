@@ -15,6 +15,7 @@
 
 #include "sieve-script-private.h"
 #include "sieve-storage-private.h"
+#include "sieve-programs.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -50,6 +51,12 @@ void sieve_storages_deinit(struct sieve_instance *svinst ATTR_UNUSED)
 	/* nothing yet */
 }
 
+void sieve_caches_deinit(void)
+{
+	sieve_programs_deinit();
+	sieve_storage_caches_deinit();
+}
+
 void sieve_storage_class_register
 (struct sieve_instance *svinst, const struct sieve_storage *storage_class)
 {
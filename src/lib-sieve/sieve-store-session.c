@@ -0,0 +1,187 @@
+/* Copyright (c) 2002-2018 Pigeonhole authors, see the included COPYING file
+ */
+
+#include "lib.h"
+#include "array.h"
+#include "hash.h"
+#include "str-sanitize.h"
+#include "mail-storage.h"
+
+#include "sieve-common.h"
+#include "sieve-store-session.h"
+
+/*
+ * Store session
+ */
+
+struct sieve_store_mailbox {
+	/* Next mailbox with the same name (of another user) */
+	struct sieve_store_mailbox *next;
+
+	struct mail_user *user;
+	struct mailbox *box;
+	struct mailbox_transaction_context *trans;
+};
+
+struct sieve_store_session {
+	pool_t pool;
+
+	/* Mailbox name => mailboxes of all users with that name */
+	HASH_TABLE(const char *, struct sieve_store_mailbox *) names;
+	/* All mailboxes in the order they were added */
+	ARRAY(struct sieve_store_mailbox *) mailboxes;
+
+	unsigned int commits;
+};
+
+struct sieve_store_session *sieve_store_session_create(void)
+{
+	struct sieve_store_session *session;
+	pool_t pool;
+
+	pool = pool_alloconly_create("sieve_store_session", 1024);
+	session = p_new(pool, struct sieve_store_session, 1);
+	session->pool = pool;
+	hash_table_create(&session->names, pool, 0, str_hash, strcmp);
+	p_array_init(&session->mailboxes, pool, 8);
+
+	return session;
+}
+
+void sieve_store_session_free(struct sieve_store_session **_session)
+{
+	struct sieve_store_session *session = *_session;
+	struct sieve_store_mailbox *const *smboxes;
+	unsigned int i, count;
+
+	*_session = NULL;
+
+	smboxes = array_get(&session->mailboxes, &count);
+	for ( i = 0; i < count; i++ ) {
+		if ( smboxes[i]->trans != NULL )
+			mailbox_transaction_rollback(&smboxes[i]->trans);
+		mailbox_free(&smboxes[i]->box);
+	}
+
+	hash_table_destroy(&session->names);
+	pool_unref(&session->pool);
+}
+
+int sieve_store_session_commit
+(struct sieve_store_session *session, const char **error_r, bool *temp_r)
+{
+	struct sieve_store_mailbox *const *smboxes;
+	unsigned int i, count;
+	int ret = 0;
+
+	*error_r = NULL;
+	*temp_r = TRUE;
+
+	smboxes = array_get(&session->mailboxes, &count);
+	for ( i = 0; i < count; i++ ) {
+		struct sieve_store_mailbox *smbox = smboxes[i];
+		enum mail_error error_code;
+		const char *error;
+
+		if ( smbox->trans == NULL )
+			continue;
+
+		if ( mailbox_transaction_commit(&smbox->trans) == 0 ) {
+			session->commits++;
+			continue;
+		}
+
+		error = mailbox_get_last_error(smbox->box, &error_code);
+		if ( *error_r == NULL ) {
+			*error_r = t_strdup_printf(
+				"failed to store into mailbox '%s': %s",
+				str_sanitize(mailbox_get_vname(smbox->box), 128), error);
+		}
+		if ( error_code != MAIL_ERROR_TEMP )
+			*temp_r = FALSE;
+		ret = -1;
+	}
+	return ret;
+}
+
+struct mailbox *sieve_store_session_lookup_mailbox
+(struct sieve_store_session *session, struct mail_user *user,
+	const char *vname)
+{
+	struct sieve_store_mailbox *smbox;
+
+	smbox = hash_table_lookup(session->names, vname);
+	for ( ; smbox != NULL; smbox = smbox->next ) {
+		if ( smbox->user == user )
+			return smbox->box;
+	}
+	return NULL;
+}
+
+void sieve_store_session_add_mailbox
+(struct sieve_store_session *session, struct mail_user *user,
+	const char *vname, struct mailbox *box)
+{
+	struct sieve_store_mailbox *smbox, *first;
+	const char *name;
+
+	i_assert( sieve_store_session_lookup_mailbox
+		(session, user, vname) == NULL );
+
+	smbox = p_new(session->pool, struct sieve_store_mailbox, 1);
+	smbox->user = user;
+	smbox->box = box;
+
+	if ( hash_table_lookup_full(session->names, vname, &name, &first) ) {
+		smbox->next = first;
+	} else {
+		name = p_strdup(session->pool, vname);
+	}
+	hash_table_update(session->names, name, smbox);
+	array_append(&session->mailboxes, &smbox, 1);
+}
+
+static struct sieve_store_mailbox *sieve_store_session_find
+(struct sieve_store_session *session, struct mailbox *box)
+{
+	struct sieve_store_mailbox *const *smboxp;
+
+	array_foreach(&session->mailboxes, smboxp) {
+		if ( (*smboxp)->box == box )
+			return *smboxp;
+	}
+	return NULL;
+}
+
+bool sieve_store_session_has_mailbox
+(struct sieve_store_session *session, struct mailbox *box)
+{
+	return ( sieve_store_session_find(session, box) != NULL );
+}
+
+struct mailbox_transaction_context *sieve_store_session_get_transaction
+(struct sieve_store_session *session, struct mailbox *box)
+{
+	struct sieve_store_mailbox *smbox;
+
+	smbox = sieve_store_session_find(session, box);
+	i_assert( smbox != NULL );
+
+	if ( smbox->trans == NULL ) {
+		smbox->trans = mailbox_transaction_begin
+			(box, MAILBOX_TRANSACTION_FLAG_EXTERNAL, __func__);
+	}
+	return smbox->trans;
+}
+
+unsigned int
+sieve_store_session_get_mailbox_count(struct sieve_store_session *session)
+{
+	return array_count(&session->mailboxes);
+}
+
+unsigned int
+sieve_store_session_get_commit_count(struct sieve_store_session *session)
+{
+	return session->commits;
+}
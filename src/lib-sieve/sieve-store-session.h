@@ -0,0 +1,66 @@
+/* Copyright (c) 2002-2018 Pigeonhole authors, see the included COPYING file
+ */
+
+#ifndef __SIEVE_STORE_SESSION_H
+#define __SIEVE_STORE_SESSION_H
+
+#include "sieve-common.h"
+
+/*
+ * Store session
+ */
+
+/* Mailboxes used by the store actions of one delivery session, e.g. all
+ * recipients of one message in an LMTP transaction.
+ *
+ * A script environment that has a store_session assigned opens each mailbox
+ * only once per user and keeps it open until the session is freed. Its store
+ * actions save the message into one transaction per mailbox, which is only
+ * committed by sieve_store_session_commit(). So when many recipients file the
+ * same message into the same mailbox, it is opened, synced and committed only
+ * once.
+ *
+ * The store actions report the message as stored once it is saved into the
+ * session's transaction. When the final commit fails, the implicit keep of the
+ * affected recipients cannot be restored anymore; the caller needs to fail the
+ * delivery of the whole session instead. The mail users must outlive the
+ * session.
+ */
+
+struct mail_user;
+struct mailbox;
+struct mailbox_transaction_context;
+struct sieve_store_session;
+
+struct sieve_store_session *sieve_store_session_create(void);
+/* Rolls back anything that was not committed */
+void sieve_store_session_free(struct sieve_store_session **_session);
+
+/* Commits the transactions of all mailboxes. Returns 0 on success and -1 when
+   any commit failed; error_r then describes the first failure and temp_r is
+   TRUE when all failures were temporary. */
+int sieve_store_session_commit
+	(struct sieve_store_session *session, const char **error_r, bool *temp_r);
+
+/* Mailboxes added to the session are owned by it; they need not be opened
+   successfully */
+struct mailbox *sieve_store_session_lookup_mailbox
+	(struct sieve_store_session *session, struct mail_user *user,
+		const char *vname);
+void sieve_store_session_add_mailbox
+	(struct sieve_store_session *session, struct mail_user *user,
+		const char *vname, struct mailbox *box);
+bool sieve_store_session_has_mailbox
+	(struct sieve_store_session *session, struct mailbox *box);
+/* Returns the transaction of a mailbox in the session, beginning it when
+   needed */
+struct mailbox_transaction_context *sieve_store_session_get_transaction
+	(struct sieve_store_session *session, struct mailbox *box);
+
+/* Statistics, mainly for testing */
+unsigned int
+sieve_store_session_get_mailbox_count(struct sieve_store_session *session);
+unsigned int
+sieve_store_session_get_commit_count(struct sieve_store_session *session);
+
+#endif /* __SIEVE_STORE_SESSION_H */
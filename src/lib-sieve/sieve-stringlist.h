@@ -23,6 +23,15 @@ struct sieve_stringlist {
 	void (*set_trace)
 		(struct sieve_stringlist *strlist, bool trace);
 
+	/* Lists read directly from the binary can report the code address of
+	   their items, which uniquely identifies the list within the executing
+	   block. The list is literal when all its items are literals in the
+	   binary, meaning that it yields the same items at every execution. */
+	bool (*get_code_address)
+		(struct sieve_stringlist *strlist, sieve_size_t *address_r);
+	bool (*is_literal)
+		(struct sieve_stringlist *strlist);
+
 	const struct sieve_runtime_env *runenv;
 	int exec_status;
 
@@ -50,6 +59,24 @@ static inline void sieve_stringlist_reset
 	strlist->reset(strlist);
 }
 
+static inline bool sieve_stringlist_get_code_address
+(struct sieve_stringlist *strlist, sieve_size_t *address_r)
+{
+	if ( strlist->get_code_address == NULL )
+		return FALSE;
+
+	return strlist->get_code_address(strlist, address_r);
+}
+
+static inline bool sieve_stringlist_is_literal
+(struct sieve_stringlist *strlist)
+{
+	if ( strlist->is_literal == NULL )
+		return FALSE;
+
+	return strlist->is_literal(strlist);
+}
+
 int sieve_stringlist_get_length
 	(struct sieve_stringlist *strlist);
 
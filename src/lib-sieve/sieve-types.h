@@ -231,6 +231,14 @@ struct sieve_script_env {
 			time_t time);
 	void (*duplicate_flush)
 		(const struct sieve_script_env *senv);
+	/* Built-in duplicate database; used instead of the callbacks above
+	   when assigned (see sieve-duplicate.h) */
+	struct sieve_duplicate_db *duplicate_db;
+
+	/* Mailboxes and transactions shared with the other deliveries of a
+	   session; store actions commit through it when assigned (see
+	   sieve-store-session.h) */
+	struct sieve_store_session *store_session;
 
 	/* Interface for rejecting mail */
 	int (*reject_mail)(const struct sieve_script_env *senv,
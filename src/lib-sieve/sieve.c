@@ -20,10 +20,12 @@
 #include "sieve-address.h"
 #include "sieve-script.h"
 #include "sieve-storage-private.h"
+#include "sieve-duplicate-private.h"
 #include "sieve-ast.h"
 #include "sieve-binary.h"
 #include "sieve-actions.h"
 #include "sieve-result.h"
+#include "sieve-message.h"
 
 #include "sieve-parser.h"
 #include "sieve-validator.h"
@@ -113,6 +115,9 @@ struct sieve_instance *sieve_init
 	/* Initialize storage classes */
 	sieve_storages_init(svinst);
 
+	/* Initialize duplicate database drivers */
+	sieve_duplicate_dbs_init(svinst);
+
 	/* Initialize plugins */
 	sieve_plugins_load(svinst, NULL, NULL);
 
@@ -126,7 +131,9 @@ void sieve_deinit(struct sieve_instance **_svinst)
 {
 	struct sieve_instance *svinst = *_svinst;
 
+	sieve_binary_cache_free(svinst);
 	sieve_plugins_unload(svinst);
+	sieve_duplicate_dbs_deinit(svinst);
 	sieve_storages_deinit(svinst);
 	sieve_extensions_deinit(svinst);
 	sieve_errors_deinit(svinst);
@@ -372,34 +379,60 @@ struct sieve_binary *sieve_open_script
 	struct sieve_binary *sbin;
 
 	T_BEGIN {
-		/* Then try to open the matching binary */
-		sbin = sieve_script_binary_load(script, error_r);
+		/* First check whether the binary was loaded before */
+		sbin = sieve_binary_cache_lookup(script, flags);
+		if ( sbin != NULL ) {
+			if ( svinst->debug ) {
+				sieve_sys_debug(svinst,
+					"Script binary %s reused from cache",
+					sieve_binary_path(sbin));
+			}
+			if ( error_r != NULL )
+				*error_r = SIEVE_ERROR_NONE;
+		} else {
+			/* Then try to open the matching binary */
+			sbin = sieve_script_binary_load(script, error_r);
+
+			if (sbin != NULL) {
+				/* Ok, it exists; now let's see if it is up to date */
+				if ( !sieve_binary_up_to_date(sbin, flags) ) {
+					/* Not up to date */
+					if ( svinst->debug ) {
+						sieve_sys_debug(svinst, "Script binary %s is not up-to-date",
+							sieve_binary_path(sbin));
+					}
+
+					sieve_binary_unref(&sbin);
+					sbin = NULL;
+				}
+			}
 
-		if (sbin != NULL) {
-			/* Ok, it exists; now let's see if it is up to date */
-			if ( !sieve_binary_up_to_date(sbin, flags) ) {
-				/* Not up to date */
+			if ( sbin != NULL ) {
 				if ( svinst->debug ) {
-					sieve_sys_debug(svinst, "Script binary %s is not up-to-date",
+					sieve_sys_debug(svinst,
+						"Script binary %s successfully loaded",
 						sieve_binary_path(sbin));
 				}
-
-				sieve_binary_unref(&sbin);
-				sbin = NULL;
+				sieve_binary_cache_add(sbin, flags);
 			}
 		}
 
-		/* If the binary does not exist or is not up-to-date, we need
-		 * to (re-)compile.
-		 */
-		if ( sbin != NULL ) {
+		/* Then try a binary compiled earlier for an identical script */
+		if ( sbin == NULL &&
+			(sbin=sieve_binary_shared_lookup(script, flags)) != NULL ) {
 			if ( svinst->debug ) {
 				sieve_sys_debug(svinst,
-					"Script binary %s successfully loaded",
+					"Script binary %s loaded from shared directory",
 					sieve_binary_path(sbin));
 			}
+			if ( error_r != NULL )
+				*error_r = SIEVE_ERROR_NONE;
+		}
 
-		} else {
+		/* If the binary does not exist or is not up-to-date, we need
+		 * to (re-)compile.
+		 */
+		if ( sbin == NULL ) {
 			sbin = sieve_compile_script(script, ehandler, flags, error_r);
 
 			if ( sbin != NULL ) {
@@ -482,6 +515,13 @@ int sieve_save
 	return sieve_script_binary_save(script, sbin, update, error_r);
 }
 
+int sieve_save_shared
+(struct sieve_binary *sbin, enum sieve_compile_flags flags,
+	enum sieve_error *error_r)
+{
+	return sieve_binary_shared_save(sbin, flags, error_r);
+}
+
 void sieve_close(struct sieve_binary **sbin)
 {
 	sieve_binary_unref(sbin);
@@ -628,9 +668,9 @@ struct sieve_multiscript {
 	bool discard_handled:1;
 };
 
-struct sieve_multiscript *sieve_multiscript_start_execute
+static struct sieve_multiscript *sieve_multiscript_start
 (struct sieve_instance *svinst,	const struct sieve_message_data *msgdata,
-	const struct sieve_script_env *senv)
+	const struct sieve_script_env *senv, struct sieve_message_cache *msgcache)
 {
 	pool_t pool;
 	struct sieve_result *result;
@@ -639,6 +679,11 @@ struct sieve_multiscript *sieve_multiscript_start_execute
 	result = sieve_result_create(svinst, msgdata, senv);
 	pool = sieve_result_pool(result);
 
+	if ( msgcache != NULL ) {
+		sieve_message_context_set_cache
+			(sieve_result_get_message_context(result), msgcache);
+	}
+
 	sieve_result_set_keep_action(result, NULL, NULL);
 
 	mscript = p_new(pool, struct sieve_multiscript, 1);
@@ -653,6 +698,13 @@ struct sieve_multiscript *sieve_multiscript_start_execute
 	return mscript;
 }
 
+struct sieve_multiscript *sieve_multiscript_start_execute
+(struct sieve_instance *svinst,	const struct sieve_message_data *msgdata,
+	const struct sieve_script_env *senv)
+{
+	return sieve_multiscript_start(svinst, msgdata, senv, NULL);
+}
+
 struct sieve_multiscript *sieve_multiscript_start_test
 (struct sieve_instance *svinst, const struct sieve_message_data *msgdata,
 	const struct sieve_script_env *senv, struct ostream *stream)
@@ -665,6 +717,65 @@ struct sieve_multiscript *sieve_multiscript_start_test
 	return mscript;
 }
 
+/* Batch: one message delivered to several recipients */
+
+struct sieve_multiscript_batch {
+	struct mail *mail;
+	struct sieve_message_cache *msgcache;
+};
+
+struct sieve_multiscript_batch *
+sieve_multiscript_batch_create(struct mail *mail)
+{
+	struct sieve_multiscript_batch *batch;
+
+	batch = i_new(struct sieve_multiscript_batch, 1);
+	batch->mail = mail;
+	batch->msgcache = sieve_message_cache_create(mail);
+
+	return batch;
+}
+
+void sieve_multiscript_batch_free(struct sieve_multiscript_batch **_batch)
+{
+	struct sieve_multiscript_batch *batch = *_batch;
+
+	*_batch = NULL;
+
+	/* Message contexts that are still alive keep their own reference */
+	sieve_message_cache_unref(&batch->msgcache);
+	i_free(batch);
+}
+
+struct sieve_multiscript *sieve_multiscript_batch_start_execute
+(struct sieve_multiscript_batch *batch, struct sieve_instance *svinst,
+	const struct sieve_message_data *msgdata,
+	const struct sieve_script_env *senv)
+{
+	i_assert( msgdata->mail == batch->mail );
+
+	return sieve_multiscript_start(svinst, msgdata, senv, batch->msgcache);
+}
+
+struct sieve_multiscript *sieve_multiscript_batch_start_test
+(struct sieve_multiscript_batch *batch, struct sieve_instance *svinst,
+	const struct sieve_message_data *msgdata,
+	const struct sieve_script_env *senv, struct ostream *stream)
+{
+	struct sieve_multiscript *mscript =
+		sieve_multiscript_batch_start_execute(batch, svinst, msgdata, senv);
+
+	mscript->teststream = stream;
+
+	return mscript;
+}
+
+unsigned int
+sieve_multiscript_batch_get_message_reads(struct sieve_multiscript_batch *batch)
+{
+	return sieve_message_cache_get_reads(batch->msgcache);
+}
+
 static void sieve_multiscript_test
 (struct sieve_multiscript *mscript, bool *keep)
 {
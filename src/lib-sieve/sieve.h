@@ -28,6 +28,13 @@ struct sieve_instance *sieve_init
  */
 void sieve_deinit(struct sieve_instance **_svinst);
 
+/* sieve_caches_deinit():
+ *   Frees the caches that storage drivers and external programs keep for the
+ *   lifetime of the process.
+ *   Must be called once the process stops using the sieve engine.
+ */
+void sieve_caches_deinit(void);
+
 /* sieve_get_capabilities():
  *
  */
@@ -113,6 +120,17 @@ int sieve_save_as
 int sieve_save
 	(struct sieve_binary *sbin, bool update, enum sieve_error *error_r);
 
+/* sieve_save_shared:
+ *
+ *  Stores the binary in the directory configured with sieve_binary_shared_dir,
+ *  where it is found for any script with the same content compiled with the
+ *  same flags. Meant for administration tools; delivery only reads that
+ *  directory.
+ */
+int sieve_save_shared
+	(struct sieve_binary *sbin, enum sieve_compile_flags flags,
+		enum sieve_error *error_r);
+
 /* sieve_close:
  *
  *   Closes a compiled/opened sieve binary.
@@ -195,6 +213,29 @@ struct sieve_multiscript *sieve_multiscript_start_test
 	(struct sieve_instance *svinst, const struct sieve_message_data *msgdata,
 		const struct sieve_script_env *senv, struct ostream *stream);
 
+/* Batch execution: all recipients of one message share the parsed message
+   (MIME structure and decoded body parts), while the envelope and the result
+   remain separate for each recipient's multiscript. */
+
+struct sieve_multiscript_batch;
+
+struct sieve_multiscript_batch *
+sieve_multiscript_batch_create(struct mail *mail);
+void sieve_multiscript_batch_free(struct sieve_multiscript_batch **_batch);
+
+struct sieve_multiscript *sieve_multiscript_batch_start_execute
+	(struct sieve_multiscript_batch *batch, struct sieve_instance *svinst,
+		const struct sieve_message_data *msgdata,
+		const struct sieve_script_env *senv);
+struct sieve_multiscript *sieve_multiscript_batch_start_test
+	(struct sieve_multiscript_batch *batch, struct sieve_instance *svinst,
+		const struct sieve_message_data *msgdata,
+		const struct sieve_script_env *senv, struct ostream *stream);
+
+/* Number of times the shared message was read by the recipients' scripts */
+unsigned int
+sieve_multiscript_batch_get_message_reads(struct sieve_multiscript_batch *batch);
+
 bool sieve_multiscript_run
 	(struct sieve_multiscript *mscript, struct sieve_binary *sbin,
 		struct sieve_error_handler *exec_ehandler,
@@ -14,6 +14,51 @@
 
 #include "sieve-dict-storage.h"
 
+/*
+ * Data ID cache
+ */
+
+/* Name -> data ID lookups are cached per process, so that a process
+   delivering many messages does not query the dict for every one of them.
+   Scripts that are not found are cached as well (with a NULL data ID). Expired
+   entries are dropped when they are looked up and the least recently used ones
+   are evicted once the cache grows beyond cache_size kilobytes. */
+
+#define SIEVE_DICT_SCRIPT_CACHE_NAME "dict script data ID"
+
+static const char *
+sieve_dict_script_cache_key(struct sieve_dict_storage *dstorage,
+	const char *name)
+{
+	return t_strconcat(dstorage->uri, "\n", dstorage->username, "\n",
+		name, NULL);
+}
+
+static bool
+sieve_dict_script_cache_lookup(struct sieve_dict_storage *dstorage,
+	const char *name, const char **data_id_r)
+{
+	if ( dstorage->cache_ttl == 0 )
+		return FALSE;
+
+	return sieve_storage_cache_lookup(
+		sieve_storage_cache_get(SIEVE_DICT_SCRIPT_CACHE_NAME),
+		sieve_dict_script_cache_key(dstorage, name), 1, data_id_r);
+}
+
+static void
+sieve_dict_script_cache_update(struct sieve_dict_storage *dstorage,
+	const char *name, const char *data_id)
+{
+	if ( dstorage->cache_ttl == 0 )
+		return;
+
+	sieve_storage_cache_update(
+		sieve_storage_cache_get(SIEVE_DICT_SCRIPT_CACHE_NAME),
+		sieve_dict_script_cache_key(dstorage, name), 1, &data_id,
+		dstorage->cache_ttl, (size_t)dstorage->cache_size * 1024);
+}
+
 /*
  * Script dict implementation
  */
@@ -81,8 +126,18 @@ static int sieve_dict_script_open
 	path = t_strconcat
 		(DICT_SIEVE_NAME_PATH, dict_escape_string(name), NULL);
 
-	ret = dict_lookup
-		(dscript->dict, script->pool, path, &data_id, &error);
+	if ( sieve_dict_script_cache_lookup(dstorage, name, &data_id) ) {
+		sieve_script_sys_debug(script,
+			"Using cached data ID for script `%s'", name);
+		ret = ( data_id == NULL ? 0 : 1 );
+	} else {
+		ret = dict_lookup
+			(dscript->dict, script->pool, path, &data_id, &error);
+		if ( ret >= 0 ) {
+			sieve_dict_script_cache_update
+				(dstorage, name, ( ret > 0 ? data_id : NULL ));
+		}
+	}
 	if ( ret <= 0 ) {
 		if ( ret < 0 ) {
 			sieve_script_set_critical(script,
@@ -2,6 +2,7 @@
  */
 
 #include "lib.h"
+#include "strnum.h"
 #include "dict.h"
 
 #include "sieve-common.h"
@@ -22,6 +23,7 @@ static struct sieve_storage *sieve_dict_storage_alloc(void)
 	dstorage = p_new(pool, struct sieve_dict_storage, 1);
 	dstorage->storage = sieve_dict_storage;
 	dstorage->storage.pool = pool;
+	dstorage->cache_size = SIEVE_DICT_SCRIPT_CACHE_DEFAULT_SIZE;
 
 	return &dstorage->storage;
 }
@@ -41,6 +43,20 @@ static int sieve_dict_storage_init
 
 			if ( strncasecmp(option, "user=", 5) == 0 && option[5] != '\0' ) {
 				username = option+5;
+			} else if ( strncasecmp(option, "cache_size=", 11) == 0 ) {
+				if ( str_to_uint(option+11, &dstorage->cache_size) < 0 ) {
+					sieve_storage_set_critical(storage,
+						"Invalid cache_size value `%s'", option+11);
+					*error_r = SIEVE_ERROR_TEMP_FAILURE;
+					return -1;
+				}
+			} else if ( strncasecmp(option, "cache_ttl=", 10) == 0 ) {
+				if ( str_to_uint(option+10, &dstorage->cache_ttl) < 0 ) {
+					sieve_storage_set_critical(storage,
+						"Invalid cache_ttl value `%s'", option+10);
+					*error_r = SIEVE_ERROR_TEMP_FAILURE;
+					return -1;
+				}
 			} else {
 				sieve_storage_set_critical(storage,
 					"Invalid option `%s'", option);
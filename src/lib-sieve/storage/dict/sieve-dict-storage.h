@@ -14,6 +14,8 @@
 
 #define SIEVE_DICT_SCRIPT_DEFAULT "default"
 
+#define SIEVE_DICT_SCRIPT_CACHE_DEFAULT_SIZE 1024
+
 /*
  * Storage class
  */
@@ -24,6 +26,11 @@ struct sieve_dict_storage {
 	const char *username;
 	const char *uri;
 
+	/* Seconds that name -> data ID lookups are cached in this process */
+	unsigned int cache_ttl;
+	/* Maximum size of that cache in kilobytes */
+	unsigned int cache_size;
+
 	struct dict *dict;
 };
 
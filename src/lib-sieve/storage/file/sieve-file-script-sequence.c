@@ -4,6 +4,7 @@
 #include "lib.h"
 #include "str.h"
 #include "array.h"
+#include "ioloop.h"
 #include "eacces-error.h"
 
 #include "sieve-common.h"
@@ -28,6 +29,89 @@ struct sieve_file_script_sequence {
 	bool storage_is_file:1;
 };
 
+/*
+ * Directory cache
+ */
+
+/* The sorted list of scripts in a sequence directory is cached per process
+   for cache_ttl seconds and only reused while the directory's mtime and ctime
+   are unchanged. Listings of directories modified within the current second
+   are not cached, since a later change within that same second would go
+   unnoticed. Each entry holds the directory's stat stamp and the file names
+   separated by '/'. */
+
+#define SIEVE_FILE_SCRIPT_SEQUENCE_CACHE_NAME "file script sequence"
+
+static const char *
+sieve_file_script_sequence_cache_stamp(const struct stat *st)
+{
+	return t_strdup_printf("%ld.%lu.%ld", (long)st->st_mtime,
+		(unsigned long)ST_MTIME_NSEC(*st), (long)st->st_ctime);
+}
+
+static bool sieve_file_script_sequence_cache_lookup
+(struct sieve_file_script_sequence *fseq, const char *path,
+	const struct stat *st)
+{
+	struct sieve_file_storage *fstorage =
+		(struct sieve_file_storage *)fseq->seq.storage;
+	const char *values[2];
+	const char *const *files;
+
+	if ( fstorage->cache_ttl == 0 )
+		return FALSE;
+
+	if ( !sieve_storage_cache_lookup(
+		sieve_storage_cache_get(SIEVE_FILE_SCRIPT_SEQUENCE_CACHE_NAME),
+		path, 2, values) )
+		return FALSE;
+	if ( values[0] == NULL || values[1] == NULL ||
+		strcmp(values[0], sieve_file_script_sequence_cache_stamp(st)) != 0 )
+		return FALSE;
+
+	if ( *values[1] == '\0' )
+		return TRUE;
+	for ( files = t_strsplit(values[1], "/"); *files != NULL; files++ ) {
+		const char *file = p_strdup(fseq->pool, *files);
+
+		array_append(&fseq->script_files, &file, 1);
+	}
+	return TRUE;
+}
+
+static void sieve_file_script_sequence_cache_update
+(struct sieve_file_script_sequence *fseq, const char *path,
+	const struct stat *st)
+{
+	struct sieve_file_storage *fstorage =
+		(struct sieve_file_storage *)fseq->seq.storage;
+	const char *values[2];
+	string_t *files;
+	const char *const *file;
+
+	if ( fstorage->cache_ttl == 0 ||
+		st->st_mtime >= ioloop_time || st->st_ctime >= ioloop_time )
+		return;
+
+	files = t_str_new(256);
+	array_foreach(&fseq->script_files, file) {
+		if ( str_len(files) > 0 )
+			str_append_c(files, '/');
+		str_append(files, *file);
+	}
+
+	values[0] = sieve_file_script_sequence_cache_stamp(st);
+	values[1] = str_c(files);
+	sieve_storage_cache_update(
+		sieve_storage_cache_get(SIEVE_FILE_SCRIPT_SEQUENCE_CACHE_NAME),
+		path, 2, values, fstorage->cache_ttl,
+		(size_t)fstorage->cache_size * 1024);
+}
+
+/*
+ * Directory reading
+ */
+
 static int sieve_file_script_sequence_read_dir
 (struct sieve_file_script_sequence *fseq, const char *path)
 {
@@ -168,12 +252,19 @@ struct sieve_script_sequence *sieve_file_storage_get_script_sequence
 
 		/* Path is directory */
 		if (name == 0 || *name == '\0') {
-			/* Read all '.sieve' files in directory */
-			if (sieve_file_script_sequence_read_dir
+			/* Read all '.sieve' files in directory, unless it is unchanged
+			   since it was last read */
+			if ( sieve_file_script_sequence_cache_lookup
+				(fseq, fstorage->path, &st) ) {
+				/* Listing obtained from cache */
+			} else if (sieve_file_script_sequence_read_dir
 				(fseq, fstorage->path) < 0) {
 				*error_r = storage->error_code;
 				sieve_file_script_sequence_destroy(&fseq->seq);
 				return NULL;
+			} else {
+				sieve_file_script_sequence_cache_update
+					(fseq, fstorage->path, &st);
 			}
 
 		}	else {
@@ -3,6 +3,8 @@
 
 #include "lib.h"
 #include "mempool.h"
+#include "buffer.h"
+#include "hex-binary.h"
 #include "path-util.h"
 #include "istream.h"
 #include "time-util.h"
@@ -274,6 +276,49 @@ static int sieve_file_script_stat
 	return 0;
 }
 
+/* With the cache_ttl storage option, the stat() results for script files are
+   cached per process and trusted for that many seconds. This mainly avoids
+   checking every included global script at each delivery. Failures are not
+   cached. Each entry holds both stat structs in hex, keyed by path. */
+
+#define SIEVE_FILE_SCRIPT_STAT_CACHE_NAME "file script stat"
+
+static bool
+sieve_file_script_stat_decode(const char *hex, struct stat *st_r)
+{
+	buffer_t buf;
+
+	buffer_create_from_data(&buf, st_r, sizeof(*st_r));
+	return ( hex != NULL && strlen(hex) == sizeof(*st_r) * 2 &&
+		hex_to_binary(hex, &buf) == 0 );
+}
+
+static int sieve_file_script_stat_cached
+(struct sieve_file_storage *fstorage, const char *path,
+	struct stat *st, struct stat *lnk_st)
+{
+	struct sieve_storage_cache *cache;
+	const char *values[2];
+
+	if ( fstorage->cache_ttl == 0 )
+		return sieve_file_script_stat(path, st, lnk_st);
+
+	cache = sieve_storage_cache_get(SIEVE_FILE_SCRIPT_STAT_CACHE_NAME);
+	if ( sieve_storage_cache_lookup(cache, path, 2, values) &&
+		sieve_file_script_stat_decode(values[0], st) &&
+		sieve_file_script_stat_decode(values[1], lnk_st) )
+		return 0;
+
+	if ( sieve_file_script_stat(path, st, lnk_st) < 0 )
+		return -1;
+
+	values[0] = binary_to_hex((const unsigned char *)st, sizeof(*st));
+	values[1] = binary_to_hex((const unsigned char *)lnk_st, sizeof(*lnk_st));
+	sieve_storage_cache_update(cache, path, 2, values,
+		fstorage->cache_ttl, (size_t)fstorage->cache_size * 1024);
+	return 0;
+}
+
 static const char *
 path_split_filename(const char *path, const char **dirpath_r)
 {
@@ -343,7 +388,7 @@ static int sieve_file_script_open
 				dirpath = path;
 
 				path = sieve_file_storage_path_extend(fstorage, filename);
-				ret = sieve_file_script_stat(path, &st, &lnk_st);
+				ret = sieve_file_script_stat_cached(fstorage, path, &st, &lnk_st);
 			}
 
 		} else {
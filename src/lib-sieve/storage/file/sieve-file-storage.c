@@ -6,6 +6,7 @@
 #include "home-expand.h"
 #include "ioloop.h"
 #include "mkdir-parents.h"
+#include "strnum.h"
 #include "eacces-error.h"
 #include "unlink-old-files.h"
 #include "mail-storage-private.h"
@@ -224,6 +225,7 @@ static struct sieve_storage *sieve_file_storage_alloc(void)
 	fstorage = p_new(pool, struct sieve_file_storage, 1);
 	fstorage->storage = sieve_file_storage;
 	fstorage->storage.pool = pool;
+	fstorage->cache_size = SIEVE_FILE_STORAGE_CACHE_DEFAULT_SIZE;
 
 	return &fstorage->storage;
 }
@@ -504,6 +506,20 @@ static int sieve_file_storage_init
 
 			if ( strncasecmp(option, "active=", 7) == 0 && option[7] != '\0' ) {
 				active_path = option+7;
+			} else if ( strncasecmp(option, "cache_ttl=", 10) == 0 ) {
+				if ( str_to_uint(option+10, &fstorage->cache_ttl) < 0 ) {
+					sieve_storage_set_critical(storage,
+						"Invalid cache_ttl value `%s'", option+10);
+					*error_r = SIEVE_ERROR_TEMP_FAILURE;
+					return -1;
+				}
+			} else if ( strncasecmp(option, "cache_size=", 11) == 0 ) {
+				if ( str_to_uint(option+11, &fstorage->cache_size) < 0 ) {
+					sieve_storage_set_critical(storage,
+						"Invalid cache_size value `%s'", option+11);
+					*error_r = SIEVE_ERROR_TEMP_FAILURE;
+					return -1;
+				}
 			} else {
 				sieve_storage_set_critical(storage,
 					"Invalid option `%s'", option);
@@ -23,6 +23,8 @@
 /* Delete files having ctime older than this from tmp/. 36h is standard. */
 #define SIEVE_FILE_STORAGE_TMP_DELETE_SECS (36*60*60)
 
+#define SIEVE_FILE_STORAGE_CACHE_DEFAULT_SIZE 1024
+
 /*
  * Storage class
  */
@@ -43,6 +45,11 @@ struct sieve_file_storage {
 	gid_t file_create_gid;
 
 	time_t prev_mtime;
+
+	/* Seconds that stat() results for scripts are trusted */
+	unsigned int cache_ttl;
+	/* Maximum size of the caches in kilobytes */
+	unsigned int cache_size;
 };
 
 const char *sieve_file_storage_path_extend
@@ -1215,6 +1215,69 @@ db_ldap_get_var_expand_table(struct ldap_connection *conn,
 	return tab;
 }
 
+/*
+ * Script lookup cache
+ */
+
+/* Results of script entry searches are cached per process, so that a burst of
+   deliveries for the same user does not send a search to the directory for
+   each of them. Entries expire after sieve_ldap_cache_ttl seconds and the
+   least recently used ones are dropped once the cache grows beyond
+   sieve_ldap_cache_size kilobytes. The cache itself is kept by lib-sieve, so
+   that it survives unloading this driver when it is built as a plugin. */
+
+#define SIEVE_LDAP_LOOKUP_CACHE_NAME "ldap script lookup"
+
+static const char *
+sieve_ldap_lookup_cache_key(struct ldap_connection *conn,
+	const char *base, const char *filter)
+{
+	const struct sieve_ldap_storage_settings *set = &conn->lstorage->set;
+
+	return t_strdup_printf("%s\n%s\n%s\n%d\n%s",
+		(set->uris != NULL ? set->uris : set->hosts),
+		base, filter, set->ldap_scope, set->sieve_ldap_mod_attr);
+}
+
+static bool
+sieve_ldap_lookup_cache_find(struct ldap_connection *conn, const char *key,
+	const char **dn_r, const char **modattr_r)
+{
+	const char *values[2];
+
+	if (conn->lstorage->set.sieve_ldap_cache_ttl == 0)
+		return FALSE;
+
+	if (!sieve_storage_cache_lookup(
+		sieve_storage_cache_get(SIEVE_LDAP_LOOKUP_CACHE_NAME),
+		key, N_ELEMENTS(values), values))
+		return FALSE;
+
+	*dn_r = values[0];
+	*modattr_r = values[1];
+	return TRUE;
+}
+
+static void
+sieve_ldap_lookup_cache_add(struct ldap_connection *conn, const char *key,
+	const char *dn, const char *modattr)
+{
+	const struct sieve_ldap_storage_settings *set = &conn->lstorage->set;
+	const char *values[2] = { dn, modattr };
+
+	if (set->sieve_ldap_cache_ttl == 0)
+		return;
+
+	sieve_storage_cache_update(
+		sieve_storage_cache_get(SIEVE_LDAP_LOOKUP_CACHE_NAME),
+		key, N_ELEMENTS(values), values, set->sieve_ldap_cache_ttl,
+		(size_t)set->sieve_ldap_cache_size * 1024);
+}
+
+/*
+ * Script lookup
+ */
+
 struct sieve_ldap_script_lookup_request {
 	struct ldap_request request;
 
@@ -1232,6 +1295,8 @@ sieve_ldap_lookup_script_callback(struct ldap_connection *conn,
 		(struct sieve_ldap_script_lookup_request *)request;
 
 	if (res == NULL) {
+		/* Search failed; don't cache the outcome */
+		request->failed = TRUE;
 		io_loop_stop(conn->ioloop);
 		return;
 	}
@@ -1262,7 +1327,7 @@ int sieve_ldap_db_lookup_script(struct ldap_connection *conn,
 	struct sieve_ldap_script_lookup_request *request;
 	const struct var_expand_table *tab;
 	char **attr_names;
-	const char *error;
+	const char *cache_key, *error;
 	string_t *str;
 
 	pool_t pool = pool_alloconly_create
@@ -1296,6 +1361,16 @@ int sieve_ldap_db_lookup_script(struct ldap_connection *conn,
 	request->request.filter = p_strdup(pool, str_c(str));
 	request->request.attributes = attr_names;
 
+	cache_key = sieve_ldap_lookup_cache_key(conn,
+		request->request.base, request->request.filter);
+	if (sieve_ldap_lookup_cache_find(conn, cache_key, dn_r, modattr_r)) {
+		sieve_storage_sys_debug(storage, "db: "
+			"Using cached result for base=%s filter=%s",
+			request->request.base, request->request.filter);
+		pool_unref(&request->request.pool);
+		return (*dn_r == NULL ? 0 : 1);
+	}
+
 	sieve_storage_sys_debug(storage,
 			       "base=%s scope=%s filter=%s fields=%s",
 			       request->request.base, lstorage->set.scope,
@@ -1308,6 +1383,10 @@ int sieve_ldap_db_lookup_script(struct ldap_connection *conn,
 
 	*dn_r = t_strdup(request->result_dn);
 	*modattr_r = t_strdup(request->result_modattr);
+	if (!request->request.failed) {
+		sieve_ldap_lookup_cache_add(conn, cache_key,
+			request->result_dn, request->result_modattr);
+	}
 	pool_unref(&request->request.pool);
 	return (*dn_r == NULL ? 0 : 1);
 }
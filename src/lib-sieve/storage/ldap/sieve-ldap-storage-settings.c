@@ -48,6 +48,8 @@ static struct setting_def setting_defs[] = {
 	DEF_STR(sieve_ldap_script_attr),
 	DEF_STR(sieve_ldap_mod_attr),
 	DEF_STR(sieve_ldap_filter),
+	DEF_INT(sieve_ldap_cache_ttl),
+	DEF_INT(sieve_ldap_cache_size),
 
 	{ 0, NULL, 0 }
 };
@@ -77,6 +79,8 @@ static struct sieve_ldap_storage_settings default_settings = {
 	.sieve_ldap_script_attr = "mailSieveRuleSource",
 	.sieve_ldap_mod_attr = "modifyTimestamp",
 	.sieve_ldap_filter = "(&(objectClass=posixAccount)(uid=%u))",
+	.sieve_ldap_cache_ttl = 0,
+	.sieve_ldap_cache_size = 1024,
 };
 
 static const char *parse_setting(const char *key, const char *value,
@@ -51,6 +51,9 @@ struct sieve_ldap_storage_settings {
 	const char *sieve_ldap_mod_attr;
 	const char *sieve_ldap_filter;
 
+	unsigned int sieve_ldap_cache_ttl;
+	unsigned int sieve_ldap_cache_size;
+
 	/* ... */
 	int ldap_deref, ldap_scope, ldap_tls_require_cert;
 };
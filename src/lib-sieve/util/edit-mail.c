@@ -4,9 +4,11 @@
 #include "lib.h"
 #include "array.h"
 #include "str.h"
+#include "hash.h"
 #include "mempool.h"
 #include "llist.h"
 #include "istream-private.h"
+#include "istream-concat.h"
 #include "master-service.h"
 #include "master-service-settings.h"
 #include "message-parser.h"
@@ -185,8 +187,11 @@ struct edit_mail {
 
 	struct istream *wrapped_stream;
 	struct istream *stream;
+	/* Outdated splice streams that callers may still be reading */
+	ARRAY(struct istream *) old_streams;
 
 	struct _header_index *headers_head, *headers_tail;
+	HASH_TABLE(const char *, struct _header_index *) header_index;
 	struct _header_field_index *header_fields_head, *header_fields_tail;
 	struct message_size hdr_size, body_size;
 
@@ -201,6 +206,7 @@ struct edit_mail {
 	bool eoh_crlf:1;
 	bool headers_parsed:1;
 	bool destroying_stream:1;
+	bool splice_stream:1;
 };
 
 struct edit_mail *edit_mail_wrap(struct mail *mail)
@@ -351,6 +357,14 @@ void edit_mail_reset(struct edit_mail *edmail)
 	struct _header_field_index *field_idx;
 
 	i_stream_unref(&edmail->stream);
+	edmail->splice_stream = FALSE;
+	if ( array_is_created(&edmail->old_streams) ) {
+		struct istream **input;
+
+		array_foreach_modifiable(&edmail->old_streams, input)
+			i_stream_unref(input);
+		array_free(&edmail->old_streams);
+	}
 
 	field_idx = edmail->header_fields_head;
 	while ( field_idx != NULL ) {
@@ -371,6 +385,12 @@ void edit_mail_reset(struct edit_mail *edmail)
 
 		header_idx = next;
 	}
+	edmail->headers_head = edmail->headers_tail = NULL;
+	edmail->header_fields_head = edmail->header_fields_tail = NULL;
+	edmail->header_fields_appended = NULL;
+
+	if ( hash_table_is_created(edmail->header_index) )
+		hash_table_destroy(&edmail->header_index);
 
 	edmail->modified = FALSE;
 }
@@ -419,6 +439,17 @@ static inline void edit_mail_modify(struct edit_mail *edmail)
 	edmail->mail.mail.seq++;
 	edmail->modified = TRUE;
 	edmail->snapshot_modified = TRUE;
+
+	/* A splice stream holds a copy of the header block, so it is stale now.
+	   Earlier callers of mail_get_stream() do not hold a reference of their
+	   own, so it is kept until the edit_mail is reset. */
+	if ( edmail->splice_stream ) {
+		if ( !array_is_created(&edmail->old_streams) )
+			i_array_init(&edmail->old_streams, 4);
+		array_append(&edmail->old_streams, &edmail->stream, 1);
+		edmail->stream = NULL;
+		edmail->splice_stream = FALSE;
+	}
 }
 
 /* Header modification */
@@ -465,17 +496,33 @@ static inline char *_header_value_unfold
 static struct _header_index *edit_mail_header_find
 (struct edit_mail *edmail, const char *field_name)
 {
-	struct _header_index *header_idx;
+	if ( !hash_table_is_created(edmail->header_index) )
+		return NULL;
 
-	header_idx = edmail->headers_head;
-	while ( header_idx != NULL ) {
-		if ( strcasecmp(header_idx->header->name, field_name) == 0 )
-			return header_idx;
+	return hash_table_lookup(edmail->header_index, field_name);
+}
 
-		header_idx = header_idx->next;
+static void edit_mail_header_link
+(struct edit_mail *edmail, struct _header_index *header_idx)
+{
+	if ( !hash_table_is_created(edmail->header_index) ) {
+		hash_table_create(&edmail->header_index, default_pool, 0,
+			strcase_hash, strcasecmp);
 	}
 
-	return NULL;
+	/* Keyed by the header name, which lives as long as the index entry */
+	hash_table_insert
+		(edmail->header_index, header_idx->header->name, header_idx);
+	DLLIST2_APPEND(&edmail->headers_head, &edmail->headers_tail, header_idx);
+}
+
+static void edit_mail_header_remove
+(struct edit_mail *edmail, struct _header_index *header_idx)
+{
+	hash_table_remove(edmail->header_index, header_idx->header->name);
+	DLLIST2_REMOVE(&edmail->headers_head, &edmail->headers_tail, header_idx);
+	_header_unref(header_idx->header);
+	i_free(header_idx);
 }
 
 static struct _header_index *edit_mail_header_create
@@ -487,7 +534,7 @@ static struct _header_index *edit_mail_header_create
 		header_idx = i_new(struct _header_index, 1);
 		header_idx->header = _header_create(field_name);
 
-		DLLIST2_APPEND(&edmail->headers_head, &edmail->headers_tail, header_idx);
+		edit_mail_header_link(edmail, header_idx);
 	}
 
 	return header_idx;
@@ -498,18 +545,17 @@ static struct _header_index *edit_mail_header_clone
 {
 	struct _header_index *header_idx;
 
-	header_idx = edmail->headers_head;
-	while ( header_idx != NULL ) {
-		if ( header_idx->header == header )
-			return header_idx;
-
-		header_idx = header_idx->next;
+	/* Header names are unique within a mail, so the name identifies the
+	   index entry that already shares this header (if any). */
+	if ( (header_idx=edit_mail_header_find(edmail, header->name)) != NULL ) {
+		i_assert( header_idx->header == header );
+		return header_idx;
 	}
 
 	header_idx = i_new(struct _header_index, 1);
 	header_idx->header = header;
 	_header_ref(header);
-	DLLIST2_APPEND(&edmail->headers_head, &edmail->headers_tail, header_idx);
+	edit_mail_header_link(edmail, header_idx);
 
 	return header_idx;
 }
@@ -574,9 +620,7 @@ static void edit_mail_header_field_delete
 	header_idx->count--;
 	if ( update_index ) {
 		if ( header_idx->count == 0 ) {
-			DLLIST2_REMOVE(&edmail->headers_head, &edmail->headers_tail, header_idx);
-			_header_unref(header_idx->header);
-			i_free(header_idx);
+			edit_mail_header_remove(edmail, header_idx);
 		} else if ( header_idx->first == field_idx ) {
 			struct _header_field_index *hfield = header_idx->first->next;
 
@@ -656,9 +700,7 @@ edit_mail_header_field_replace
 
 		if ( update_index ) {
 			if ( header_idx->count == 0 ) {
-				DLLIST2_REMOVE(&edmail->headers_head, &edmail->headers_tail, header_idx);
-				_header_unref(header_idx->header);
-				i_free(header_idx);
+				edit_mail_header_remove(edmail, header_idx);
 			} else if ( header_idx->first == field_idx ) {
 				struct _header_field_index *hfield = header_idx->first->next;
 
@@ -986,9 +1028,7 @@ int edit_mail_header_delete
 	}
 
 	if ( index == 0 || header_idx->count == 0 ) {
-		DLLIST2_REMOVE(&edmail->headers_head, &edmail->headers_tail, header_idx);
-		_header_unref(header_idx->header);
-		i_free(header_idx);
+		edit_mail_header_remove(edmail, header_idx);
 	} else if ( header_idx->first == NULL || header_idx->last == NULL ) {
 		struct _header_field_index *current = edmail->header_fields_head;
 
@@ -1062,9 +1102,7 @@ int edit_mail_header_replace
 
 	/* Update old header index */
 	if ( header_idx->count == 0 ) {
-		DLLIST2_REMOVE(&edmail->headers_head, &edmail->headers_tail, header_idx);
-		_header_unref(header_idx->header);
-		i_free(header_idx);
+		edit_mail_header_remove(edmail, header_idx);
 	} else if ( header_idx->first == NULL || header_idx->last == NULL ) {
 		struct _header_field_index *current = edmail->header_fields_head;
 
@@ -1547,9 +1585,17 @@ static int edit_mail_get_stream
 	struct message_size *body_size, struct istream **stream_r)
 {
 	struct edit_mail *edmail = (struct edit_mail *)mail;
+	struct edit_mail_splice splice;
 
 	if ( edmail->stream == NULL ) {
-		edmail->stream = edit_mail_istream_create(edmail);
+		/* Prefer passing the body straight from the wrapped stream */
+		if ( edit_mail_get_splice(edmail, &splice) > 0 ) {
+			edmail->stream = edit_mail_splice_istream_create(&splice);
+			edmail->splice_stream = TRUE;
+			edit_mail_splice_deinit(&splice);
+		} else {
+			edmail->stream = edit_mail_istream_create(edmail);
+		}
 	}
 
 	if ( hdr_size != NULL ) {
@@ -1695,6 +1741,127 @@ static struct mail_vfuncs edit_mail_vfuncs = {
 	NULL,
 };
 
+/*
+ * Splice representation
+ */
+
+static void
+edit_mail_splice_append_fields(buffer_t *header,
+	struct _header_field_index *from, struct _header_field_index *until)
+{
+	struct _header_field_index *field_idx;
+
+	for ( field_idx = from; field_idx != until; field_idx = field_idx->next ) {
+		i_assert( field_idx != NULL );
+		buffer_append(header, field_idx->field->data, field_idx->field->size);
+	}
+}
+
+static int
+edit_mail_splice_append_wrapped(struct edit_mail *edmail, buffer_t *header,
+	uoff_t size)
+{
+	struct istream *input = edmail->wrapped_stream;
+	const unsigned char *data;
+	size_t dsize;
+	int ret;
+
+	i_stream_seek(input, 0);
+	while ( size > 0 && (ret=i_stream_read_more(input, &data, &dsize)) > 0 ) {
+		if ( dsize > size )
+			dsize = (size_t)size;
+		buffer_append(header, data, dsize);
+		i_stream_skip(input, dsize);
+		size -= dsize;
+	}
+
+	if ( size > 0 ) {
+		i_error("edit-mail: failed to read original header: %s",
+			( input->stream_errno != 0 ?
+				i_stream_get_error(input) : "unexpected EOF" ));
+		return -1;
+	}
+	return 0;
+}
+
+int edit_mail_get_splice
+(struct edit_mail *edmail, struct edit_mail_splice *splice_r)
+{
+	struct istream *wrapped = edmail->wrapped_stream;
+	uoff_t eoh_size = ( edmail->eoh_crlf ? 2 : 1 );
+	buffer_t *header;
+
+	i_zero(splice_r);
+
+	/* The range into the wrapped stream needs to be read independently
+	   from the header block */
+	if ( !edmail->modified || !wrapped->seekable ||
+		edmail->wrapped_hdr_size.physical_size < eoh_size )
+		return 0;
+
+	header = buffer_create_dynamic(default_pool,
+		edmail->hdr_size.physical_size + 128);
+
+	if ( edmail->headers_parsed ) {
+		/* Header is fully rebuilt; only the end-of-header line and the body
+		   come from the original message */
+		edit_mail_splice_append_fields
+			(header, edmail->header_fields_head, NULL);
+		splice_r->body_offset =
+			edmail->wrapped_hdr_size.physical_size - eoh_size;
+	} else if ( edmail->header_fields_appended != NULL ) {
+		/* Original header is kept, with fields added before and after it */
+		edit_mail_splice_append_fields(header,
+			edmail->header_fields_head, edmail->header_fields_appended);
+		if ( edit_mail_splice_append_wrapped(edmail, header,
+			edmail->wrapped_hdr_size.physical_size - 1) < 0 ) {
+			buffer_free(&header);
+			return -1;
+		}
+		/* Strip final CR too when it is present */
+		if ( header->used > 0 &&
+			((const unsigned char *)header->data)[header->used-1] == '\r' )
+			buffer_set_used_size(header, header->used - 1);
+		edit_mail_splice_append_fields
+			(header, edmail->header_fields_appended, NULL);
+		splice_r->body_offset =
+			edmail->wrapped_hdr_size.physical_size - eoh_size;
+	} else {
+		/* Fields are only prepended to the original message */
+		edit_mail_splice_append_fields
+			(header, edmail->header_fields_head, NULL);
+		splice_r->body_offset = 0;
+	}
+
+	splice_r->header = header;
+	splice_r->input = wrapped;
+	return 1;
+}
+
+void edit_mail_splice_deinit(struct edit_mail_splice *splice)
+{
+	if ( splice->header != NULL )
+		buffer_free(&splice->header);
+	splice->input = NULL;
+}
+
+struct istream *
+edit_mail_splice_istream_create(const struct edit_mail_splice *splice)
+{
+	struct istream *inputs[3], *input;
+
+	inputs[0] = i_stream_create_copy_from_data
+		(splice->header->data, splice->header->used);
+	inputs[1] = i_stream_create_range
+		(splice->input, splice->body_offset, (uoff_t)-1);
+	inputs[2] = NULL;
+
+	input = i_stream_create_concat(inputs);
+	i_stream_unref(&inputs[0]);
+	i_stream_unref(&inputs[1]);
+	return input;
+}
+
 /*
  * Edit Mail Stream
  */
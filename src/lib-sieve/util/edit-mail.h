@@ -10,6 +10,8 @@ struct edit_mail *edit_mail_wrap(struct mail *mail);
 void edit_mail_unwrap(struct edit_mail **edmail);
 struct edit_mail *edit_mail_snapshot(struct edit_mail *edmail);
 
+/* Streams obtained from the mail remain valid until the edit_mail is reset or
+   unwrapped, even when the message is modified again in the mean time. */
 void edit_mail_reset(struct edit_mail *edmail);
 
 struct mail *edit_mail_get_mail(struct edit_mail *edmail);
@@ -51,6 +53,28 @@ bool edit_mail_headers_iterate_replace
 	(struct edit_mail_header_iter *edhiter,
 		const char *newname, const char *newvalue);
 
+/*
+ * Splice representation
+ */
+
+/* A modified message consists of a (rebuilt) header block followed by an
+   unmodified range of the wrapped message stream. Consumers can send the
+   header block and then pass the range through without copying the body.
+ */
+struct edit_mail_splice {
+	buffer_t *header;
+
+	struct istream *input;
+	uoff_t body_offset;
+};
+
+/* Returns 1 when the splice is filled in, 0 when the message is not modified
+   or the wrapped stream is not seekable, and -1 on read error. */
+int edit_mail_get_splice
+	(struct edit_mail *edmail, struct edit_mail_splice *splice_r);
+void edit_mail_splice_deinit(struct edit_mail_splice *splice);
 
+struct istream *
+edit_mail_splice_istream_create(const struct edit_mail_splice *splice);
 
 #endif /* __edit_mail_H */
@@ -143,6 +143,30 @@ static bool cmd_putscript_cancel(struct cmd_putscript_context *ctx, bool skip)
 	return cmd_putscript_continue_cancel(ctx->cmd);
 }
 
+static void cmd_putscript_save_binary
+(struct client *client, const char *scriptname)
+{
+	struct sieve_script *script;
+	struct sieve_binary *sbin;
+	enum sieve_error error;
+
+	/* The binary compiled for validation refers to the temporary script, so
+	 * compile the committed script once more to make sure the next delivery
+	 * only needs to load it. */
+	script = sieve_storage_open_script(client->storage, scriptname, NULL);
+	if ( script == NULL )
+		return;
+
+	sbin = sieve_compile_script(script,
+		sieve_system_ehandler_get(client->svinst),
+		SIEVE_COMPILE_FLAG_NOGLOBAL | SIEVE_COMPILE_FLAG_ACTIVATED, &error);
+	if ( sbin != NULL ) {
+		(void)sieve_save(sbin, FALSE, NULL);
+		sieve_close(&sbin);
+	}
+	sieve_script_unref(&script);
+}
+
 static bool cmd_putscript_finish_parsing(struct client_command_context *cmd)
 {
 	struct client *client = cmd->client;
@@ -213,10 +237,12 @@ static bool cmd_putscript_finish_parsing(struct client_command_context *cmd)
 			struct sieve_binary *sbin;
 			enum sieve_error error;
 			string_t *errors;
+			bool activated = FALSE;
 
 			/* Mark this as an activation when we are replacing the active script */
 			if ( sieve_storage_save_will_activate(ctx->save_ctx) ) {
 				cpflags |= SIEVE_COMPILE_FLAG_ACTIVATED;
+				activated = TRUE;
 			}
 
 			/* Prepare error handler */
@@ -249,6 +275,10 @@ static bool cmd_putscript_finish_parsing(struct client_command_context *cmd)
 					if (ret < 0) {
 						client_send_storage_error(client, ctx->storage);
 						success = FALSE;
+
+					/* Replaced the active script */
+					} else if ( activated && client_may_store_binary(ehandler) ) {
+						cmd_putscript_save_binary(client, ctx->scriptname);
 					}
 				}
 			}
@@ -63,6 +63,10 @@ bool cmd_setactive(struct client_command_context *cmd)
 					}
 					success = FALSE;
 				} else {
+					/* Store the binary, so that the first delivery does not need
+					 * to compile the script. */
+					if ( client_may_store_binary(ehandler) )
+						(void)sieve_save(sbin, FALSE, NULL);
 					sieve_close(&sbin);
 				}
 
@@ -437,6 +437,17 @@ void client_send_storage_error
 	}
 }
 
+bool client_may_store_binary(struct sieve_error_handler *ehandler)
+{
+	/* Warnings are only reported to the ManageSieve client. A delivery that
+	   loads a stored binary never compiles the script itself, so it would
+	   never log them. Without the binary, the first delivery compiles the
+	   script and the warnings end up in the log. Compiling for upload is also
+	   less strict (e.g. about missing includes), so such a binary may not be
+	   accepted by a delivery anyway. */
+	return ( sieve_get_warnings(ehandler) == 0 );
+}
+
 bool client_read_args(struct client_command_context *cmd, unsigned int count,
 	unsigned int flags, bool no_more, const struct managesieve_arg **args_r)
 {
@@ -8,6 +8,7 @@
 
 struct client;
 struct sieve_storage;
+struct sieve_error_handler;
 struct managesieve_parser;
 struct managesieve_arg;
 
@@ -123,6 +124,10 @@ void client_send_command_error(struct client_command_context *cmd,
 void client_send_storage_error(struct client *client,
              struct sieve_storage *storage);
 
+/* Returns TRUE when the binary compiled while activating a script may be
+   stored for use by the next delivery */
+bool client_may_store_binary(struct sieve_error_handler *ehandler);
+
 /* Read a number of arguments. Returns TRUE if everything was read or
    FALSE if either needs more data or error occurred. */
 bool client_read_args
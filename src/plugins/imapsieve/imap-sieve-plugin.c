@@ -3,6 +3,8 @@
 #include "imap-common.h"
 #include "str.h"
 
+#include "sieve.h"
+
 #include "imap-sieve.h"
 #include "imap-sieve-storage.h"
 
@@ -57,4 +59,6 @@ void imap_sieve_plugin_deinit(void)
 {
 	imap_sieve_storage_deinit();
 	imap_client_created_hook_set(next_hook_client_created);
+
+	sieve_caches_deinit();
 }
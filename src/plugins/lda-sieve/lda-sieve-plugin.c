@@ -19,6 +19,7 @@
 #include "sieve.h"
 #include "sieve-script.h"
 #include "sieve-storage.h"
+#include "sieve-duplicate.h"
 
 #include "lda-sieve-log.h"
 #include "lda-sieve-plugin.h"
@@ -799,6 +800,7 @@ static int lda_sieve_execute
 	struct sieve_exec_status estatus;
 	struct sieve_trace_config trace_config;
 	struct sieve_trace_log *trace_log;
+	struct sieve_duplicate_db *dup_db;
 	bool debug = mdctx->rcpt_user->mail_debug;
 	const char *error;
 	int ret;
@@ -880,6 +882,12 @@ static int lda_sieve_execute
 	scriptenv.trace_log = trace_log;
 	scriptenv.trace_config = trace_config;
 
+	/* Prefer the Sieve duplicate database over the one from LDA when it is
+	   configured. If it cannot be opened, the latter is used instead. */
+	(void)sieve_duplicate_db_open_default
+		(svinst, mdctx->rcpt_user->username, &dup_db);
+	scriptenv.duplicate_db = dup_db;
+
 	i_zero(&estatus);
 	scriptenv.exec_status = &estatus;
 
@@ -889,6 +897,9 @@ static int lda_sieve_execute
 
 	ret = lda_sieve_execute_scripts(srctx);
 
+	if ( dup_db != NULL )
+		sieve_duplicate_db_close(&dup_db);
+
 	/* Record status */
 
 	mdctx->tried_default_save = estatus.tried_default_save;
@@ -981,4 +992,6 @@ void sieve_plugin_deinit(void)
 {
 	/* Remove hook */
 	mail_deliver_hook_set(next_deliver_mail);
+
+	sieve_caches_deinit();
 }
@@ -91,9 +91,19 @@ static int act_pipe_check_duplicate
 static void act_pipe_print
 	(const struct sieve_action *action,
 		const struct sieve_result_print_env *rpenv, bool *keep);	
+static int act_pipe_start
+	(const struct sieve_action *action,
+		const struct sieve_action_exec_env *aenv, void **tr_context);
+static int act_pipe_execute
+	(const struct sieve_action *action,
+		const struct sieve_action_exec_env *aenv, void *tr_context);
 static int act_pipe_commit
 	(const struct sieve_action *action,	
 		const struct sieve_action_exec_env *aenv, void *tr_context, bool *keep);
+static void act_pipe_rollback
+	(const struct sieve_action *action,
+		const struct sieve_action_exec_env *aenv, void *tr_context,
+		bool success);
 
 /* Action object */
 
@@ -102,7 +112,10 @@ const struct sieve_action_def act_pipe = {
 	.flags = SIEVE_ACTFLAG_TRIES_DELIVER,
 	.check_duplicate = act_pipe_check_duplicate, 
 	.print = act_pipe_print,
-	.commit = act_pipe_commit
+	.start = act_pipe_start,
+	.execute = act_pipe_execute,
+	.commit = act_pipe_commit,
+	.rollback = act_pipe_rollback
 };
 
 /* Action context information */
@@ -113,6 +126,15 @@ struct ext_pipe_action {
 	bool try;
 };
 
+struct act_pipe_transaction {
+	struct sieve_extprogram *sprog;
+	enum sieve_error error;
+
+	/* Program was created (and possibly started) during execute */
+	bool prepared:1;
+	bool mail_failed:1;
+};
+
 /*
  * Command registration
  */
@@ -281,10 +303,10 @@ static int act_pipe_check_duplicate
 	old_act = (struct ext_pipe_action *) act_other->context;
 
 	if ( strcmp(new_act->program_name, old_act->program_name) == 0 ) {
-		sieve_runtime_error(renv, act->location,
+		sieve_runtime_error(renv, sieve_action_get_location(act),
 			"duplicate pipe \"%s\" action not allowed "
 			"(previously triggered one was here: %s)",
-			new_act->program_name, act_other->location);
+			new_act->program_name, sieve_action_get_location(act_other));
 		return -1;
 	}
 
@@ -317,34 +339,89 @@ static void act_pipe_print
 
 /* Result execution */
 
+static int act_pipe_program_create
+(const struct sieve_action *action,
+	const struct sieve_action_exec_env *aenv,
+	struct act_pipe_transaction *trans)
+{
+	const struct ext_pipe_action *act =
+		(const struct ext_pipe_action *) action->context;
+	struct mail *mail =	( action->mail != NULL ?
+		action->mail : sieve_message_get_mail(aenv->msgctx) );
+
+	trans->prepared = TRUE;
+	trans->sprog = sieve_extprogram_create
+		(action->ext, aenv->scriptenv, aenv->msgdata, "pipe",
+			act->program_name, act->args, &trans->error);
+	if ( trans->sprog == NULL )
+		return -1;
+
+	if ( sieve_extprogram_set_input_mail(trans->sprog, mail) < 0 ) {
+		sieve_extprogram_destroy(&trans->sprog);
+		trans->mail_failed = TRUE;
+		return -1;
+	}
+	return 0;
+}
+
+static int act_pipe_start
+(const struct sieve_action *action ATTR_UNUSED,
+	const struct sieve_action_exec_env *aenv, void **tr_context)
+{
+	pool_t pool = sieve_result_pool(aenv->result);
+
+	*tr_context = p_new(pool, struct act_pipe_transaction, 1);
+	return SIEVE_EXEC_OK;
+}
+
+static int act_pipe_execute
+(const struct sieve_action *action,
+	const struct sieve_action_exec_env *aenv, void *tr_context)
+{
+	struct act_pipe_transaction *trans =
+		(struct act_pipe_transaction *) tr_context;
+
+	/* Start the program now when programs may run in parallel; it is joined
+	   at commit, so the pipes of one result proceed concurrently. */
+	if ( !sieve_extprogram_can_run_async(action->ext) )
+		return SIEVE_EXEC_OK;
+
+	if ( act_pipe_program_create(action, aenv, trans) == 0 )
+		sieve_extprogram_run_async(trans->sprog);
+	return SIEVE_EXEC_OK;
+}
+
 static int act_pipe_commit
 (const struct sieve_action *action,
 	const struct sieve_action_exec_env *aenv, 
-	void *tr_context ATTR_UNUSED, bool *keep)
+	void *tr_context, bool *keep)
 {
 	const struct ext_pipe_action *act = 
 		(const struct ext_pipe_action *) action->context;
-	enum sieve_error error = SIEVE_ERROR_NONE;
+	struct act_pipe_transaction *trans =
+		(struct act_pipe_transaction *) tr_context;
+	enum sieve_error error;
 	struct mail *mail =	( action->mail != NULL ?
 		action->mail : sieve_message_get_mail(aenv->msgctx) );
-	struct sieve_extprogram *sprog;
 	int ret;
 
-	sprog = sieve_extprogram_create
-		(action->ext, aenv->scriptenv, aenv->msgdata, "pipe",
-			act->program_name, act->args, &error);
-	if ( sprog != NULL ) {
-		if ( sieve_extprogram_set_input_mail(sprog, mail) < 0 ) {
-			sieve_extprogram_destroy(&sprog);
-			return sieve_result_mail_error(aenv, mail,
-				"pipe action: failed to read input message");
-		}
-		ret = sieve_extprogram_run(sprog);
-	} else {
-		ret = -1;
+	if ( !trans->prepared )
+		(void)act_pipe_program_create(action, aenv, trans);
+	error = trans->error;
+
+	if ( trans->mail_failed ) {
+		return sieve_result_mail_error(aenv, mail,
+			"pipe action: failed to read input message");
 	}
-	if ( sprog != NULL )
-		sieve_extprogram_destroy(&sprog);
+
+	if ( trans->sprog == NULL )
+		ret = -1;
+	else if ( sieve_extprogram_can_run_async(action->ext) )
+		ret = sieve_extprogram_wait(trans->sprog);
+	else
+		ret = sieve_extprogram_run(trans->sprog);
+	if ( trans->sprog != NULL )
+		sieve_extprogram_destroy(&trans->sprog);
 
 	if ( ret > 0 ) {
 		sieve_result_global_log(aenv, "pipe action: "
@@ -378,9 +455,15 @@ static int act_pipe_commit
 	return SIEVE_EXEC_OK;
 }
 
+static void act_pipe_rollback
+(const struct sieve_action *action ATTR_UNUSED,
+	const struct sieve_action_exec_env *aenv ATTR_UNUSED,
+	void *tr_context, bool success ATTR_UNUSED)
+{
+	struct act_pipe_transaction *trans =
+		(struct act_pipe_transaction *) tr_context;
 
-
-
-
-
-
+	/* Abort the program if it is still running */
+	if ( trans != NULL && trans->sprog != NULL )
+		sieve_extprogram_destroy(&trans->sprog);
+}
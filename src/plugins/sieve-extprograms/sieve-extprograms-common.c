@@ -8,6 +8,8 @@
 #include "str-sanitize.h"
 #include "unichar.h"
 #include "array.h"
+#include "ioloop.h"
+#include "time-util.h"
 #include "eacces-error.h"
 #include "smtp-params.h"
 #include "istream.h"
@@ -31,6 +33,7 @@
 #include "sieve-validator.h"
 #include "sieve-runtime.h"
 #include "sieve-interpreter.h"
+#include "sieve-programs.h"
 
 #include "sieve-ext-copy.h"
 #include "sieve-ext-variables.h"
@@ -63,7 +66,8 @@ struct sieve_extprograms_config *sieve_extprograms_config_init
 	struct sieve_extprograms_config *ext_config;
 	const char *extname = sieve_extension_name(ext);
 	const char *bin_dir, *socket_dir, *input_eol;
-	sieve_number_t execute_timeout;
+	sieve_number_t execute_timeout, cache_ttl;
+	unsigned long long int max_parallel;
 
 	extname = strrchr(extname, '.');
 	i_assert(extname != NULL);
@@ -79,6 +83,7 @@ struct sieve_extprograms_config *sieve_extprograms_config_init
 	ext_config = i_new(struct sieve_extprograms_config, 1);
 	ext_config->execute_timeout = 
 		SIEVE_EXTPROGRAMS_DEFAULT_EXEC_TIMEOUT_SECS;
+	ext_config->max_parallel = 1;
 
 	if ( bin_dir == NULL && socket_dir == NULL ) {
 		if ( svinst->debug ) {
@@ -97,6 +102,18 @@ struct sieve_extprograms_config *sieve_extprograms_config_init
 			ext_config->execute_timeout = execute_timeout;
 		}
 
+		if (sieve_setting_get_uint_value
+			(svinst, t_strdup_printf("sieve_%s_max_parallel", extname),
+				&max_parallel) && max_parallel > 0) {
+			ext_config->max_parallel = (unsigned int)max_parallel;
+		}
+
+		if (sieve_setting_get_duration_value
+			(svinst, t_strdup_printf("sieve_%s_cache_ttl", extname),
+				&cache_ttl)) {
+			ext_config->cache_ttl = cache_ttl;
+		}
+
 		ext_config->default_input_eol = SIEVE_EXTPROGRAMS_EOL_CRLF;
 		if (input_eol != NULL && strcasecmp(input_eol, "lf") == 0)
 			ext_config->default_input_eol = SIEVE_EXTPROGRAMS_EOL_LF;
@@ -115,6 +132,8 @@ void sieve_extprograms_config_deinit
 	if ( *ext_config == NULL )
 		return;
 
+	i_assert( (*ext_config)->async_count == 0 );
+
 	i_free((*ext_config)->bin_dir);
 	i_free((*ext_config)->socket_dir);
 	i_free((*ext_config));
@@ -372,11 +391,21 @@ int sieve_extprogram_command_read_operands
 
 struct sieve_extprogram {
 	struct sieve_instance *svinst;
-	const struct sieve_extprograms_config *ext_config;
+	struct sieve_extprograms_config *ext_config;
 
 	const struct sieve_script_env *scriptenv;
 	struct program_client_settings set;
 	struct program_client *program_client;
+
+	/* Program identity for the run statistics and the location cache */
+	char *stats_name, *location_key;
+	struct timeval start_time;
+
+	/* Asynchronous execution */
+	int result;
+
+	bool async:1;
+	bool running:1;
 };
 
 void sieve_extprogram_exec_error
@@ -404,38 +433,17 @@ void sieve_extprogram_exec_error
 	va_end(args);
 }
 
-/* API */
-
-struct sieve_extprogram *sieve_extprogram_create
-(const struct sieve_extension *ext, const struct sieve_script_env *senv,
-	const struct sieve_message_data *msgdata, const char *action,
-	const char *program_name, const char * const *args,
+static int sieve_extprogram_locate
+(struct sieve_instance *svinst, struct sieve_extprograms_config *ext_config,
+	const struct sieve_script_env *senv, const char *action,
+	const char *program_name, const char **path_r, bool *fork_r,
 	enum sieve_error *error_r)
 {
-	struct sieve_instance *svinst = ext->svinst;
-	struct sieve_extprograms_config *ext_config =
-		(struct sieve_extprograms_config *) ext->context;
-	const struct smtp_address *sender, *recipient, *orig_recipient;
-	struct sieve_extprogram *sprog;
 	const char *path = NULL;
 	struct stat st;
 	bool fork = FALSE;
 	int ret;
 
-	if ( svinst->debug ) {
-		sieve_sys_debug(svinst, "action %s: "
-			"running program: %s", action, program_name);
-	}
-
-	if ( ext_config == NULL ||
-		(ext_config->bin_dir == NULL && ext_config->socket_dir == NULL) ) {
-		sieve_sys_error(svinst, "action %s: "
-			"failed to execute program `%s': "
-			"vnd.dovecot.%s extension is unconfigured", action, program_name, action);
-		*error_r = SIEVE_ERROR_NOT_FOUND;
-		return NULL;
-	}
-
 	/* Try socket first */
 	if ( ext_config->socket_dir != NULL ) {
 		path = t_strconcat(senv->user->set->base_dir, "/",
@@ -453,12 +461,12 @@ struct sieve_extprogram *sieve_extprogram_create
 				sieve_sys_error(svinst, "action %s: "
 					"failed to stat socket: %s", action, eacces_error_get("stat", path));
 				*error_r = SIEVE_ERROR_NO_PERMISSION;
-				return NULL;
+				return -1;
 			default:
 				sieve_sys_error(svinst, "action %s: "
 					"failed to stat socket `%s': %m", action, path);
 				*error_r = SIEVE_ERROR_TEMP_FAILURE;
-				return NULL;
+				return -1;
 			}
 			path = NULL;
 		} else if ( !S_ISSOCK(st.st_mode) ) {
@@ -466,7 +474,7 @@ struct sieve_extprogram *sieve_extprogram_create
 				"socket path `%s' for program `%s' is not a socket",
 				action, path, program_name);
 			*error_r = SIEVE_ERROR_NOT_POSSIBLE;
-			return NULL;
+			return -1;
 		}
 	}
 		
@@ -496,19 +504,19 @@ struct sieve_extprogram *sieve_extprogram_create
 				break;
 			}
 
-			return NULL;
+			return -1;
 		} else if ( !S_ISREG(st.st_mode) ) {
 			sieve_sys_error(svinst, "action %s: "
 				"executable `%s' for program `%s' is not a regular file",
 				action, path, program_name);
 			*error_r = SIEVE_ERROR_NOT_POSSIBLE;
-			return NULL;
+			return -1;
 		} else if ( (st.st_mode & S_IWOTH) != 0 ) {
 			sieve_sys_error(svinst, "action %s: "
 				"executable `%s' for program `%s' is world-writable",
 				action, path, program_name);
 			*error_r = SIEVE_ERROR_NO_PERMISSION;
-			return NULL;
+			return -1;
 		}
 	}
 
@@ -517,13 +525,70 @@ struct sieve_extprogram *sieve_extprogram_create
 		sieve_sys_error(svinst, "action %s: "
 			"program `%s' not found", action, program_name);
 		*error_r = SIEVE_ERROR_NOT_FOUND;
+		return -1;
+	}
+
+	*path_r = path;
+	*fork_r = fork;
+	return 0;
+}
+
+/* API */
+
+struct sieve_extprogram *sieve_extprogram_create
+(const struct sieve_extension *ext, const struct sieve_script_env *senv,
+	const struct sieve_message_data *msgdata, const char *action,
+	const char *program_name, const char * const *args,
+	enum sieve_error *error_r)
+{
+	struct sieve_instance *svinst = ext->svinst;
+	struct sieve_extprograms_config *ext_config =
+		(struct sieve_extprograms_config *) ext->context;
+	const struct smtp_address *sender, *recipient, *orig_recipient;
+	struct sieve_extprogram *sprog;
+	const char *path = NULL, *location_key, *stats_name;
+	bool fork = FALSE, is_socket;
+
+	if ( svinst->debug ) {
+		sieve_sys_debug(svinst, "action %s: "
+			"running program: %s", action, program_name);
+	}
+
+	if ( ext_config == NULL ||
+		(ext_config->bin_dir == NULL && ext_config->socket_dir == NULL) ) {
+		sieve_sys_error(svinst, "action %s: "
+			"failed to execute program `%s': "
+			"vnd.dovecot.%s extension is unconfigured", action, program_name, action);
+		*error_r = SIEVE_ERROR_NOT_FOUND;
 		return NULL;
 	}
 
+	stats_name = t_strdup_printf("%s/%s", action, program_name);
+
+	/* Locate the program; the location may be known from an earlier run */
+	location_key = t_strdup_printf("%s/%s\n%s\n%s",
+		senv->user->set->base_dir,
+		( ext_config->socket_dir == NULL ? "" : ext_config->socket_dir ),
+		( ext_config->bin_dir == NULL ? "" : ext_config->bin_dir ),
+		program_name);
+	if ( ext_config->cache_ttl > 0 &&
+		sieve_program_location_lookup(location_key, &path, &is_socket) ) {
+		fork = !is_socket;
+		sieve_program_stats_add_location_hit(stats_name);
+	} else {
+		if ( sieve_extprogram_locate(svinst, ext_config, senv, action,
+			program_name, &path, &fork, error_r) < 0 )
+			return NULL;
+		sieve_program_location_update
+			(location_key, path, !fork, ext_config->cache_ttl);
+	}
+
 	sprog = i_new(struct sieve_extprogram, 1);
 	sprog->svinst = ext->svinst;
 	sprog->ext_config = ext_config;
 	sprog->scriptenv = senv;
+	sprog->stats_name = i_strdup(stats_name);
+	sprog->location_key = i_strdup(location_key);
 
 	sprog->set.client_connect_timeout_msecs =
 		SIEVE_EXTPROGRAMS_CONNECT_TIMEOUT_MSECS;
@@ -576,8 +641,27 @@ struct sieve_extprogram *sieve_extprogram_create
 void sieve_extprogram_destroy(struct sieve_extprogram **_sprog)
 {
 	struct sieve_extprogram *sprog = *_sprog;
+	struct sieve_extprograms_config *ext_config = sprog->ext_config;
+
+	if ( sprog->running ) {
+		/* Aborted before it was joined */
+		i_assert( ext_config->running > 0 );
+		ext_config->running--;
+		sprog->running = FALSE;
+	}
 
 	program_client_destroy(&sprog->program_client);
+
+	if ( sprog->async ) {
+		i_assert( ext_config->async_count > 0 );
+		if ( --ext_config->async_count == 0 ) {
+			io_loop_set_current(ext_config->ioloop);
+			io_loop_destroy(&ext_config->ioloop);
+		}
+	}
+
+	i_free(sprog->stats_name);
+	i_free(sprog->location_key);
 	i_free(sprog);
 	*_sprog = NULL;
 }
@@ -637,8 +721,126 @@ int sieve_extprogram_set_input_mail
 	return 1;
 }
 
+static void sieve_extprogram_run_start(struct sieve_extprogram *sprog)
+{
+	if ( gettimeofday(&sprog->start_time, NULL) < 0 )
+		i_fatal("gettimeofday() failed: %m");
+}
+
+static void
+sieve_extprogram_run_finish(struct sieve_extprogram *sprog, int result)
+{
+	struct sieve_instance *svinst = sprog->svinst;
+	struct timeval end_time;
+	unsigned int msecs;
+
+	if ( gettimeofday(&end_time, NULL) < 0 )
+		i_fatal("gettimeofday() failed: %m");
+	msecs = timeval_diff_msecs(&end_time, &sprog->start_time);
+
+	/* The program could not be run at all; locate it again next time */
+	if ( result < 0 )
+		sieve_program_location_invalidate(sprog->location_key);
+
+	sieve_program_stats_add_run(sprog->stats_name, msecs, result > 0);
+
+	if ( svinst->debug ) {
+		struct sieve_program_stats stats;
+		unsigned int count;
+
+		sieve_program_stats_get(sprog->stats_name, &stats);
+		count = stats.runs + stats.failures;
+		sieve_sys_debug(svinst, "program %s: "
+			"finished in %u ms (%u runs, %u failed, "
+			"average %u ms, maximum %u ms)",
+			sprog->stats_name, msecs, count, stats.failures,
+			(unsigned int)(stats.total_msecs / count), stats.max_msecs);
+	}
+}
+
 int sieve_extprogram_run(struct sieve_extprogram *sprog)
 {
-	return program_client_run(sprog->program_client);
+	int ret;
+
+	i_assert( !sprog->async );
+
+	sieve_extprogram_run_start(sprog);
+	ret = program_client_run(sprog->program_client);
+	sieve_extprogram_run_finish(sprog, ret);
+
+	return ret;
 }
 
+/* Asynchronous execution */
+
+static void
+sieve_extprogram_async_callback(int result, struct sieve_extprogram *sprog)
+{
+	struct sieve_extprograms_config *ext_config = sprog->ext_config;
+
+	if ( !sprog->running )
+		return;
+
+	sprog->running = FALSE;
+	sprog->result = result;
+	i_assert( ext_config->running > 0 );
+	ext_config->running--;
+
+	sieve_extprogram_run_finish(sprog, result);
+
+	io_loop_stop(ext_config->ioloop);
+}
+
+bool sieve_extprogram_can_run_async(const struct sieve_extension *ext)
+{
+	struct sieve_extprograms_config *ext_config =
+		(struct sieve_extprograms_config *) ext->context;
+
+	return ( ext_config != NULL && ext_config->max_parallel > 1 );
+}
+
+void sieve_extprogram_run_async(struct sieve_extprogram *sprog)
+{
+	struct sieve_extprograms_config *ext_config = sprog->ext_config;
+	struct ioloop *prev_ioloop = current_ioloop;
+
+	i_assert( !sprog->async );
+
+	if ( ext_config->ioloop == NULL ) {
+		ext_config->ioloop = io_loop_create();
+	} else {
+		io_loop_set_current(ext_config->ioloop);
+
+		/* Wait for a free slot */
+		while ( ext_config->running >= ext_config->max_parallel )
+			io_loop_run(ext_config->ioloop);
+	}
+
+	sprog->async = TRUE;
+	sprog->running = TRUE;
+	ext_config->async_count++;
+	ext_config->running++;
+
+	sieve_extprogram_run_start(sprog);
+	program_client_run_async(sprog->program_client,
+		sieve_extprogram_async_callback, sprog);
+
+	io_loop_set_current(prev_ioloop);
+}
+
+int sieve_extprogram_wait(struct sieve_extprogram *sprog)
+{
+	struct sieve_extprograms_config *ext_config = sprog->ext_config;
+	struct ioloop *prev_ioloop = current_ioloop;
+
+	i_assert( sprog->async );
+
+	if ( sprog->running ) {
+		io_loop_set_current(ext_config->ioloop);
+		while ( sprog->running )
+			io_loop_run(ext_config->ioloop);
+		io_loop_set_current(prev_ioloop);
+	}
+
+	return sprog->result;
+}
@@ -25,6 +25,13 @@ struct sieve_extprograms_config {
 	enum sieve_extprograms_eol default_input_eol;
 
 	unsigned int execute_timeout;
+	unsigned int max_parallel;
+	/* Seconds a program location is cached for */
+	unsigned int cache_ttl;
+
+	/* Programs running asynchronously on a private ioloop */
+	struct ioloop *ioloop;
+	unsigned int async_count, running;
 };
 
 struct sieve_extprograms_config *sieve_extprograms_config_init
@@ -107,4 +114,11 @@ int sieve_extprogram_set_input_mail
 
 int sieve_extprogram_run(struct sieve_extprogram *sprog);
 
+/* Programs that are run asynchronously progress concurrently (at most
+   sieve_<ext>_max_parallel at once) until they are joined with
+   sieve_extprogram_wait(). Destroying one that was not joined aborts it. */
+bool sieve_extprogram_can_run_async(const struct sieve_extension *ext);
+void sieve_extprogram_run_async(struct sieve_extprogram *sprog);
+int sieve_extprogram_wait(struct sieve_extprogram *sprog);
+
 #endif /* __SIEVE_EXTPROGRAMS_COMMON_H */
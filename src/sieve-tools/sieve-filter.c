@@ -497,7 +497,7 @@ int main(int argc, char **argv)
 
 	/* Compile main sieve script */
 	if ( force_compile ) {
-		main_sbin = sieve_tool_script_compile(svinst, scriptfile, NULL);
+		main_sbin = sieve_tool_script_compile(svinst, scriptfile, NULL, 0);
 		if ( main_sbin != NULL )
 			(void) sieve_save(main_sbin, TRUE, NULL);
 	} else {
@@ -264,7 +264,7 @@ int main(int argc, char **argv)
 
 	/* Compile main sieve script */
 	if ( force_compile ) {
-		main_sbin = sieve_tool_script_compile(svinst, scriptfile, NULL);
+		main_sbin = sieve_tool_script_compile(svinst, scriptfile, NULL, 0);
 		if ( main_sbin != NULL )
 			(void) sieve_save(main_sbin, TRUE, NULL);
 	} else {
@@ -377,7 +377,7 @@ int main(int argc, char **argv)
 
 				/* Compile sieve script */
 				if ( force_compile ) {
-					sbin = sieve_tool_script_compile(svinst, sfiles[i], sfiles[i]);
+					sbin = sieve_tool_script_compile(svinst, sfiles[i], sfiles[i], 0);
 					if ( sbin != NULL )
 						(void) sieve_save(sbin, FALSE, NULL);
 				} else {
@@ -29,8 +29,8 @@
 static void print_help(void)
 {
 	printf(
-"Usage: sievec  [-c <config-file>] [-d] [-D] [-P <plugin>] [-x <extensions>] \n"
-"              <script-file> [<out-file>]\n"
+"Usage: sievec  [-c <config-file>] [-d] [-D] [-P <plugin>] [-s] \n"
+"              [-x <extensions>] <script-file> [<out-file>]\n"
 	);
 }
 
@@ -43,12 +43,13 @@ int main(int argc, char **argv)
 	struct sieve_instance *svinst;
 	struct stat st;
 	struct sieve_binary *sbin;
-	bool dump = FALSE;
+	enum sieve_compile_flags cpflags = 0;
+	bool dump = FALSE, shared = FALSE;
 	const char *scriptfile, *outfile;
 	int exit_status = EXIT_SUCCESS;
 	int c;
 
-	sieve_tool = sieve_tool_init("sievec", &argc, &argv, "DdP:x:u:", FALSE);
+	sieve_tool = sieve_tool_init("sievec", &argc, &argv, "DdP:sx:u:", FALSE);
 
 	outfile = NULL;
 	while ((c = sieve_tool_getopt(sieve_tool)) > 0) {
@@ -57,6 +58,10 @@ int main(int argc, char **argv)
 			/* dump file */
 			dump = TRUE;
 			break;
+		case 's':
+			/* store in shared binary directory */
+			shared = TRUE;
+			break;
 		default:
 			print_help();
 			i_fatal_status(EX_USAGE, "Unknown argument: %c", c);
@@ -77,6 +82,18 @@ int main(int argc, char **argv)
 		outfile = "-";
 	}
 
+	if ( shared ) {
+		if ( dump )
+			i_fatal_status(EX_USAGE,
+				"the -d option is not allowed together with the -s option.");
+		if ( outfile != NULL )
+			i_fatal_status(EX_USAGE,
+				"the outfile argument is not allowed with the -s option.");
+
+		/* Shared binaries are used for personal scripts */
+		cpflags |= SIEVE_COMPILE_FLAG_NOGLOBAL;
+	}
+
 	svinst = sieve_tool_init_finish(sieve_tool, FALSE, TRUE);
 
 	/* Enable debug extension */
@@ -119,10 +136,13 @@ int main(int argc, char **argv)
 				else
 					file = t_strconcat(scriptfile, "/", dp->d_name, NULL);
 
-				sbin = sieve_tool_script_compile(svinst, file, NULL);
+				sbin = sieve_tool_script_compile(svinst, file, NULL, cpflags);
 
 				if ( sbin != NULL ) {
-					sieve_save(sbin, TRUE, NULL);
+					if ( shared )
+						(void)sieve_save_shared(sbin, cpflags, NULL);
+					else
+						sieve_save(sbin, TRUE, NULL);
 					sieve_close(&sbin);
 				}
 			}
@@ -136,12 +156,15 @@ int main(int argc, char **argv)
 		 *
 		 *   NOTE: For consistency, stat errors are handled here as well
 		 */
-		sbin = sieve_tool_script_compile(svinst, scriptfile, NULL);
+		sbin = sieve_tool_script_compile(svinst, scriptfile, NULL, cpflags);
 
 		if ( sbin != NULL ) {
 			if ( dump )
 				sieve_tool_dump_binary_to(sbin, outfile, FALSE);
-			else {	
+			else if ( shared ) {
+				if ( sieve_save_shared(sbin, cpflags, NULL) < 0 )
+					exit_status = EXIT_FAILURE;
+			} else {	
 				sieve_save_as(sbin, outfile, TRUE, 0600, NULL);
 			}
 
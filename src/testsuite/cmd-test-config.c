@@ -14,6 +14,7 @@
 
 #include "testsuite-common.h"
 #include "testsuite-settings.h"
+#include "testsuite-duplicate.h"
 
 /*
  * Commands
@@ -451,6 +452,7 @@ static int cmd_test_config_reload_operation_execute
 		}
 
 		sieve_settings_load(renv->svinst);
+		testsuite_duplicate_reload();
 
 	} else {
 		if ( sieve_runtime_trace_active(renv, SIEVE_TRLVL_COMMANDS) ) {
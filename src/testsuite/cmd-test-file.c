@@ -0,0 +1,183 @@
+/* Copyright (c) 2002-2018 Pigeonhole authors, see the included COPYING file
+ */
+
+#include "lib.h"
+#include "str.h"
+#include "mkdir-parents.h"
+#include "write-full.h"
+
+#include "sieve-common.h"
+#include "sieve-commands.h"
+#include "sieve-validator.h"
+#include "sieve-generator.h"
+#include "sieve-interpreter.h"
+#include "sieve-code.h"
+#include "sieve-binary.h"
+#include "sieve-dump.h"
+
+#include "testsuite-common.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+
+/*
+ * Test_file_write command
+ *
+ * Syntax:
+ *   test_file_write <path: string> <data: string>
+ *
+ * The path is relative to the testsuite's temporary directory.
+ */
+
+static bool cmd_test_file_write_validate
+	(struct sieve_validator *valdtr, struct sieve_command *cmd);
+static bool cmd_test_file_write_generate
+	(const struct sieve_codegen_env *cgenv, struct sieve_command *ctx);
+
+const struct sieve_command_def cmd_test_file_write = {
+	.identifier = "test_file_write",
+	.type = SCT_COMMAND,
+	.positional_args = 2,
+	.subtests = 0,
+	.block_allowed = FALSE,
+	.block_required = FALSE,
+	.validate = cmd_test_file_write_validate,
+	.generate = cmd_test_file_write_generate
+};
+
+/*
+ * Operation
+ */
+
+static bool cmd_test_file_write_operation_dump
+	(const struct sieve_dumptime_env *denv, sieve_size_t *address);
+static int cmd_test_file_write_operation_execute
+	(const struct sieve_runtime_env *renv, sieve_size_t *address);
+
+const struct sieve_operation_def test_file_write_operation = {
+	.mnemonic = "TEST_FILE_WRITE",
+	.ext_def = &testsuite_extension,
+	.code = TESTSUITE_OPERATION_TEST_FILE_WRITE,
+	.dump = cmd_test_file_write_operation_dump,
+	.execute = cmd_test_file_write_operation_execute
+};
+
+/*
+ * Validation
+ */
+
+static bool cmd_test_file_write_validate
+(struct sieve_validator *valdtr, struct sieve_command *cmd)
+{
+	struct sieve_ast_argument *arg = cmd->first_positional;
+
+	if ( !sieve_validate_positional_argument
+		(valdtr, cmd, arg, "path", 1, SAAT_STRING) ) {
+		return FALSE;
+	}
+
+	if ( !sieve_validator_argument_activate(valdtr, cmd, arg, FALSE) )
+		return FALSE;
+
+	arg = sieve_ast_argument_next(arg);
+
+	if ( !sieve_validate_positional_argument
+		(valdtr, cmd, arg, "data", 2, SAAT_STRING) ) {
+		return FALSE;
+	}
+
+	return sieve_validator_argument_activate(valdtr, cmd, arg, FALSE);
+}
+
+/*
+ * Code generation
+ */
+
+static bool cmd_test_file_write_generate
+(const struct sieve_codegen_env *cgenv, struct sieve_command *cmd)
+{
+	sieve_operation_emit(cgenv->sblock, cmd->ext, &test_file_write_operation);
+
+	/* Generate arguments */
+	return sieve_generate_arguments(cgenv, cmd, NULL);
+}
+
+/*
+ * Code dump
+ */
+
+static bool cmd_test_file_write_operation_dump
+(const struct sieve_dumptime_env *denv, sieve_size_t *address)
+{
+	sieve_code_dumpf(denv, "TEST_FILE_WRITE:");
+	sieve_code_descend(denv);
+
+	return
+		sieve_opr_string_dump(denv, address, "path") &&
+		sieve_opr_string_dump(denv, address, "data");
+}
+
+/*
+ * Intepretation
+ */
+
+static int cmd_test_file_write_operation_execute
+(const struct sieve_runtime_env *renv, sieve_size_t *address)
+{
+	string_t *path = NULL, *data = NULL;
+	const char *file, *tmp_file, *p;
+	int fd, ret;
+
+	/*
+	 * Read operands
+	 */
+
+	if ( (ret=sieve_opr_string_read(renv, address, "path", &path)) <= 0 )
+		return ret;
+
+	if ( (ret=sieve_opr_string_read(renv, address, "data", &data)) <= 0 )
+		return ret;
+
+	/*
+	 * Perform operation
+	 */
+
+	if ( sieve_runtime_trace_active(renv, SIEVE_TRLVL_COMMANDS) ) {
+		sieve_runtime_trace(renv, 0, "testsuite/test_file_write command");
+		sieve_runtime_trace_descend(renv);
+		sieve_runtime_trace(renv, 0, "write file `%s'", str_c(path));
+	}
+
+	file = t_strconcat(testsuite_tmp_dir_get(), "/", str_c(path), NULL);
+	tmp_file = t_strconcat(file, ".tmp", NULL);
+
+	p = strrchr(file, '/');
+	if ( mkdir_parents(t_strdup_until(file, p), 0700) < 0 &&
+		errno != EEXIST ) {
+		testsuite_test_failf("test_file_write: "
+			"failed to create directory for `%s': %m", str_c(path));
+		return SIEVE_EXEC_OK;
+	}
+
+	/* Replace the file the way the storage does, so that anything still
+	   mapping the old file is not affected */
+	if ( (fd=open(tmp_file, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0 ) {
+		testsuite_test_failf("test_file_write: "
+			"open(%s) failed: %m", str_c(path));
+		return SIEVE_EXEC_OK;
+	}
+	if ( write_full(fd, str_data(data), str_len(data)) < 0 ) {
+		testsuite_test_failf("test_file_write: "
+			"write(%s) failed: %m", str_c(path));
+	}
+	if ( close(fd) < 0 ) {
+		testsuite_test_failf("test_file_write: "
+			"close(%s) failed: %m", str_c(path));
+	}
+	if ( rename(tmp_file, file) < 0 ) {
+		testsuite_test_failf("test_file_write: "
+			"rename(%s) failed: %m", str_c(path));
+	}
+
+	return SIEVE_EXEC_OK;
+}
@@ -75,7 +75,9 @@ const struct sieve_operation_def *testsuite_operations[] = {
 	&test_mailbox_delete_operation,
 	&test_binary_load_operation,
 	&test_binary_save_operation,
-	&test_imap_metadata_set_operation
+	&test_imap_metadata_set_operation,
+	&test_script_open_operation,
+	&test_file_write_operation
 };
 
 /*
@@ -136,8 +138,10 @@ static bool ext_testsuite_validator_load
 	sieve_validator_register_command(valdtr, ext, &cmd_test_binary_load);
 	sieve_validator_register_command(valdtr, ext, &cmd_test_binary_save);
 	sieve_validator_register_command(valdtr, ext, &cmd_test_imap_metadata_set);
+	sieve_validator_register_command(valdtr, ext, &cmd_test_file_write);
 
 	sieve_validator_register_command(valdtr, ext, &tst_test_script_compile);
+	sieve_validator_register_command(valdtr, ext, &tst_test_script_open);
 	sieve_validator_register_command(valdtr, ext, &tst_test_script_run);
 	sieve_validator_register_command(valdtr, ext, &tst_test_multiscript);
 	sieve_validator_register_command(valdtr, ext, &tst_test_error);
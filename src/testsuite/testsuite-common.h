@@ -79,12 +79,14 @@ extern const struct sieve_command_def cmd_test_mailbox_delete;
 extern const struct sieve_command_def cmd_test_binary_load;
 extern const struct sieve_command_def cmd_test_binary_save;
 extern const struct sieve_command_def cmd_test_imap_metadata_set;
+extern const struct sieve_command_def cmd_test_file_write;
 
 /*
  * Tests
  */
 
 extern const struct sieve_command_def tst_test_script_compile;
+extern const struct sieve_command_def tst_test_script_open;
 extern const struct sieve_command_def tst_test_script_run;
 extern const struct sieve_command_def tst_test_multiscript;
 extern const struct sieve_command_def tst_test_error;
@@ -118,7 +120,9 @@ enum testsuite_operation_code {
 	TESTSUITE_OPERATION_TEST_MAILBOX_DELETE,
 	TESTSUITE_OPERATION_TEST_BINARY_LOAD,
 	TESTSUITE_OPERATION_TEST_BINARY_SAVE,
-	TESTSUITE_OPERATION_TEST_IMAP_METADATA_SET
+	TESTSUITE_OPERATION_TEST_IMAP_METADATA_SET,
+	TESTSUITE_OPERATION_TEST_SCRIPT_OPEN,
+	TESTSUITE_OPERATION_TEST_FILE_WRITE
 };
 
 extern const struct sieve_operation_def test_operation;
@@ -144,6 +148,8 @@ extern const struct sieve_operation_def test_mailbox_delete_operation;
 extern const struct sieve_operation_def test_binary_load_operation;
 extern const struct sieve_operation_def test_binary_save_operation;
 extern const struct sieve_operation_def test_imap_metadata_set_operation;
+extern const struct sieve_operation_def test_script_open_operation;
+extern const struct sieve_operation_def test_file_write_operation;
 
 /*
  * Operands
@@ -0,0 +1,80 @@
+/* Copyright (c) 2002-2018 Pigeonhole authors, see the included COPYING file
+ */
+
+#include "lib.h"
+#include "mail-user.h"
+
+#include "sieve-common.h"
+#include "sieve-settings.h"
+#include "sieve-duplicate.h"
+
+#include "testsuite-common.h"
+#include "testsuite-duplicate.h"
+
+static struct sieve_script_env *testsuite_duplicate_senv = NULL;
+static struct sieve_duplicate_db *testsuite_duplicate_db = NULL;
+static char *testsuite_duplicate_user = NULL;
+
+/*
+ * Initialize
+ */
+
+void testsuite_duplicate_init(struct sieve_script_env *senv)
+{
+	testsuite_duplicate_senv = senv;
+	testsuite_duplicate_reload();
+}
+
+void testsuite_duplicate_deinit(void)
+{
+	if ( testsuite_duplicate_db != NULL )
+		sieve_duplicate_db_close(&testsuite_duplicate_db);
+	if ( testsuite_duplicate_senv != NULL )
+		testsuite_duplicate_senv->duplicate_db = NULL;
+	testsuite_duplicate_senv = NULL;
+	i_free(testsuite_duplicate_user);
+}
+
+/*
+ * Configuration
+ */
+
+void testsuite_duplicate_reload(void)
+{
+	struct sieve_instance *svinst = testsuite_sieve_instance;
+	const char *location, *username;
+
+	if ( testsuite_duplicate_senv == NULL )
+		return;
+
+	if ( testsuite_duplicate_db != NULL )
+		sieve_duplicate_db_close(&testsuite_duplicate_db);
+
+	/* The configured path is taken relative to the testsuite's temporary
+	   directory */
+	location = sieve_setting_get(svinst, "sieve_duplicate_db");
+	if ( location != NULL && *location != '\0' ) {
+		const char *driver = "", *p;
+
+		p = strchr(location, ':');
+		if ( p != NULL ) {
+			driver = t_strdup_until(location, p + 1);
+			location = p + 1;
+		}
+		username = testsuite_duplicate_user;
+		if ( username == NULL )
+			username = testsuite_duplicate_senv->user->username;
+		testsuite_duplicate_db = sieve_duplicate_db_open(svinst,
+			t_strconcat(driver, testsuite_tmp_dir_get(), "/", location, NULL),
+			username);
+	}
+
+	testsuite_duplicate_senv->duplicate_db = testsuite_duplicate_db;
+}
+
+void testsuite_duplicate_set_user(const char *username)
+{
+	i_free(testsuite_duplicate_user);
+	testsuite_duplicate_user = i_strdup(username);
+	testsuite_duplicate_reload();
+}
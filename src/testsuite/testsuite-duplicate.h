@@ -0,0 +1,25 @@
+/* Copyright (c) 2002-2018 Pigeonhole authors, see the included COPYING file
+ */
+
+#ifndef __TESTSUITE_DUPLICATE_H
+#define __TESTSUITE_DUPLICATE_H
+
+#include "sieve-common.h"
+
+/*
+ * Duplicate database
+ */
+
+/* The sieve_duplicate_db setting names a file in the testsuite temporary
+   directory; it is (re)opened for the script environment at initialization
+   and by test_config_reload. Without it, duplicate checking is unavailable.
+   The database is opened for the testsuite's mail user, unless another user
+   is set with test_set "duplicate.user". */
+
+void testsuite_duplicate_init(struct sieve_script_env *senv);
+void testsuite_duplicate_deinit(void);
+
+void testsuite_duplicate_reload(void);
+void testsuite_duplicate_set_user(const char *username);
+
+#endif /* __TESTSUITE_DUPLICATE_H */
@@ -5,6 +5,8 @@
 #include "string.h"
 #include "ostream.h"
 #include "hash.h"
+#include "strnum.h"
+#include "ioloop.h"
 #include "mail-storage.h"
 
 #include "sieve.h"
@@ -19,6 +21,7 @@
 #include "testsuite-common.h"
 #include "testsuite-objects.h"
 #include "testsuite-message.h"
+#include "testsuite-duplicate.h"
 
 /*
  * Testsuite core objects
@@ -26,11 +29,14 @@
 
 enum testsuite_object_code {
 	TESTSUITE_OBJECT_MESSAGE,
-	TESTSUITE_OBJECT_ENVELOPE
+	TESTSUITE_OBJECT_ENVELOPE,
+	TESTSUITE_OBJECT_TIME,
+	TESTSUITE_OBJECT_DUPLICATE
 };
 
 const struct testsuite_object_def *testsuite_core_objects[] = {
-	&message_testsuite_object, &envelope_testsuite_object
+	&message_testsuite_object, &envelope_testsuite_object,
+	&time_testsuite_object, &duplicate_testsuite_object
 };
 
 const unsigned int testsuite_core_objects_count =
@@ -286,6 +292,16 @@ static const char *tsto_envelope_get_member_name(int id);
 static bool tsto_envelope_set_member
 	(const struct sieve_runtime_env *renv, int id, string_t *value);
 
+static int tsto_time_get_member_id(const char *identifier);
+static const char *tsto_time_get_member_name(int id);
+static bool tsto_time_set_member
+	(const struct sieve_runtime_env *renv, int id, string_t *value);
+
+static int tsto_duplicate_get_member_id(const char *identifier);
+static const char *tsto_duplicate_get_member_name(int id);
+static bool tsto_duplicate_set_member
+	(const struct sieve_runtime_env *renv, int id, string_t *value);
+
 const struct testsuite_object_def message_testsuite_object = {
 	SIEVE_OBJECT("message",
 		&testsuite_object_operand, TESTSUITE_OBJECT_MESSAGE),
@@ -300,6 +316,22 @@ const struct testsuite_object_def envelope_testsuite_object = {
 	.set_member = tsto_envelope_set_member
 };
 
+const struct testsuite_object_def time_testsuite_object = {
+	SIEVE_OBJECT("time",
+		&testsuite_object_operand, TESTSUITE_OBJECT_TIME),
+	.get_member_id = tsto_time_get_member_id,
+	.get_member_name = tsto_time_get_member_name,
+	.set_member = tsto_time_set_member
+};
+
+const struct testsuite_object_def duplicate_testsuite_object = {
+	SIEVE_OBJECT("duplicate",
+		&testsuite_object_operand, TESTSUITE_OBJECT_DUPLICATE),
+	.get_member_id = tsto_duplicate_get_member_id,
+	.get_member_name = tsto_duplicate_get_member_name,
+	.set_member = tsto_duplicate_set_member
+};
+
 enum testsuite_object_envelope_field {
 	TESTSUITE_OBJECT_ENVELOPE_FROM,
 	TESTSUITE_OBJECT_ENVELOPE_TO,
@@ -367,3 +399,78 @@ static bool tsto_envelope_set_member
 
 	return FALSE;
 }
+
+enum testsuite_object_time_field {
+	TESTSUITE_OBJECT_TIME_ADVANCE
+};
+
+static int tsto_time_get_member_id(const char *identifier)
+{
+	if ( strcasecmp(identifier, "advance") == 0 )
+		return TESTSUITE_OBJECT_TIME_ADVANCE;
+
+	return -1;
+}
+
+static const char *tsto_time_get_member_name(int id)
+{
+	switch ( id ) {
+	case TESTSUITE_OBJECT_TIME_ADVANCE:
+		return "advance";
+	}
+
+	return NULL;
+}
+
+static bool tsto_time_set_member
+(const struct sieve_runtime_env *renv ATTR_UNUSED, int id, string_t *value)
+{
+	unsigned int secs;
+
+	switch ( id ) {
+	case TESTSUITE_OBJECT_TIME_ADVANCE:
+		/* Moves the clock used for timestamps forward, e.g. to make
+		   duplicate tracking entries expire */
+		if ( str_to_uint(str_c(value), &secs) < 0 )
+			return FALSE;
+		ioloop_time += secs;
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+enum testsuite_object_duplicate_field {
+	TESTSUITE_OBJECT_DUPLICATE_USER
+};
+
+static int tsto_duplicate_get_member_id(const char *identifier)
+{
+	if ( strcasecmp(identifier, "user") == 0 )
+		return TESTSUITE_OBJECT_DUPLICATE_USER;
+
+	return -1;
+}
+
+static const char *tsto_duplicate_get_member_name(int id)
+{
+	switch ( id ) {
+	case TESTSUITE_OBJECT_DUPLICATE_USER:
+		return "user";
+	}
+
+	return NULL;
+}
+
+static bool tsto_duplicate_set_member
+(const struct sieve_runtime_env *renv ATTR_UNUSED, int id, string_t *value)
+{
+	switch ( id ) {
+	case TESTSUITE_OBJECT_DUPLICATE_USER:
+		/* Reopens the duplicate database for another user */
+		testsuite_duplicate_set_user(str_c(value));
+		return TRUE;
+	}
+
+	return FALSE;
+}
@@ -82,5 +82,7 @@ const char *testsuite_object_member_name
 
 extern const struct testsuite_object_def message_testsuite_object;
 extern const struct testsuite_object_def envelope_testsuite_object;
+extern const struct testsuite_object_def time_testsuite_object;
+extern const struct testsuite_object_def duplicate_testsuite_object;
 
 #endif /* __TESTSUITE_OBJECTS_H */
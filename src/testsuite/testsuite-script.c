@@ -2,6 +2,7 @@
  */
 
 #include "lib.h"
+#include "smtp-address.h"
 
 #include "sieve.h"
 #include "sieve-common.h"
@@ -10,6 +11,7 @@
 #include "sieve-interpreter.h"
 #include "sieve-runtime-trace.h"
 #include "sieve-result.h"
+#include "sieve-store-session.h"
 
 #include "testsuite-common.h"
 #include "testsuite-settings.h"
@@ -22,6 +24,10 @@
  * Tested script environment
  */
 
+static unsigned int testsuite_batch_message_reads = 0;
+static unsigned int testsuite_store_mailboxes = 0;
+static unsigned int testsuite_store_commits = 0;
+
 void testsuite_script_init(void)
 {
 }
@@ -30,6 +36,22 @@ void testsuite_script_deinit(void)
 {
 }
 
+static const char *_testsuite_script_path
+(const struct sieve_runtime_env *renv, const char *script)
+{
+	const char *script_path;
+
+	/* Relative paths are taken relative to the test script */
+	if ( *script == '/' )
+		return script;
+
+	script_path = sieve_file_script_get_dirpath(renv->script);
+	if ( script_path == NULL )
+		return NULL;
+
+	return t_strconcat(script_path, "/", script, NULL);
+}
+
 static struct sieve_binary *_testsuite_script_compile
 (const struct sieve_runtime_env *renv, const char *script)
 {
@@ -39,12 +61,10 @@ static struct sieve_binary *_testsuite_script_compile
 
 	sieve_runtime_trace(renv, SIEVE_TRLVL_TESTS, "compile script `%s'", script);
 
-	script_path = sieve_file_script_get_dirpath(renv->script);
+	script_path = _testsuite_script_path(renv, script);
 	if ( script_path == NULL )
 		return NULL;
 
-	script_path = t_strconcat(script_path, "/", script, NULL);
-
 	if ( (sbin = sieve_compile
 		(svinst, script_path, NULL, testsuite_log_ehandler, 0, NULL)) == NULL )
 		return NULL;
@@ -73,6 +93,40 @@ bool testsuite_script_compile
 	return TRUE;
 }
 
+bool testsuite_script_open
+(const struct sieve_runtime_env *renv, const char *script)
+{
+	struct sieve_instance *svinst = testsuite_sieve_instance;
+	struct testsuite_interpreter_context *ictx =
+		testsuite_interpreter_context_get(renv->interp, testsuite_ext);
+	struct sieve_binary *sbin;
+	const char *script_path;
+
+	i_assert(ictx != NULL);
+	testsuite_log_clear_messages();
+
+	sieve_runtime_trace(renv, SIEVE_TRLVL_TESTS, "open script `%s'", script);
+
+	script_path = _testsuite_script_path(renv, script);
+	if ( script_path == NULL )
+		return FALSE;
+
+	if ( (sbin = sieve_open
+		(svinst, script_path, NULL, testsuite_log_ehandler, 0, NULL)) == NULL )
+		return FALSE;
+
+	/* Store a freshly compiled binary, like a delivery does */
+	if ( !sieve_is_loaded(sbin) )
+		(void)sieve_save(sbin, FALSE, NULL);
+
+	if ( ictx->compiled_script != NULL ) {
+		sieve_binary_unref(&ictx->compiled_script);
+	}
+
+	ictx->compiled_script = sbin;
+	return TRUE;
+}
+
 bool testsuite_script_is_subtest(const struct sieve_runtime_env *renv)
 {
 	struct testsuite_interpreter_context *ictx =
@@ -121,6 +175,7 @@ bool testsuite_script_run(const struct sieve_runtime_env *renv)
 	scriptenv.smtp_finish = NULL;
 	scriptenv.duplicate_mark = NULL;
 	scriptenv.duplicate_check = NULL;
+	scriptenv.duplicate_db = senv->duplicate_db;
 	scriptenv.trace_log = renv->scriptenv->trace_log;
 	scriptenv.trace_config = renv->scriptenv->trace_config;
 
@@ -170,17 +225,66 @@ void testsuite_script_set_binary
  * Multiscript
  */
 
-bool testsuite_script_multiscript
-(const struct sieve_runtime_env *renv, ARRAY_TYPE (const_string) *scriptfiles)
+static bool _testsuite_script_multiscript
+(const struct sieve_runtime_env *renv,
+	const struct sieve_message_data *msgdata,
+	const struct sieve_script_env *scriptenv,
+	struct sieve_multiscript_batch *batch,
+	const char *const *scripts, unsigned int count)
 {
 	struct sieve_instance *svinst = testsuite_sieve_instance;
+	struct sieve_multiscript *mscript;
+	unsigned int i;
+	bool more = TRUE;
+	bool result = TRUE;
+
+	/* Start execution */
+
+	if ( batch == NULL )
+		mscript = sieve_multiscript_start_execute(svinst, msgdata, scriptenv);
+	else {
+		mscript = sieve_multiscript_batch_start_execute
+			(batch, svinst, msgdata, scriptenv);
+	}
+
+	/* Execute scripts before main script */
+
+	for ( i = 0; i < count && more; i++ ) {
+		struct sieve_binary *sbin = NULL;
+		const char *script = scripts[i];
+
+		/* Open */
+		if ( (sbin=_testsuite_script_compile(renv, script)) == NULL ) {
+			result = FALSE;
+			break;
+		}
+
+		/* Execute */
+
+		sieve_runtime_trace(renv, SIEVE_TRLVL_TESTS, "run script `%s'", script);
+
+		more = sieve_multiscript_run(mscript, sbin,
+			testsuite_log_ehandler, testsuite_log_ehandler, 0);
+
+		sieve_close(&sbin);
+	}
+
+	return ( sieve_multiscript_finish
+		(&mscript, testsuite_log_ehandler, 0, NULL) > 0	&& result );
+}
+
+bool testsuite_script_multiscript
+(const struct sieve_runtime_env *renv, ARRAY_TYPE (const_string) *scriptfiles,
+	ARRAY_TYPE (const_string) *recipients)
+{
 	const struct sieve_script_env *senv = renv->scriptenv;
 	struct sieve_script_env scriptenv;
-	struct sieve_multiscript *mscript;
-	const char *const *scripts;
+	struct sieve_multiscript_batch *batch;
+	struct sieve_store_session *store_session;
+	const char *const *scripts, *const *rcpts;
 	const char *error;
-	unsigned int count, i;
-	bool more = TRUE;
+	bool temp_error;
+	unsigned int count, rcpt_count, i;
 	bool result = TRUE;
 
 	testsuite_log_clear_messages();
@@ -199,37 +303,78 @@ bool testsuite_script_multiscript
 	scriptenv.smtp_finish = NULL;
 	scriptenv.duplicate_mark = NULL;
 	scriptenv.duplicate_check = NULL;
+	scriptenv.duplicate_db = senv->duplicate_db;
 	scriptenv.trace_log = renv->scriptenv->trace_log;
 	scriptenv.trace_config = renv->scriptenv->trace_config;
 
-	/* Start execution */
-
-	mscript = sieve_multiscript_start_execute(svinst, renv->msgdata, &scriptenv);
-
-	/* Execute scripts before main script */
-
 	scripts = array_get(scriptfiles, &count);
 
-	for ( i = 0; i < count && more; i++ ) {
-		struct sieve_binary *sbin = NULL;
-		const char *script = scripts[i];
+	if ( recipients == NULL ) {
+		return _testsuite_script_multiscript
+			(renv, renv->msgdata, &scriptenv, NULL, scripts, count);
+	}
 
-		/* Open */
-		if ( (sbin=_testsuite_script_compile(renv, script)) == NULL ) {
+	/* Deliver the message to several recipients, which share the parsed
+	   message through a batch and the mailboxes through a store session */
+
+	batch = sieve_multiscript_batch_create(renv->msgdata->mail);
+	store_session = sieve_store_session_create();
+	scriptenv.store_session = store_session;
+
+	rcpts = array_get(recipients, &rcpt_count);
+	for ( i = 0; i < rcpt_count && result; i++ ) {
+		struct sieve_message_data msgdata = *renv->msgdata;
+		struct smtp_address *rcpt_to;
+
+		if ( smtp_address_parse_path(pool_datastack_create(), rcpts[i],
+			SMTP_ADDRESS_PARSE_FLAG_ALLOW_LOCALPART |
+			SMTP_ADDRESS_PARSE_FLAG_BRACKETS_OPTIONAL,
+			&rcpt_to, &error) < 0 ) {
+			sieve_runtime_error(renv, NULL,
+				"testsuite: recipient address `%s' is invalid: %s",
+				rcpts[i], error);
 			result = FALSE;
 			break;
 		}
+		msgdata.envelope.rcpt_to = rcpt_to;
 
-		/* Execute */
-
-		sieve_runtime_trace(renv, SIEVE_TRLVL_TESTS, "run script `%s'", script);
+		sieve_runtime_trace(renv, SIEVE_TRLVL_TESTS,
+			"deliver to recipient `%s'", rcpts[i]);
 
-		more = sieve_multiscript_run(mscript, sbin,
-			testsuite_log_ehandler, testsuite_log_ehandler, 0);
+		result = _testsuite_script_multiscript
+			(renv, &msgdata, &scriptenv, batch, scripts, count);
+	}
 
-		sieve_close(&sbin);
+	if ( result && sieve_store_session_commit
+		(store_session, &error, &temp_error) < 0 ) {
+		sieve_runtime_error(renv, NULL,
+			"testsuite: %s", error);
+		result = FALSE;
 	}
 
-	return ( sieve_multiscript_finish
-		(&mscript, testsuite_log_ehandler, 0, NULL) > 0	&& result );
+	testsuite_batch_message_reads =
+		sieve_multiscript_batch_get_message_reads(batch);
+	testsuite_store_mailboxes =
+		sieve_store_session_get_mailbox_count(store_session);
+	testsuite_store_commits =
+		sieve_store_session_get_commit_count(store_session);
+
+	sieve_store_session_free(&store_session);
+	sieve_multiscript_batch_free(&batch);
+	return result;
+}
+
+unsigned int testsuite_script_batch_message_reads(void)
+{
+	return testsuite_batch_message_reads;
+}
+
+unsigned int testsuite_script_store_mailboxes(void)
+{
+	return testsuite_store_mailboxes;
+}
+
+unsigned int testsuite_script_store_commits(void)
+{
+	return testsuite_store_commits;
 }
@@ -13,11 +13,17 @@ bool testsuite_script_is_subtest(const struct sieve_runtime_env *renv);
 
 bool testsuite_script_compile
 	(const struct sieve_runtime_env *renv, const char *script);
+bool testsuite_script_open
+	(const struct sieve_runtime_env *renv, const char *script);
 bool testsuite_script_run
 	(const struct sieve_runtime_env *renv);
 bool testsuite_script_multiscript
 	(const struct sieve_runtime_env *renv,
-		ARRAY_TYPE (const_string) *scriptfiles);
+		ARRAY_TYPE (const_string) *scriptfiles,
+		ARRAY_TYPE (const_string) *recipients) ATTR_NULL(3);
+unsigned int testsuite_script_batch_message_reads(void);
+unsigned int testsuite_script_store_mailboxes(void);
+unsigned int testsuite_script_store_commits(void);
 
 struct sieve_binary *testsuite_script_get_binary(const struct sieve_runtime_env *renv);
 void testsuite_script_set_binary(const struct sieve_runtime_env *renv, struct sieve_binary *sbin);
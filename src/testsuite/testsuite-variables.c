@@ -12,10 +12,12 @@
 #include "sieve-generator.h"
 #include "sieve-interpreter.h"
 #include "sieve-dump.h"
+#include "sieve-programs.h"
 
 #include "sieve-ext-variables.h"
 
 #include "testsuite-common.h"
+#include "testsuite-script.h"
 #include "testsuite-variables.h"
 
 /*
@@ -149,8 +151,34 @@ int testsuite_varnamespace_read_variable
 	}
 
 	if ( str_r != NULL ) {
+		struct sieve_program_stats stats;
+		const char *value = NULL;
+
 		if ( strcmp(str_c(var_name), "path") == 0 )
-			*str_r = t_str_new_const(testsuite_test_path, strlen(testsuite_test_path));
+			value = testsuite_test_path;
+		else if ( strcmp(str_c(var_name), "tmp") == 0 )
+			value = testsuite_tmp_dir_get();
+		else if ( strcmp(str_c(var_name), "binary_cache_hits") == 0 ) {
+			value = dec2str
+				(sieve_binary_cache_hits(testsuite_sieve_instance));
+		}
+		else if ( strcmp(str_c(var_name), "batch_message_reads") == 0 )
+			value = dec2str(testsuite_script_batch_message_reads());
+		else if ( strcmp(str_c(var_name), "store_mailboxes") == 0 )
+			value = dec2str(testsuite_script_store_mailboxes());
+		else if ( strcmp(str_c(var_name), "store_commits") == 0 )
+			value = dec2str(testsuite_script_store_commits());
+		else if ( strcmp(str_c(var_name), "program_runs") == 0 ) {
+			sieve_program_stats_get(NULL, &stats);
+			value = dec2str(stats.runs + stats.failures);
+		}
+		else if ( strcmp(str_c(var_name), "program_location_hits") == 0 ) {
+			sieve_program_stats_get(NULL, &stats);
+			value = dec2str(stats.location_hits);
+		}
+
+		if ( value != NULL )
+			*str_r = t_str_new_const(value, strlen(value));
 		else
 			*str_r = NULL;
 	}
@@ -24,6 +24,7 @@
 #include "testsuite-result.h"
 #include "testsuite-message.h"
 #include "testsuite-smtp.h"
+#include "testsuite-duplicate.h"
 #include "testsuite-mailstore.h"
 
 #include <stdio.h>
@@ -197,6 +198,8 @@ int main(int argc, char **argv)
 
 		testsuite_scriptenv = &scriptenv;
 
+		testsuite_duplicate_init(&scriptenv);
+
 		testsuite_result_init();
 
 		/* Run the test */
@@ -219,6 +222,7 @@ int main(int argc, char **argv)
 		sieve_close(&sbin);
 
 		/* De-initialize message environment */
+		testsuite_duplicate_deinit();
 		testsuite_message_deinit();
 		testsuite_mailstore_deinit();
 		testsuite_result_deinit();
@@ -20,9 +20,13 @@
  * Test_multiscript command
  *
  * Syntax:
- *   test_multiscript <scripts: string-list>
+ *   test_multiscript [:recipients <recipients: string-list>]
+ *     <scripts: string-list>
  */
 
+static bool tst_test_multiscript_registered
+	(struct sieve_validator *validator, const struct sieve_extension *ext,
+		struct sieve_command_registration *cmd_reg);
 static bool tst_test_multiscript_validate
 	(struct sieve_validator *validator, struct sieve_command *cmd);
 static bool tst_test_multiscript_generate
@@ -35,6 +39,7 @@ const struct sieve_command_def tst_test_multiscript = {
 	.subtests = 0,
 	.block_allowed = FALSE,
 	.block_required = FALSE,
+	.registered = tst_test_multiscript_registered,
 	.validate = tst_test_multiscript_validate,
 	.generate = tst_test_multiscript_generate,
 };
@@ -56,6 +61,58 @@ const struct sieve_operation_def test_multiscript_operation = {
 	.execute = tst_test_multiscript_operation_execute
 };
 
+/*
+ * Tagged arguments
+ */
+
+static bool tst_test_multiscript_validate_recipients_tag
+	(struct sieve_validator *validator, struct sieve_ast_argument **arg,
+		struct sieve_command *cmd);
+
+static const struct sieve_argument_def test_multiscript_recipients_tag = {
+	.identifier = "recipients",
+	.validate = tst_test_multiscript_validate_recipients_tag
+};
+
+enum tst_test_multiscript_optional {
+	OPT_END,
+	OPT_RECIPIENTS
+};
+
+static bool tst_test_multiscript_validate_recipients_tag
+(struct sieve_validator *validator, struct sieve_ast_argument **arg,
+	struct sieve_command *cmd)
+{
+	struct sieve_ast_argument *tag = *arg;
+
+	/* Detach the tag itself */
+	*arg = sieve_ast_arguments_detach(*arg,1);
+
+	/* Check syntax:
+	 *   :recipients string-list
+	 */
+	if ( !sieve_validate_tag_parameter
+		(validator, cmd, tag, *arg, NULL, 0, SAAT_STRING_LIST, FALSE) ) {
+		return FALSE;
+	}
+
+	/* Skip parameter */
+	*arg = sieve_ast_argument_next(*arg);
+
+	return TRUE;
+}
+
+static bool tst_test_multiscript_registered
+(struct sieve_validator *validator, const struct sieve_extension *ext,
+	struct sieve_command_registration *cmd_reg)
+{
+	sieve_validator_register_tag
+		(validator, cmd_reg, ext, &test_multiscript_recipients_tag,
+			OPT_RECIPIENTS);
+
+	return TRUE;
+}
+
 /*
  * Validation
  */
@@ -93,9 +150,30 @@ static bool tst_test_multiscript_generate
 static bool tst_test_multiscript_operation_dump
 (const struct sieve_dumptime_env *denv, sieve_size_t *address)
 {
+	int opt_code = 0;
+
 	sieve_code_dumpf(denv, "TEST_MULTISCRIPT:");
 	sieve_code_descend(denv);
 
+	/* Dump optional operands */
+	for (;;) {
+		int opt;
+
+		if ( (opt=sieve_opr_optional_dump(denv, address, &opt_code)) < 0 )
+			return FALSE;
+
+		if ( opt == 0 ) break;
+
+		switch ( opt_code ) {
+		case OPT_RECIPIENTS:
+			if ( !sieve_opr_stringlist_dump(denv, address, "recipients") )
+				return FALSE;
+			break;
+		default:
+			return FALSE;
+		}
+	}
+
 	if ( !sieve_opr_stringlist_dump(denv, address, "scripts") )
 		return FALSE;
 
@@ -109,9 +187,10 @@ static bool tst_test_multiscript_operation_dump
 static int tst_test_multiscript_operation_execute
 (const struct sieve_runtime_env *renv, sieve_size_t *address)
 {
-	struct sieve_stringlist *scripts_list;
-	string_t *script_name;
-	ARRAY_TYPE (const_string) scriptfiles;
+	struct sieve_stringlist *scripts_list, *rcpts_list = NULL;
+	string_t *script_name, *rcpt;
+	ARRAY_TYPE (const_string) scriptfiles, recipients;
+	int opt_code = 0;
 	bool result = TRUE;
 	int ret;
 
@@ -119,6 +198,28 @@ static int tst_test_multiscript_operation_execute
 	 * Read operands
 	 */
 
+	/* Optional operands */
+	for (;;) {
+		int opt;
+
+		if ( (opt=sieve_opr_optional_read(renv, address, &opt_code)) < 0 )
+			return SIEVE_EXEC_BIN_CORRUPT;
+
+		if ( opt == 0 ) break;
+
+		switch ( opt_code ) {
+		case OPT_RECIPIENTS:
+			if ( (ret=sieve_opr_stringlist_read
+				(renv, address, "recipients", &rcpts_list)) <= 0 )
+				return ret;
+			break;
+		default:
+			sieve_runtime_trace_error(renv,
+				"unknown optional operand");
+			return SIEVE_EXEC_BIN_CORRUPT;
+		}
+	}
+
 	if ( (ret=sieve_opr_stringlist_read(renv, address, "scripts", &scripts_list))
 		<= 0 )
 		return ret;
@@ -141,8 +242,20 @@ static int tst_test_multiscript_operation_execute
 		array_append(&scriptfiles, &script, 1);
 	}
 
+	if ( result && ret >= 0 && rcpts_list != NULL ) {
+		t_array_init(&recipients, 4);
+
+		rcpt = NULL;
+		while ( (ret=sieve_stringlist_next_item(rcpts_list, &rcpt)) > 0 ) {
+			const char *recipient = t_strdup(str_c(rcpt));
+
+			array_append(&recipients, &recipient, 1);
+		}
+	}
+
 	result = result && (ret >= 0) &&
-		testsuite_script_multiscript(renv, &scriptfiles);
+		testsuite_script_multiscript(renv, &scriptfiles,
+			( rcpts_list == NULL ? NULL : &recipients ));
 
 	/* Set result */
 	sieve_interpreter_set_test_result(renv->interp, result);